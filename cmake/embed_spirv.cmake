@@ -0,0 +1,27 @@
+# Turns a SPIR-V binary into a header with a constexpr word array.
+#
+#   cmake -DINPUT=<file.spv> -DOUTPUT=<file.hpp> -DNAME=<identifier>
+#         -P embed_spirv.cmake
+
+file(READ ${INPUT} contents HEX)
+
+# SPIR-V is stored little-endian, flip every 4 bytes into a 32-bit literal
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1," words "${contents}")
+# Keep the generated lines reasonably short
+string(REPEAT "0x........," 8 line_pattern)
+string(REGEX REPLACE "(${line_pattern})" "\\1\n    " words "${words}")
+
+file(WRITE ${OUTPUT}
+"#pragma once
+
+// Generated from ${INPUT}, do not edit.
+
+#include <cstdint>
+
+namespace retort::builtins {
+
+constexpr uint32_t ${NAME}[] = {
+    ${words}};
+
+} // namespace retort::builtins
+")
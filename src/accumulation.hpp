@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "memory.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// Edge length of a tile in pixels when rendering under a time budget.
+const uint32_t ACCUMULATION_TILE_SIZE = 128;
+
+// How much a new per tile GPU time moves the estimate the budget is split by.
+const double TILE_TIME_SMOOTHING = 0.25;
+
+struct AccumulationSettings {
+  bool is_enabled = false;
+  // Samples after which the image is left as it is
+  uint32_t sample_limit = 1024;
+  // Draws only as many tiles per frame as fit, instead of the whole image
+  std::optional<double> tile_budget_ms;
+};
+
+// A float image a window's shader keeps blending new samples into, which is
+// what the window shows. Each sample is weighted by 1 / (samples + 1) with the
+// blend constants, so the image is always the mean of all samples so far.
+struct AccumulationTarget {
+  Image color;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  bool needs_clear = true;
+
+  uint32_t samples = 0;
+  // The first tile of the sample in progress that has not been drawn
+  uint32_t next_tile = 0;
+  // Shaders see the time accumulation started at and the sample as the frame
+  float time = 0.f;
+
+  double ms_per_tile = 0.;
+  // Tiles drawn in each frame slot, for the timestamps of that slot
+  std::vector<uint32_t> slot_tiles;
+};
+
+// The first of these that can be blended into and blitted from.
+VkFormat pick_accumulation_format(VkPhysicalDevice physical_device) {
+  const VkFormatFeatureFlags REQUIRED =
+      VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT |
+      VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+  for (auto format :
+       {VK_FORMAT_R32G32B32A32_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT}) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device, format, &properties);
+    if ((properties.optimalTilingFeatures & REQUIRED) == REQUIRED)
+      return format;
+  }
+  PANIC("NO FLOAT FORMAT TO ACCUMULATE INTO");
+}
+
+// Keeps what is already in the image and leaves it ready to be blitted.
+// Compatible with no other render pass, pipelines need one of their own.
+VkRenderPass create_accumulation_render_pass(vkb::DispatchTable &dispatch,
+                                             VkFormat format) {
+  VkAttachmentDescription color_attachment = {};
+  color_attachment.format = format;
+  color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  color_attachment.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  color_attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  VkAttachmentReference color_attachment_ref = {};
+  color_attachment_ref.attachment = 0;
+  color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color_attachment_ref;
+
+  VkSubpassDependency dependencies[2] = {};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[0].srcAccessMask =
+      VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  VkRenderPassCreateInfo render_pass_info = {};
+  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  render_pass_info.attachmentCount = 1;
+  render_pass_info.pAttachments = &color_attachment;
+  render_pass_info.subpassCount = 1;
+  render_pass_info.pSubpasses = &subpass;
+  render_pass_info.dependencyCount = 2;
+  render_pass_info.pDependencies = dependencies;
+
+  VkRenderPass render_pass;
+  CHECK_VK_ERRC(
+      dispatch.createRenderPass(&render_pass_info, nullptr, &render_pass));
+  return render_pass;
+}
+
+AccumulationTarget
+create_accumulation_target(vkb::DispatchTable &dispatch,
+                           const VkPhysicalDeviceMemoryProperties &props,
+                           VkRenderPass render_pass, VkFormat format,
+                           VkExtent2D extent, size_t frame_count) {
+  AccumulationTarget target;
+  target.slot_tiles.assign(frame_count, 0);
+  target.color = create_image(dispatch, props, format, extent,
+                              VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                  VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                  VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+  VkFramebufferCreateInfo framebuffer_info = {};
+  framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebuffer_info.renderPass = render_pass;
+  framebuffer_info.attachmentCount = 1;
+  framebuffer_info.pAttachments = &target.color.view;
+  framebuffer_info.width = extent.width;
+  framebuffer_info.height = extent.height;
+  framebuffer_info.layers = 1;
+  CHECK_VK_ERRC(dispatch.createFramebuffer(&framebuffer_info, nullptr,
+                                           &target.framebuffer));
+  return target;
+}
+
+void destroy_accumulation_target(vkb::DispatchTable &dispatch,
+                                 AccumulationTarget &target) {
+  dispatch.destroyFramebuffer(target.framebuffer, nullptr);
+  destroy_image(dispatch, target.color);
+  target = {};
+}
+
+// Starts over with the next frame.
+void reset_accumulation_target(AccumulationTarget &target, float time) {
+  target.needs_clear = true;
+  target.samples = 0;
+  target.next_tile = 0;
+  target.time = time;
+}
+
+uint32_t accumulation_tile_count(VkExtent2D extent) {
+  auto columns = (extent.width + ACCUMULATION_TILE_SIZE - 1) /
+                 ACCUMULATION_TILE_SIZE;
+  auto rows = (extent.height + ACCUMULATION_TILE_SIZE - 1) /
+              ACCUMULATION_TILE_SIZE;
+  return columns * rows;
+}
+
+VkRect2D accumulation_tile(VkExtent2D extent, uint32_t tile) {
+  auto columns = (extent.width + ACCUMULATION_TILE_SIZE - 1) /
+                 ACCUMULATION_TILE_SIZE;
+  auto x = tile % columns * ACCUMULATION_TILE_SIZE;
+  auto y = tile / columns * ACCUMULATION_TILE_SIZE;
+
+  VkRect2D rect = {};
+  rect.offset = {(int32_t)x, (int32_t)y};
+  rect.extent = {std::min(ACCUMULATION_TILE_SIZE, extent.width - x),
+                 std::min(ACCUMULATION_TILE_SIZE, extent.height - y)};
+  return rect;
+}
+
+// Zeroes the image, as a blend weight of zero still turns whatever garbage
+// it held into NaNs.
+void record_accumulation_clear(vkb::DispatchTable &dispatch,
+                               VkCommandBuffer cmd,
+                               const AccumulationTarget &target) {
+  record_image_barrier(dispatch, cmd, target.color.image,
+                       VK_IMAGE_LAYOUT_UNDEFINED,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT);
+
+  VkClearColorValue black = {};
+  VkImageSubresourceRange range = {};
+  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.levelCount = 1;
+  range.layerCount = 1;
+  dispatch.cmdClearColorImage(cmd, target.color.image,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &black, 1,
+                              &range);
+
+  record_image_barrier(dispatch, cmd, target.color.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                           VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+}
+
+// Copies the accumulated image into a swapchain image of the same size,
+// which is left in `TRANSFER_DST_OPTIMAL`.
+void record_accumulation_blit(vkb::DispatchTable &dispatch,
+                              VkCommandBuffer cmd,
+                              const AccumulationTarget &target,
+                              VkImage swapchain_image) {
+  record_image_barrier(dispatch, cmd, swapchain_image,
+                       VK_IMAGE_LAYOUT_UNDEFINED,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT);
+
+  auto extent = target.color.extent;
+  VkImageBlit blit = {};
+  blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  blit.srcSubresource.layerCount = 1;
+  blit.srcOffsets[1] = {(int32_t)extent.width, (int32_t)extent.height, 1};
+  blit.dstSubresource = blit.srcSubresource;
+  blit.dstOffsets[1] = blit.srcOffsets[1];
+  dispatch.cmdBlitImage(cmd, target.color.image,
+                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, swapchain_image,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                        VK_FILTER_NEAREST);
+}
+
+} // namespace retort
@@ -2,77 +2,434 @@
 
 #include <GLFW/glfw3native.h>
 
+#include <algorithm>
 #include <filesystem>
+#include <memory>
 #include <optional>
+#include <vector>
 
+#include "audio.hpp"
+#include "compare.hpp"
+#include "gallery.hpp"
+#include "publish.hpp"
 #include "renderer.hpp"
+#include "replay.hpp"
+#include "threading.hpp"
+#include "tracing.hpp"
 #include "watching.hpp"
 
 #include <WinBase.h>
 
 namespace retort {
 
+// How long an idle on-demand loop sleeps before polling the watched files.
+const double ON_DEMAND_WAKEUP_SECONDS = 0.1;
+
+// ImGui only settles on the frame after the input that changed it.
+const uint32_t INPUT_REDRAW_FRAMES = 2;
+
 struct AppInteractions {
   std::optional<std::filesystem::path> open_file;
+  std::optional<std::filesystem::path> focus_file;
+  std::optional<std::filesystem::path> open_texture;
+  size_t focus_window = 0;
+  bool open_window = false;
+  std::optional<OptimizerRecipe> optimizer_recipe;
+  bool start_comparison = false;
+  bool stop_comparison = false;
+  bool dump_trace = false;
+  std::optional<AccumulationSettings> accumulation;
+  bool reset_accumulation = false;
+  std::optional<bool> show_latency_test;
+  bool is_parameter_changed = false;
 };
 
 struct App {
   bool pressed = 0;
+  bool trace_pressed = 0;
+  ThreadPool thread_pool;
   Renderer renderer;
   FileWatcherPool file_watcher;
+  std::unique_ptr<SharedFramePublisher> publisher;
+  std::unique_ptr<ShaderComparison> comparison;
+  std::unique_ptr<AudioAnalyzer> audio;
+  std::unique_ptr<Gallery> gallery;
+  AudioFrame audio_frame;
+  std::optional<TraceWriter> recorder;
+  std::optional<TraceReplay> replay;
+  // What the trace last had the primary window show, to write reloads too
+  std::string _recorded_shader;
+  VkShaderModule _recorded_module = VK_NULL_HANDLE;
+  std::optional<std::filesystem::path> vertex_shader_path;
+  bool has_reported_vertex_upload = false;
+  // Indices into the shader set
+  size_t comparison_shaders[2] = {0, 1};
+
+  std::vector<std::filesystem::path> shader_set;
 
   bool show_compilation_logs = false;
+  bool show_shader_statistics = false;
+  bool show_comparison = false;
+  bool show_reload_latency = false;
+  bool show_textures = false;
+  bool show_accumulation = false;
+  bool show_input_latency = false;
+  bool show_vertex_stream = false;
+  bool show_parameters = false;
+  bool show_gallery = false;
+  // What the window showed before the latency test pattern replaced it
+  std::optional<std::string> shader_before_latency_test;
+  bool is_on_demand = false;
+  // Set while GLFW handles events, which on Windows it does inside a modal
+  // loop for as long as a window edge is dragged
+  bool is_polling_events = false;
+  // From the GUI drawn inside event callbacks, where GLFW forbids creating
+  // or destroying windows
+  std::vector<AppInteractions> _polled_interactions;
 
   App(Bootstrap bootstrap) : renderer(bootstrap) {
-    glfwSetWindowUserPointer(bootstrap.window, this);
-    glfwSetDropCallback(bootstrap.window, [](GLFWwindow *window, int path_count,
-                                             const char **paths) {
-      EXPECT(path_count == 1);
+    TRACE_THREAD_NAME("main");
+    _install_window_callbacks(bootstrap.window);
+    _install_redraw_callbacks(bootstrap.window, true);
+  }
+
+  // Files dropped onto a window are shown in that window.
+  void _install_window_callbacks(GLFWwindow *window) {
+    glfwSetWindowUserPointer(window, this);
+    glfwSetDropCallback(window, [](GLFWwindow *window, int path_count,
+                                   const char **paths) {
       App *self = (App *)glfwGetWindowUserPointer(window);
+      std::vector<std::filesystem::path> files;
       for (int i = 0; i < path_count; i++) {
         const char *path_cstr = paths[i];
-        auto path = std::filesystem::path(path_cstr);
-        self->add_file(path);
+        files.push_back(std::filesystem::path(path_cstr));
       }
+      self->renderer.focused_window =
+          self->renderer.window_index(window).value_or(0);
+      self->add_files(files);
+    });
+    glfwSetWindowFocusCallback(window, [](GLFWwindow *w, int focused) {
+      App *self = (App *)glfwGetWindowUserPointer(w);
+      if (focused)
+        self->renderer.focused_window =
+            self->renderer.window_index(w).value_or(0);
+      _on_input(w);
+    });
+    glfwSetFramebufferSizeCallback(
+        window, [](GLFWwindow *w, int, int) { _on_input(w); });
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow *w) {
+      _on_input(w);
+      ((App *)glfwGetWindowUserPointer(w))->_draw_while_polling();
+    });
+  }
+
+  // Keeps frames coming while a resize holds up the event loop. Only draws
+  // and presents, the rest waits for the loop to get back.
+  void _draw_while_polling() {
+    if (!is_polling_events || renderer.is_frame_in_progress)
+      return;
+    is_polling_events = false;
+    renderer.mark_inputs_polled();
+    _draw_frame_only(_polled_interactions.emplace_back());
+    is_polling_events = true;
+  }
+
+  static void _on_input(GLFWwindow *window) {
+    App *self = (App *)glfwGetWindowUserPointer(window);
+    self->renderer.request_redraw(INPUT_REDRAW_FRAMES);
+  }
+
+  // Input the GUI does not take starts accumulation over, as it is what a
+  // shader would react to. The GUI only lives in the primary window.
+  static void _on_shader_input(GLFWwindow *window, bool is_mouse) {
+    _on_input(window);
+    App *self = (App *)glfwGetWindowUserPointer(window);
+    auto &io = ImGui::GetIO();
+    if (window == self->renderer.primary_window().window &&
+        (is_mouse ? io.WantCaptureMouse : io.WantCaptureKeyboard))
+      return;
+    self->renderer.reset_accumulation();
+  }
+
+  // Our callbacks go in first so that ImGui chains to them from its own, in
+  // the window that has the GUI.
+  void _install_redraw_callbacks(GLFWwindow *window, bool has_gui) {
+    if (has_gui)
+      ImGui_ImplGlfw_RestoreCallbacks(window);
+
+    glfwSetCursorEnterCallback(window,
+                               [](GLFWwindow *w, int) { _on_input(w); });
+    glfwSetCursorPosCallback(
+        window, [](GLFWwindow *w, double, double) { _on_input(w); });
+    glfwSetMouseButtonCallback(window, [](GLFWwindow *w, int, int, int) {
+      _on_shader_input(w, true);
+    });
+    glfwSetScrollCallback(window, [](GLFWwindow *w, double, double) {
+      _on_shader_input(w, true);
     });
+    glfwSetKeyCallback(window, [](GLFWwindow *w, int, int, int, int) {
+      _on_shader_input(w, false);
+    });
+    glfwSetCharCallback(window,
+                        [](GLFWwindow *w, unsigned int) { _on_input(w); });
+
+    if (has_gui)
+      ImGui_ImplGlfw_InstallCallbacks(window);
+  }
+
+  bool should_close() {
+    return glfwWindowShouldClose(renderer.primary_window().window) ||
+           (replay && replay->is_done());
   }
 
-  bool should_close() { return glfwWindowShouldClose(renderer.window); }
+  bool should_draw() {
+    return !is_on_demand || renderer.needs_redraw() || replay;
+  }
 
   void poll_events() {
-    glfwPollEvents();
-    auto current_press =
-        glfwGetKey(renderer.window, GLFW_KEY_ESCAPE) == GLFW_PRESS;
+    TRACE_SCOPE("App::poll_events");
+
+    is_polling_events = true;
+    if (should_draw()) {
+      glfwPollEvents();
+    } else {
+      TRACE_SCOPE("glfwWaitEventsTimeout");
+      glfwWaitEventsTimeout(ON_DEMAND_WAKEUP_SECONDS);
+    }
+    is_polling_events = false;
+    renderer.mark_inputs_polled();
+
+    for (auto &interactions : _polled_interactions)
+      _apply_interactions(std::move(interactions));
+    _polled_interactions.clear();
+
+    for (size_t i = renderer.windows.size() - 1; i > 0; i--)
+      if (glfwWindowShouldClose(renderer.windows[i]->window))
+        renderer.close_window(i);
+
+    auto primary = renderer.primary_window().window;
+    auto current_press = glfwGetKey(primary, GLFW_KEY_ESCAPE) == GLFW_PRESS;
     if (current_press > pressed)
       renderer.set_imgui_enabled(!renderer.is_imgui_enabled);
     pressed = current_press;
 
+    auto current_trace_press = glfwGetKey(primary, GLFW_KEY_F12) == GLFW_PRESS;
+    if (current_trace_press > trace_pressed)
+      dump_trace();
+    trace_pressed = current_trace_press;
+
     auto changed = file_watcher.poll_files();
     if (changed.size()) {
       auto [_, filepath] = changed[0];
-      _set_focused_shader_file(filepath);
+      if (renderer.textures.find(filepath))
+        add_texture(filepath);
+      else if (filepath == vertex_shader_path)
+        _reload_vertex_shader();
+      else
+        _reload_shader_file(filepath, time_since_write_ms(filepath));
     }
   }
 
   void draw_frame() {
+    TRACE_SCOPE("App::draw_frame");
     AppInteractions interactions;
 
+    if (replay && !replay->is_done())
+      _replay_frame(replay->next());
+    if (gallery)
+      gallery->update();
+    _draw_frame_only(interactions);
+    if (recorder)
+      _record_frame();
+    if (renderer.vertices && renderer.vertices->is_uploaded() &&
+        !has_reported_vertex_upload) {
+      print_vertex_stream(*renderer.vertices);
+      has_reported_vertex_upload = true;
+    }
+    if (publisher)
+      publisher->capture();
+    // One round per frame keeps the window responsive while comparing
+    if (comparison && comparison->is_running()) {
+      comparison->step();
+      renderer.request_redraw();
+    }
+    _apply_interactions(std::move(interactions));
+  }
+
+  void _draw_frame_only(AppInteractions &interactions) {
     renderer.begin_frame().unwrap();
-    _draw_gui(interactions);
+    if (audio && audio->try_latest(audio_frame))
+      renderer.update_audio(audio_frame);
+    {
+      TRACE_SCOPE("App::draw_gui");
+      _draw_gui(interactions);
+    }
     renderer.end_frame().unwrap();
-    _apply_interactions(std::move(interactions));
+  }
+
+  void start_publishing(const std::string &name, VkExtent2D extent,
+                        uint32_t slot_count) {
+    publisher = std::make_unique<SharedFramePublisher>(renderer, name, extent,
+                                                       slot_count);
+  }
+
+  // Prints why when there is nothing to show.
+  bool open_gallery(const std::filesystem::path &directory, double budget_ms) {
+    if (!std::filesystem::is_directory(directory)) {
+      std::cerr << "retort: " << directory.string() << " is not a directory"
+                << std::endl;
+      return false;
+    }
+    auto files = gallery_files(directory);
+    if (files.empty()) {
+      std::cerr << "retort: " << directory.string()
+                << " holds no shader files" << std::endl;
+      return false;
+    }
+    gallery = std::make_unique<Gallery>(renderer, thread_pool, files,
+                                        budget_ms);
+    show_gallery = true;
+    return true;
+  }
+
+  // Prints why when the vertices cannot be drawn.
+  bool start_vertex_stream(const std::filesystem::path &path,
+                           const std::filesystem::path &shader_path,
+                           VkPrimitiveTopology topology) {
+    std::string error;
+    if (!renderer.set_vertex_stream(path, shader_path, topology, error)) {
+      std::cerr << "retort: " << error << std::endl;
+      return false;
+    }
+    vertex_shader_path = shader_path;
+    file_watcher.watch_file(shader_path);
+    return true;
+  }
+
+  void _reload_vertex_shader() {
+    std::string error;
+    if (!renderer.load_vertex_shader(vertex_shader_path.value(), error))
+      std::cerr << error << std::endl;
+  }
+
+  // Prints why when the trace cannot be written.
+  bool start_recording(const std::filesystem::path &path) {
+    std::string error;
+    auto writer = open_trace_writer(path, error);
+    if (!writer) {
+      std::cerr << "retort: " << error << std::endl;
+      return false;
+    }
+    recorder = std::move(writer.value());
+    return true;
+  }
+
+  // Prints why when the trace cannot be read.
+  bool start_replay(const std::filesystem::path &path) {
+    std::string error;
+    auto frames = read_trace(path, error);
+    if (!frames) {
+      std::cerr << "retort: " << error << std::endl;
+      return false;
+    }
+    replay = TraceReplay{std::move(frames.value())};
+    return true;
+  }
+
+  // Shader sources are read back from their files, which still hold what was
+  // compiled unless they were saved again since, and then reload soon.
+  void _record_frame() {
+    auto &primary = renderer.primary_window();
+    TraceFrame frame;
+    frame.dt = renderer.dt;
+    frame.extent = primary.swapchain.extent;
+    frame.inputs = primary.latched_inputs;
+
+    auto module = renderer.has_prepared_shader(primary.shader)
+                      ? renderer.prepared_shaders.at(primary.shader)
+                            .fragment_shader_module
+                      : VK_NULL_HANDLE;
+    if (module != VK_NULL_HANDLE &&
+        (primary.shader != _recorded_shader || module != _recorded_module)) {
+      TraceShader shader;
+      shader.name = primary.shader;
+      if (std::filesystem::is_regular_file(primary.shader))
+        shader.source = utils::read_file(primary.shader.c_str());
+      frame.shader = shader;
+      _recorded_shader = primary.shader;
+      _recorded_module = module;
+    }
+    recorder->write(frame);
+  }
+
+  // Puts the frame in place of the clock and the primary window's input. The
+  // window is asked for the recorded size, which the window manager may not
+  // allow or take a few frames to apply, only --export replays are exact.
+  void _replay_frame(const TraceFrame &frame) {
+    if (frame.shader)
+      show_trace_shader(renderer, frame.shader.value());
+
+    auto &primary = renderer.primary_window();
+    auto extent = primary.swapchain.extent;
+    if (extent.width != frame.extent.width ||
+        extent.height != frame.extent.height) {
+      int width, height, framebuffer_width, framebuffer_height;
+      glfwGetWindowSize(primary.window, &width, &height);
+      glfwGetFramebufferSize(primary.window, &framebuffer_width,
+                             &framebuffer_height);
+      if (framebuffer_width > 0 && framebuffer_height > 0)
+        glfwSetWindowSize(
+            primary.window,
+            (int)(frame.extent.width * width / framebuffer_width),
+            (int)(frame.extent.height * height / framebuffer_height));
+    }
+
+    renderer.scripted_dt = frame.dt;
+    renderer.scripted_inputs = frame.inputs;
+  }
+
+  // Prints why when the file cannot be played.
+  bool start_audio(const std::filesystem::path &path) {
+    std::string error;
+    auto stream = open_wav(path, error);
+    if (!stream) {
+      std::cerr << "retort: " << error << std::endl;
+      return false;
+    }
+    audio = std::make_unique<AudioAnalyzer>(std::move(stream.value()));
+    renderer.is_audio_playing = true;
+    return true;
+  }
+
+  // Loads the image into the texture table, or reloads it, and follows
+  // changes to the file. Prints why when it cannot be loaded.
+  bool add_texture(const std::filesystem::path &path) {
+    std::string error;
+    if (!renderer.load_texture(path, error)) {
+      std::cerr << "retort: " << error << std::endl;
+      return false;
+    }
+    file_watcher.watch_file(path);
+    return true;
   }
 
   void _draw_gui_menu_bar(AppInteractions &interaction) {
     if (ImGui::BeginMainMenuBar()) {
       if (ImGui::BeginMenu("File")) {
         if (ImGui::MenuItem("Open")) {
-          auto maybe_filepath = utils::open_file_dialog(renderer.window);
+          auto maybe_filepath =
+              utils::open_file_dialog(renderer.primary_window().window);
           if (maybe_filepath) {
             auto filename = maybe_filepath.value();
             interaction.open_file = filename;
           }
         }
+        if (ImGui::MenuItem("Open Texture")) {
+          auto maybe_filepath =
+              utils::open_file_dialog(renderer.primary_window().window);
+          if (maybe_filepath)
+            interaction.open_texture = maybe_filepath.value();
+        }
         ImGui::EndMenu();
       }
 
@@ -80,6 +437,53 @@ struct App {
         if (ImGui::MenuItem("Compilation Logs", nullptr, nullptr,
                             show_compilation_logs))
           show_compilation_logs = !show_compilation_logs;
+        if (ImGui::MenuItem("Shader Statistics", nullptr,
+                            show_shader_statistics))
+          show_shader_statistics = !show_shader_statistics;
+        if (ImGui::MenuItem("A/B Comparison", nullptr, show_comparison))
+          show_comparison = !show_comparison;
+        if (ImGui::MenuItem("Reload Latency", nullptr, show_reload_latency))
+          show_reload_latency = !show_reload_latency;
+        if (ImGui::MenuItem("Textures", nullptr, show_textures))
+          show_textures = !show_textures;
+        if (ImGui::MenuItem("Accumulation", nullptr, show_accumulation))
+          show_accumulation = !show_accumulation;
+        if (ImGui::MenuItem("Input Latency", nullptr, show_input_latency))
+          show_input_latency = !show_input_latency;
+        if (ImGui::MenuItem("Parameters", nullptr, show_parameters))
+          show_parameters = !show_parameters;
+        if (renderer.vertices &&
+            ImGui::MenuItem("Vertex Stream", nullptr, show_vertex_stream))
+          show_vertex_stream = !show_vertex_stream;
+        if (gallery && ImGui::MenuItem("Gallery", nullptr, show_gallery))
+          show_gallery = !show_gallery;
+        if (ImGui::MenuItem("Render On Demand", nullptr, is_on_demand))
+          is_on_demand = !is_on_demand;
+#ifdef RETORT_TRACING
+        if (ImGui::MenuItem("Dump Trace", "F12"))
+          interaction.dump_trace = true;
+#endif
+        ImGui::EndMenu();
+      }
+
+      if (ImGui::BeginMenu("Window")) {
+        if (ImGui::MenuItem("New Window"))
+          interaction.open_window = true;
+        ImGui::EndMenu();
+      }
+
+      if (ImGui::BeginMenu("Shaders", !shader_set.empty())) {
+        if (renderer.windows.size() == 1) {
+          _draw_gui_shader_items(interaction, 0);
+        } else {
+          for (size_t i = 0; i < renderer.windows.size(); i++) {
+            auto label = "Window " + std::to_string(i + 1);
+            if (ImGui::BeginMenu(label.c_str())) {
+              _draw_gui_shader_items(interaction, i);
+              ImGui::EndMenu();
+            }
+          }
+        }
         ImGui::EndMenu();
       }
 
@@ -87,24 +491,665 @@ struct App {
     }
   }
 
+  void _draw_gui_shader_items(AppInteractions &interaction, size_t window) {
+    for (auto &path : shader_set) {
+      auto name = path.filename().string();
+      bool is_active = renderer.windows[window]->shader == path.string();
+      if (ImGui::MenuItem(name.c_str(), nullptr, is_active)) {
+        interaction.focus_file = path;
+        interaction.focus_window = window;
+      }
+    }
+  }
+
+  // Opens a window showing `file` if it compiled, or whatever the primary
+  // window shows otherwise.
+  void open_window(std::optional<std::filesystem::path> file = std::nullopt) {
+    auto shader = renderer.primary_window().shader;
+    if (file && renderer.has_prepared_shader(file->string()))
+      shader = file->string();
+
+    auto &window = renderer.create_window(shader);
+    _install_window_callbacks(window.window);
+    _install_redraw_callbacks(window.window, false);
+  }
+
   void add_file(std::filesystem::path file) {
-    _set_focused_shader_file(file);
+    _add_to_shader_set(file);
+    _reload_shader_file(file);
     file_watcher.watch_file(file);
   }
 
-  void _set_focused_shader_file(std::filesystem::path path) {
+  // Compiles the whole set up front so that switching between its shaders
+  // later only swaps the pipeline.
+  void add_files(const std::vector<std::filesystem::path> &files) {
+    if (files.size() == 1) {
+      add_file(files[0]);
+      return;
+    }
+
+    auto failures = renderer.prewarm_fragment_shaders(files, thread_pool);
+    for (auto &failure : failures)
+      std::cerr << failure.error.messages << std::endl;
+
+    for (auto &file : files) {
+      _add_to_shader_set(file);
+      file_watcher.watch_file(file);
+    }
+
+    for (auto &file : files) {
+      if (renderer.has_prepared_shader(file.string())) {
+        _focus_shader_file(file, renderer.focused_window);
+        break;
+      }
+    }
+  }
+
+  void _add_to_shader_set(std::filesystem::path path) {
+    if (std::find(shader_set.begin(), shader_set.end(), path) ==
+        shader_set.end())
+      shader_set.push_back(path);
+  }
+
+  void _focus_shader_file(std::filesystem::path path, size_t window) {
     auto path_str = path.string();
+    if (renderer.has_prepared_shader(path_str)) {
+      renderer.use_prepared_shader(path_str, window);
+    } else {
+      renderer.focused_window = window;
+      _reload_shader_file(path);
+    }
+  }
+
+  void dump_trace() {
+#ifdef RETORT_TRACING
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+    auto path = "retort_trace_" + std::to_string(seconds) + ".json";
+    if (tracing::dump_chrome_trace(path))
+      std::cerr << "wrote trace to " << path << std::endl;
+    else
+      std::cerr << "failed to write trace to " << path << std::endl;
+#endif
+  }
+
+  void _reload_shader_file(std::filesystem::path path,
+                           std::optional<double> detection_delay_ms = {}) {
+    TRACE_SCOPE("App::reload_shader_file");
+    auto path_str = path.string();
+    renderer.reloads.begin(path_str, detection_delay_ms);
     auto source = utils::read_file(path_str.c_str());
-    renderer.set_fragment_shader(path_str.c_str(), source.c_str());
+    renderer.reloads.mark(path_str, ReloadStage::Read);
+    auto result =
+        renderer.set_fragment_shader(path_str.c_str(), source.c_str());
+    if (!result) {
+      renderer.reloads.cancel(path_str);
+      std::cerr << result.unwrap_err().messages << std::endl;
+    }
+  }
+
+  // What `retort_textures` holds at each index.
+  void _draw_gui_textures() {
+    if (!ImGui::Begin("Textures", &show_textures)) {
+      ImGui::End();
+      return;
+    }
+
+    auto &textures = renderer.textures.textures;
+    if (textures.empty())
+      ImGui::TextUnformatted("Load images with File > Open Texture");
+
+    auto flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV;
+    if (!textures.empty() && ImGui::BeginTable("textures", 3, flags)) {
+      ImGui::TableSetupColumn("index");
+      ImGui::TableSetupColumn("file");
+      ImGui::TableSetupColumn("size");
+      ImGui::TableHeadersRow();
+      for (size_t i = 0; i < textures.size(); i++) {
+        auto &texture = textures[i];
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%zu", i);
+        ImGui::TableNextColumn();
+        auto name = texture.path.filename().string();
+        ImGui::TextUnformatted(name.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%ux%u", texture.image.extent.width,
+                    texture.image.extent.height);
+      }
+      ImGui::EndTable();
+    }
+
+    ImGui::End();
+  }
+
+  void _draw_gui_accumulation(AppInteractions &interaction) {
+    if (!ImGui::Begin("Accumulation", &show_accumulation)) {
+      ImGui::End();
+      return;
+    }
+
+    auto settings = renderer.accumulation;
+    bool is_changed = ImGui::Checkbox("Accumulate", &settings.is_enabled);
+    int sample_limit = (int)settings.sample_limit;
+    if (ImGui::SliderInt("Samples", &sample_limit, 1, 16384, "%d",
+                         ImGuiSliderFlags_Logarithmic |
+                             ImGuiSliderFlags_AlwaysClamp)) {
+      settings.sample_limit = (uint32_t)sample_limit;
+      is_changed = true;
+    }
+
+    bool is_tiled = settings.tile_budget_ms.has_value();
+    if (ImGui::Checkbox("Tiled", &is_tiled)) {
+      settings.tile_budget_ms =
+          is_tiled ? std::optional<double>(8.) : std::nullopt;
+      is_changed = true;
+    }
+    if (is_tiled) {
+      float budget = (float)settings.tile_budget_ms.value();
+      if (ImGui::SliderFloat("Budget", &budget, 1.f, 50.f, "%.1fms")) {
+        settings.tile_budget_ms = budget;
+        is_changed = true;
+      }
+    }
+    if (is_changed)
+      interaction.accumulation = settings;
+
+    for (auto &window : renderer.windows) {
+      if (!window->accumulation)
+        continue;
+      auto &accumulating = window->accumulation.value();
+      auto name = std::filesystem::path(window->shader).filename().string();
+      ImGui::ProgressBar((float)accumulating.samples / settings.sample_limit,
+                         ImVec2(-FLT_MIN, 0.f), name.c_str());
+      ImGui::Text("%u samples", accumulating.samples);
+      if (is_tiled && accumulating.ms_per_tile > 0.)
+        ImGui::Text("%.3fms per tile", accumulating.ms_per_tile);
+    }
+
+    if (ImGui::Button("Reset"))
+      interaction.reset_accumulation = true;
+
+    ImGui::End();
+  }
+
+  // The latched input reaches the GPU as much fresher as this shows, the
+  // test pattern makes the difference visible.
+  void _draw_gui_input_latency(AppInteractions &interaction) {
+    if (!ImGui::Begin("Input Latency", &show_input_latency)) {
+      ImGui::End();
+      return;
+    }
+
+    if (renderer.latch_gain_ms)
+      ImGui::Text("latched input is %.2fms fresher than polled input",
+                  renderer.latch_gain_ms.value());
+    else
+      ImGui::TextDisabled("no frame submitted yet");
+
+    bool is_testing = shader_before_latency_test.has_value();
+    if (ImGui::Checkbox("Test pattern in the primary window", &is_testing))
+      interaction.show_latency_test = is_testing;
+    if (is_testing)
+      ImGui::TextWrapped("The cross follows the latched cursor, the ring the "
+                         "one polled when the frame started. The screen "
+                         "turns white while the left button is down.");
+
+    ImGui::End();
+  }
+
+  // Edits the parameters of the focused window's shader in place, the frame
+  // being built already sees them.
+  void _draw_gui_parameters(AppInteractions &interaction) {
+    if (!ImGui::Begin("Parameters", &show_parameters)) {
+      ImGui::End();
+      return;
+    }
+
+    auto &shader = renderer.windows[renderer.focused_window]->shader;
+    auto &prepared = renderer.prepared_shaders.at(shader);
+    auto name = std::filesystem::path(shader).filename().string();
+    ImGui::TextUnformatted(name.c_str());
+    if (!prepared.parameters) {
+      ImGui::TextDisabled("declares no uniform block at binding 2");
+      ImGui::End();
+      return;
+    }
+
+    auto &values = prepared.parameter_values;
+    for (auto &member : prepared.parameters->members)
+      if (_draw_gui_parameter(member, values.data() + member.offset))
+        interaction.is_parameter_changed = true;
+    if (ImGui::Button("Zero")) {
+      std::fill(values.begin(), values.end(), 0);
+      interaction.is_parameter_changed = true;
+    }
+
+    ImGui::End();
+  }
+
+  // Float vectors with "color" in their name get a color picker.
+  bool _draw_gui_parameter(const UniformMember &member, uint8_t *value) {
+    auto label = member.name.empty() ? "@" + std::to_string(member.offset)
+                                     : member.name;
+    auto count = (int)member.component_count;
+    bool is_color = member.kind == ScalarKind::Float && count >= 3 &&
+                    member.name.find("color") != std::string::npos;
+    if (is_color && count == 3)
+      return ImGui::ColorEdit3(label.c_str(), (float *)value);
+    if (is_color)
+      return ImGui::ColorEdit4(label.c_str(), (float *)value);
+
+    auto type = member.kind == ScalarKind::Float ? ImGuiDataType_Float
+                : member.kind == ScalarKind::Int ? ImGuiDataType_S32
+                                                 : ImGuiDataType_U32;
+    float speed = member.kind == ScalarKind::Float ? 0.01f : 1.f;
+    return ImGui::DragScalarN(label.c_str(), type, value, count, speed);
+  }
+
+  void _draw_gui_vertex_stream() {
+    if (!ImGui::Begin("Vertex Stream", &show_vertex_stream)) {
+      ImGui::End();
+      return;
+    }
+
+    const double MIB = 1 << 20;
+    auto &stream = *renderer.vertices;
+    auto total = stream.layout.data_size();
+    ImGui::ProgressBar((float)((double)stream.uploaded_bytes / total));
+    ImGui::Text("%.1f / %.1f MiB at %.1f MiB/s", stream.uploaded_bytes / MIB,
+                total / MIB, stream.upload_mib_per_second());
+    ImGui::Text("%llu vertices of %u bytes",
+                (unsigned long long)stream.layout.vertex_count,
+                stream.layout.stride);
+    ImGui::Text("device local: %.1f MiB", stream.device_bytes() / MIB);
+    ImGui::Text("staging: %.1f MiB", stream.staging_bytes() / MIB);
+    ImGui::Text("mapped: %.1f MiB", stream.file.size / MIB);
+
+    ImGui::End();
+  }
+
+  // Only the rows in view ask for their thumbnails, the rest neither load nor
+  // draw. The grid is never taller than the atlas has cells for, counting a
+  // partly visible row at either end.
+  void _draw_gui_gallery(AppInteractions &interaction) {
+    if (!ImGui::Begin("Gallery", &show_gallery)) {
+      ImGui::End();
+      return;
+    }
+
+    ImGui::SetNextItemWidth(120.f);
+    if (ImGui::InputDouble("Budget (ms)", &gallery->budget_ms, 0.5, 1., "%.1f"))
+      gallery->budget_ms = std::max(gallery->budget_ms, 0.1);
+    ImGui::SameLine();
+    ImGui::Text("drew %zu of %zu stale, %.2f ms", gallery->drawn_count,
+                gallery->stale_count, gallery->drawn_estimate_ms);
+
+    auto size = ImVec2((float)GALLERY_THUMBNAIL_EXTENT.width,
+                       (float)GALLERY_THUMBNAIL_EXTENT.height);
+    auto &style = ImGui::GetStyle();
+    auto &spacing = style.ItemSpacing;
+    auto available = ImGui::GetContentRegionAvail();
+    auto fitting = (int)((available.x - style.ScrollbarSize + spacing.x) /
+                         (size.x + spacing.x));
+    auto columns = std::clamp(fitting, 1, (int)GALLERY_CELL_COUNT / 3);
+    auto row_height =
+        size.y + spacing.y + ImGui::GetTextLineHeightWithSpacing();
+    auto row_limit = (int)GALLERY_CELL_COUNT / columns;
+    auto height = std::min(available.y, (row_limit - 2) * row_height);
+    auto count = gallery->entries.size();
+    auto rows = (int)((count + columns - 1) / columns);
+
+    ImGui::BeginChild("Thumbnails", ImVec2(0.f, height));
+    ImGuiListClipper clipper;
+    clipper.Begin(rows, row_height);
+    while (clipper.Step()) {
+      for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+        for (int column = 0; column < columns; column++) {
+          auto index = (size_t)row * columns + column;
+          if (index >= count)
+            break;
+          if (column > 0)
+            ImGui::SameLine();
+          _draw_gui_thumbnail(interaction, index, size);
+        }
+      }
+    }
+    ImGui::EndChild();
+    ImGui::End();
+  }
+
+  static const char *_thumbnail_status(const GalleryEntry &entry) {
+    if (entry.error)
+      return "failed to compile";
+    if (entry.is_loaded && !entry.cell)
+      return "no free atlas cell";
+    return "loading";
+  }
+
+  void _draw_gui_thumbnail(AppInteractions &interaction, size_t index,
+                           ImVec2 size) {
+    auto &entry = gallery->entries[index];
+    auto texture = gallery->show(index);
+
+    ImGui::PushID((int)index);
+    ImGui::BeginGroup();
+    auto corner = ImGui::GetCursorScreenPos();
+    auto far_corner = ImVec2(corner.x + size.x, corner.y + size.y);
+    bool is_clicked = ImGui::InvisibleButton("thumbnail", size);
+    auto draw_list = ImGui::GetWindowDrawList();
+    if (texture) {
+      draw_list->AddImage(texture.value(), corner, far_corner);
+    } else {
+      draw_list->AddRectFilled(corner, far_corner,
+                               ImGui::GetColorU32(ImGuiCol_FrameBg));
+      draw_list->AddText(ImVec2(corner.x + 4.f, corner.y + 4.f),
+                         ImGui::GetColorU32(ImGuiCol_TextDisabled),
+                         _thumbnail_status(entry));
+    }
+    if (ImGui::IsItemHovered()) {
+      if (entry.error)
+        ImGui::SetTooltip("%s", entry.error->c_str());
+      else if (entry.gpu_time_ms)
+        ImGui::SetTooltip("%.3f ms", entry.gpu_time_ms.value());
+    }
+
+    auto name = entry.path.filename().string();
+    auto text_corner = ImGui::GetCursorScreenPos();
+    ImGui::PushClipRect(text_corner,
+                        ImVec2(text_corner.x + size.x,
+                               text_corner.y + ImGui::GetTextLineHeight()),
+                        true);
+    ImGui::TextUnformatted(name.c_str());
+    ImGui::PopClipRect();
+    ImGui::EndGroup();
+    ImGui::PopID();
+
+    if (is_clicked && entry.is_loaded) {
+      interaction.focus_file = entry.path;
+      interaction.focus_window = renderer.focused_window;
+    }
+  }
+
+  // Newest first, every stage is the time since the one before it.
+  void _draw_gui_reload_latency() {
+    if (!ImGui::Begin("Reload Latency", &show_reload_latency)) {
+      ImGui::End();
+      return;
+    }
+
+    auto flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV;
+    if (ImGui::BeginTable("reloads", RELOAD_STAGE_COUNT + 2, flags)) {
+      ImGui::TableSetupColumn("shader");
+      for (size_t i = 0; i < RELOAD_STAGE_COUNT; i++)
+        ImGui::TableSetupColumn(reload_stage_name((ReloadStage)i));
+      ImGui::TableSetupColumn("total");
+      ImGui::TableHeadersRow();
+
+      auto &history = renderer.reloads.history;
+      for (auto it = history.rbegin(); it != history.rend(); it++) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        auto name = std::filesystem::path(it->shader).filename().string();
+        ImGui::TextUnformatted(name.c_str());
+        for (size_t i = 0; i < RELOAD_STAGE_COUNT; i++) {
+          ImGui::TableNextColumn();
+          ImGui::Text("%.2fms", it->stage_ms((ReloadStage)i));
+        }
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2fms", it->total_ms());
+      }
+      ImGui::EndTable();
+    }
+
+    ImGui::End();
+  }
+
+  void _draw_gui_shader_statistics(AppInteractions &interaction) {
+    if (!ImGui::Begin("Shader Statistics", &show_shader_statistics)) {
+      ImGui::End();
+      return;
+    }
+
+    auto current = optimizer_recipe_name(renderer.optimizer_recipe);
+    if (ImGui::BeginCombo("Optimizer", current)) {
+      for (auto recipe : OPTIMIZER_RECIPES) {
+        bool is_selected = recipe == renderer.optimizer_recipe;
+        if (ImGui::Selectable(optimizer_recipe_name(recipe), is_selected))
+          interaction.optimizer_recipe = recipe;
+      }
+      ImGui::EndCombo();
+    }
+
+    for (auto &path : shader_set) {
+      auto it = renderer.prepared_shaders.find(path.string());
+      if (it == renderer.prepared_shaders.end())
+        continue;
+
+      auto &statistics = it->second.statistics;
+      auto name = path.filename().string();
+      if (!ImGui::CollapsingHeader(name.c_str()))
+        continue;
+
+      _draw_gui_shader_cost(it->second);
+
+      auto &before = statistics.unoptimized;
+      auto &after = statistics.optimized;
+      auto flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV;
+      if (!ImGui::BeginTable(name.c_str(), after ? 3 : 2, flags))
+        continue;
+
+      // The optimized column is only there when the optimizer ran
+      auto row = [&](const char *label, size_t unoptimized, size_t optimized) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(label);
+        ImGui::TableNextColumn();
+        ImGui::Text("%zu", unoptimized);
+        if (after) {
+          ImGui::TableNextColumn();
+          ImGui::Text("%zu", optimized);
+        }
+      };
+
+      ImGui::TableSetupColumn("");
+      ImGui::TableSetupColumn("compiled");
+      if (after)
+        ImGui::TableSetupColumn("optimized");
+      ImGui::TableHeadersRow();
+
+      row("words", before.word_count, after ? after->word_count : 0);
+      row("functions", before.function_count,
+          after ? after->function_count : 0);
+      row("loops", before.loop_count, after ? after->loop_count : 0);
+      for (auto &opcode : sorted_opcodes(statistics))
+        row(opcode.c_str(), before.count(opcode),
+            after ? after->count(opcode) : 0);
+
+      ImGui::EndTable();
+    }
+
+    ImGui::End();
+  }
+
+  // The static estimate next to what the GPU measured, so that a hotspot can
+  // be told apart as ALU or fetch bound without a profiler.
+  void _draw_gui_shader_cost(const PreparedShader &prepared) {
+    auto &cost = prepared.cost;
+    ImGui::Text("estimated: %.0f alu, %.0f transcendental, %.0f texture, "
+                "%.0f branches",
+                cost.arithmetic, cost.transcendental, cost.texture,
+                cost.branch);
+    ImGui::Text("likely %s bound%s", cost.is_fetch_bound() ? "fetch" : "ALU",
+                cost.has_dynamic_loops ? ", has dynamic loops" : "");
+    if (prepared.gpu_time_ms)
+      ImGui::Text("measured: %.3fms", prepared.gpu_time_ms.value());
+    else
+      ImGui::TextDisabled("measured: not shown in any window");
+    for (auto &warning : cost.warnings)
+      ImGui::TextColored(ImVec4(1.f, .8f, .2f, 1.f), "%s", warning.c_str());
+  }
+
+  void _draw_gui_comparison(AppInteractions &interaction) {
+    if (!ImGui::Begin("A/B Comparison", &show_comparison)) {
+      ImGui::End();
+      return;
+    }
+
+    bool is_running = comparison && comparison->is_running();
+    ImGui::BeginDisabled(is_running);
+    const char *labels[2] = {"A", "B"};
+    for (size_t i = 0; i < 2; i++) {
+      auto &selected = comparison_shaders[i];
+      auto preview = selected < shader_set.size()
+                         ? shader_set[selected].filename().string()
+                         : std::string();
+      if (ImGui::BeginCombo(labels[i], preview.c_str())) {
+        for (size_t j = 0; j < shader_set.size(); j++) {
+          auto name = shader_set[j].filename().string();
+          if (ImGui::Selectable(name.c_str(), j == selected))
+            selected = j;
+        }
+        ImGui::EndCombo();
+      }
+    }
+    ImGui::EndDisabled();
+
+    if (renderer.timestamp_period_ns <= 0.) {
+      ImGui::TextDisabled("the graphics queue cannot write timestamps");
+    } else if (is_running) {
+      if (ImGui::Button("Stop"))
+        interaction.stop_comparison = true;
+    } else {
+      ImGui::BeginDisabled(!_comparison_settings());
+      if (ImGui::Button("Start"))
+        interaction.start_comparison = true;
+      ImGui::EndDisabled();
+    }
+
+    if (comparison) {
+      auto &a = comparison->a, &b = comparison->b;
+      ImGui::Text("A: %.4fms over %llu draws", a.mean,
+                  (unsigned long long)a.count);
+      ImGui::Text("B: %.4fms over %llu draws", b.mean,
+                  (unsigned long long)b.count);
+      if (a.count > 1 && b.count > 1) {
+        auto difference = comparison->interval();
+        ImGui::Text("B - A: %+.4fms, %.2f%% interval [%+.4fms, %+.4fms]",
+                    difference.difference_ms,
+                    100. * comparison->look_confidence(),
+                    difference.lower(), difference.upper());
+      }
+      ImGui::Text("%s after %.1fs",
+                  comparison_verdict_name(comparison->verdict),
+                  comparison->elapsed_seconds());
+    }
+
+    ImGui::End();
+  }
+
+  // Both shaders have to be compiled and distinct, and are drawn at the size
+  // of the primary window.
+  std::optional<ComparisonSettings> _comparison_settings() {
+    auto [a, b] = comparison_shaders;
+    if (a >= shader_set.size() || b >= shader_set.size() || a == b)
+      return std::nullopt;
+
+    ComparisonSettings settings;
+    settings.a = shader_set[a].string();
+    settings.b = shader_set[b].string();
+    if (!renderer.prepared_shaders.contains(settings.a) ||
+        !renderer.prepared_shaders.contains(settings.b))
+      return std::nullopt;
+    settings.extent = renderer.primary_window().swapchain.extent;
+    return settings;
+  }
+
+  void print_shader_statistics() {
+    for (auto &path : shader_set) {
+      auto it = renderer.prepared_shaders.find(path.string());
+      if (it == renderer.prepared_shaders.end())
+        continue;
+      retort::print_shader_statistics(path.string(), it->second.statistics);
+      print_shader_cost(it->second.cost, it->second.gpu_time_ms);
+    }
+  }
+
+  // Recompiles every known shader, e.g. after the optimizer recipe changed.
+  void _rebuild_shader_set() {
+    auto failures = renderer.prewarm_fragment_shaders(shader_set, thread_pool);
+    for (auto &failure : failures)
+      std::cerr << failure.error.messages << std::endl;
   }
 
   void _draw_gui(AppInteractions &interaction) {
     _draw_gui_menu_bar(interaction);
+    if (show_shader_statistics)
+      _draw_gui_shader_statistics(interaction);
+    if (show_comparison)
+      _draw_gui_comparison(interaction);
+    if (show_reload_latency)
+      _draw_gui_reload_latency();
+    if (show_textures)
+      _draw_gui_textures();
+    if (show_accumulation)
+      _draw_gui_accumulation(interaction);
+    if (show_input_latency)
+      _draw_gui_input_latency(interaction);
+    if (show_vertex_stream && renderer.vertices)
+      _draw_gui_vertex_stream();
+    if (show_parameters)
+      _draw_gui_parameters(interaction);
+    if (show_gallery && gallery)
+      _draw_gui_gallery(interaction);
+  }
+
+  void _show_latency_test(bool is_shown) {
+    auto &primary = renderer.primary_window();
+    if (is_shown && !shader_before_latency_test) {
+      shader_before_latency_test = primary.shader;
+      renderer.use_latency_test(0);
+    } else if (!is_shown && shader_before_latency_test) {
+      if (primary.shader == builtins::latency_shader_filename &&
+          renderer.has_prepared_shader(shader_before_latency_test.value()))
+        renderer.use_prepared_shader(shader_before_latency_test.value(), 0);
+      shader_before_latency_test.reset();
+    }
   }
 
   void _apply_interactions(AppInteractions &&interaction) {
     if (interaction.open_file)
       add_file(interaction.open_file.value());
+    if (interaction.open_texture)
+      add_texture(interaction.open_texture.value());
+    if (interaction.focus_file)
+      _focus_shader_file(interaction.focus_file.value(),
+                         interaction.focus_window);
+    if (interaction.open_window)
+      open_window();
+    if (interaction.optimizer_recipe) {
+      renderer.optimizer_recipe = interaction.optimizer_recipe.value();
+      _rebuild_shader_set();
+    }
+    if (interaction.stop_comparison)
+      comparison->verdict = ComparisonVerdict::Inconclusive;
+    if (interaction.start_comparison) {
+      comparison.reset();
+      if (auto settings = _comparison_settings())
+        comparison =
+            std::make_unique<ShaderComparison>(renderer, settings.value());
+    }
+    if (interaction.dump_trace)
+      dump_trace();
+    if (interaction.accumulation)
+      renderer.set_accumulation(interaction.accumulation.value());
+    if (interaction.reset_accumulation)
+      renderer.reset_accumulation();
+    if (interaction.show_latency_test)
+      _show_latency_test(interaction.show_latency_test.value());
+    if (interaction.is_parameter_changed)
+      renderer.reset_accumulation();
   }
 };
 
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "audio/analyzer.hpp"
+#include "audio/wav.hpp"
+#include "memory.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// What fragment shaders sample as `retort_audio`: the spectrum in the first
+// row, the waveform in the second. Every frame slot has its own staging
+// buffer, so writing the next frame never touches one the GPU still reads.
+struct AudioTexture {
+  Image image;
+  VkSampler sampler = VK_NULL_HANDLE;
+  std::vector<Buffer> staging;
+};
+
+AudioTexture create_audio_texture(vkb::DispatchTable &dispatch,
+                                  const VkPhysicalDeviceMemoryProperties &props,
+                                  size_t frame_count) {
+  AudioTexture texture;
+  texture.image = create_image(
+      dispatch, props, VK_FORMAT_R8_UNORM, {(uint32_t)AUDIO_TEXTURE_WIDTH, 2},
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = VK_FILTER_LINEAR;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  CHECK_VK_ERRC(
+      dispatch.createSampler(&sampler_info, nullptr, &texture.sampler));
+
+  for (size_t i = 0; i < frame_count; i++)
+    texture.staging.push_back(create_buffer(
+        dispatch, props, AUDIO_TEXTURE_WIDTH * 2,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT));
+
+  return texture;
+}
+
+void destroy_audio_texture(vkb::DispatchTable &dispatch,
+                           AudioTexture &texture) {
+  for (auto &buffer : texture.staging)
+    destroy_buffer(dispatch, buffer);
+  dispatch.destroySampler(texture.sampler, nullptr);
+  destroy_image(dispatch, texture.image);
+  texture = {};
+}
+
+void write_audio_frame(AudioTexture &texture, size_t slot,
+                       const AudioFrame &frame) {
+  auto mapped = (uint8_t *)texture.staging[slot].mapped;
+  memcpy(mapped, frame.spectrum.data(), AUDIO_TEXTURE_WIDTH);
+  memcpy(mapped + AUDIO_TEXTURE_WIDTH, frame.waveform.data(),
+         AUDIO_TEXTURE_WIDTH);
+}
+
+// Silence until the first upload, leaves the texture ready for sampling.
+void record_audio_clear(vkb::DispatchTable &dispatch, VkCommandBuffer cmd,
+                        const AudioTexture &texture) {
+  auto image = texture.image.image;
+  record_image_barrier(dispatch, cmd, image, VK_IMAGE_LAYOUT_UNDEFINED,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT);
+
+  VkClearColorValue silence = {};
+  VkImageSubresourceRange range = {};
+  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.levelCount = 1;
+  range.layerCount = 1;
+  dispatch.cmdClearColorImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              &silence, 1, &range);
+
+  record_image_barrier(dispatch, cmd, image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_ACCESS_SHADER_READ_BIT);
+}
+
+// Copies the staging buffer of `slot` into the texture. Has to be recorded
+// outside of a render pass, before the draws that sample it.
+void record_audio_upload(vkb::DispatchTable &dispatch, VkCommandBuffer cmd,
+                         const AudioTexture &texture, size_t slot) {
+  record_image_upload(dispatch, cmd, texture.image,
+                      texture.staging[slot].buffer,
+                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+} // namespace retort
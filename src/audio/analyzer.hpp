@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <numbers>
+#include <thread>
+#include <vector>
+
+#include "../tracing.hpp"
+#include "fft.hpp"
+#include "wav.hpp"
+
+namespace retort {
+
+const size_t AUDIO_TEXTURE_WIDTH = 512;
+const size_t AUDIO_FFT_SIZE = 4096;
+const double AUDIO_ANALYSIS_RATE = 60.;
+
+// The byte mapping and smoothing of Web Audio's AnalyserNode, which is where
+// Shadertoy's audio channels come from.
+const float AUDIO_MIN_DECIBELS = -100.f;
+const float AUDIO_MAX_DECIBELS = -30.f;
+const float AUDIO_SMOOTHING = 0.8f;
+
+// The two rows of the audio texture.
+struct AudioFrame {
+  std::array<uint8_t, AUDIO_TEXTURE_WIDTH> spectrum = {};
+  std::array<uint8_t, AUDIO_TEXTURE_WIDTH> waveform = {};
+  uint64_t sequence = 0;
+};
+
+// Plays a WAV stream against the wall clock on its own thread, without
+// output, and analyzes the most recent window of samples at a fixed rate.
+// The render loop picks up the newest analysis without ever waiting for it.
+struct AudioAnalyzer {
+  WavStream stream;
+  FourierTransform fft{AUDIO_FFT_SIZE};
+
+  // The last `AUDIO_FFT_SIZE` samples, oldest first
+  std::vector<float> _history;
+  std::vector<float> _window;
+  std::vector<float> _re;
+  std::vector<float> _im;
+  std::vector<float> _smoothed;
+  std::vector<float> _block;
+  uint64_t _sequence = 0;
+
+  std::mutex _mutex;
+  AudioFrame _latest;
+
+  std::atomic<bool> _stopping = false;
+  std::thread thread;
+
+  AudioAnalyzer(WavStream stream)
+      : stream(std::move(stream)), _history(AUDIO_FFT_SIZE),
+        _window(AUDIO_FFT_SIZE), _re(AUDIO_FFT_SIZE), _im(AUDIO_FFT_SIZE),
+        _smoothed(AUDIO_TEXTURE_WIDTH) {
+    // Hann
+    for (size_t i = 0; i < AUDIO_FFT_SIZE; i++)
+      _window[i] = 0.5f - 0.5f * (float)std::cos(2. * std::numbers::pi * i /
+                                                 (AUDIO_FFT_SIZE - 1));
+    thread = std::thread([this]() { _loop(); });
+  }
+
+  AudioAnalyzer(const AudioAnalyzer &) = delete;
+  AudioAnalyzer &operator=(const AudioAnalyzer &) = delete;
+
+  ~AudioAnalyzer() {
+    _stopping = true;
+    thread.join();
+  }
+
+  // Copies the newest analysis into `frame` if it is newer than what `frame`
+  // holds. Gives up rather than waiting while the analysis thread writes.
+  bool try_latest(AudioFrame &frame) {
+    std::unique_lock lock(_mutex, std::try_to_lock);
+    if (!lock || _latest.sequence <= frame.sequence)
+      return false;
+    frame = _latest;
+    return true;
+  }
+
+  void _loop() {
+    using namespace std::chrono;
+    TRACE_THREAD_NAME("audio analyzer");
+
+    auto start = steady_clock::now();
+    auto next = start;
+    auto period = duration_cast<steady_clock::duration>(
+        duration<double>(1. / AUDIO_ANALYSIS_RATE));
+    uint64_t played = 0;
+
+    while (!_stopping) {
+      next += period;
+      std::this_thread::sleep_until(next);
+
+      // After a stall only the most recent window is worth reading
+      auto elapsed = duration<double>(steady_clock::now() - start).count();
+      auto target = (uint64_t)(elapsed * stream.sample_rate);
+      auto count = (size_t)std::min<uint64_t>(target - played, AUDIO_FFT_SIZE);
+      played = target;
+      if (count == 0)
+        continue;
+
+      _block.resize(count);
+      stream.read_mono(_block.data(), count);
+      std::move(_history.begin() + count, _history.end(), _history.begin());
+      std::copy(_block.begin(), _block.end(), _history.end() - count);
+
+      _analyze();
+    }
+  }
+
+  void _analyze() {
+    TRACE_SCOPE("AudioAnalyzer::analyze");
+    for (size_t i = 0; i < AUDIO_FFT_SIZE; i++) {
+      _re[i] = _history[i] * _window[i];
+      _im[i] = 0.f;
+    }
+    fft.forward(_re.data(), _im.data());
+
+    AudioFrame frame;
+    frame.sequence = ++_sequence;
+
+    // Like Shadertoy, the texture covers the lower half of the spectrum
+    const size_t bins_per_texel = AUDIO_FFT_SIZE / 4 / AUDIO_TEXTURE_WIDTH;
+    const float range = AUDIO_MAX_DECIBELS - AUDIO_MIN_DECIBELS;
+    for (size_t i = 0; i < AUDIO_TEXTURE_WIDTH; i++) {
+      float magnitude = 0.f;
+      for (size_t j = 0; j < bins_per_texel; j++) {
+        auto bin = i * bins_per_texel + j;
+        magnitude += std::sqrt(_re[bin] * _re[bin] + _im[bin] * _im[bin]);
+      }
+      magnitude /= (float)(bins_per_texel * AUDIO_FFT_SIZE);
+
+      _smoothed[i] = std::lerp(magnitude, _smoothed[i], AUDIO_SMOOTHING);
+      auto decibels = 20.f * std::log10(std::max(_smoothed[i], 1e-12f));
+      auto level = (decibels - AUDIO_MIN_DECIBELS) / range;
+      frame.spectrum[i] = (uint8_t)(std::clamp(level, 0.f, 1.f) * 255.f);
+    }
+
+    auto recent = _history.end() - AUDIO_TEXTURE_WIDTH;
+    for (size_t i = 0; i < AUDIO_TEXTURE_WIDTH; i++) {
+      auto sample = std::clamp(recent[i], -1.f, 1.f);
+      frame.waveform[i] = (uint8_t)std::min(255.f, 128.f * (1.f + sample));
+    }
+
+    std::lock_guard lock(_mutex);
+    _latest = frame;
+  }
+};
+
+} // namespace retort
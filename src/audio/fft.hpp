@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RETORT_FFT_AVX
+#elif defined(__SSE2__) || defined(_M_X64) ||                                  \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RETORT_FFT_SSE
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define RETORT_FFT_NEON
+#endif
+
+#include "../error.hpp"
+
+namespace retort {
+
+namespace _fft {
+
+// Just enough of a vector type for a butterfly, `LANES` floats wide.
+#if defined(RETORT_FFT_AVX)
+using Lane = __m256;
+const size_t LANES = 8;
+inline Lane load(const float *p) { return _mm256_loadu_ps(p); }
+inline void store(float *p, Lane v) { _mm256_storeu_ps(p, v); }
+inline Lane add(Lane a, Lane b) { return _mm256_add_ps(a, b); }
+inline Lane sub(Lane a, Lane b) { return _mm256_sub_ps(a, b); }
+inline Lane mul(Lane a, Lane b) { return _mm256_mul_ps(a, b); }
+#elif defined(RETORT_FFT_SSE)
+using Lane = __m128;
+const size_t LANES = 4;
+inline Lane load(const float *p) { return _mm_loadu_ps(p); }
+inline void store(float *p, Lane v) { _mm_storeu_ps(p, v); }
+inline Lane add(Lane a, Lane b) { return _mm_add_ps(a, b); }
+inline Lane sub(Lane a, Lane b) { return _mm_sub_ps(a, b); }
+inline Lane mul(Lane a, Lane b) { return _mm_mul_ps(a, b); }
+#elif defined(RETORT_FFT_NEON)
+using Lane = float32x4_t;
+const size_t LANES = 4;
+inline Lane load(const float *p) { return vld1q_f32(p); }
+inline void store(float *p, Lane v) { vst1q_f32(p, v); }
+inline Lane add(Lane a, Lane b) { return vaddq_f32(a, b); }
+inline Lane sub(Lane a, Lane b) { return vsubq_f32(a, b); }
+inline Lane mul(Lane a, Lane b) { return vmulq_f32(a, b); }
+#else
+using Lane = float;
+const size_t LANES = 1;
+inline Lane load(const float *p) { return *p; }
+inline void store(float *p, Lane v) { *p = v; }
+inline Lane add(Lane a, Lane b) { return a + b; }
+inline Lane sub(Lane a, Lane b) { return a - b; }
+inline Lane mul(Lane a, Lane b) { return a * b; }
+#endif
+
+} // namespace _fft
+
+// An in-place complex FFT of a fixed power of two size, on split real and
+// imaginary arrays so that consecutive butterflies sit in consecutive lanes.
+// A scalar radix-4 pass does the first two stages, whose butterflies are too
+// narrow for a vector, and vectorized radix-2 passes do the rest.
+struct FourierTransform {
+  size_t size;
+  std::vector<uint32_t> _reversed;
+  // Twiddles of the stage with half width `h` start at index `h`
+  std::vector<float> _twiddle_re;
+  std::vector<float> _twiddle_im;
+
+  FourierTransform(size_t size)
+      : size(size), _reversed(size), _twiddle_re(size), _twiddle_im(size) {
+    EXPECT(size >= 4 && (size & (size - 1)) == 0);
+
+    size_t bits = 0;
+    while (((size_t)1 << bits) < size)
+      bits++;
+    for (size_t i = 0; i < size; i++) {
+      uint32_t reversed = 0;
+      for (size_t bit = 0; bit < bits; bit++)
+        if (i & ((size_t)1 << bit))
+          reversed |= 1u << (bits - 1 - bit);
+      _reversed[i] = reversed;
+    }
+
+    for (size_t half = 1; half < size; half *= 2) {
+      for (size_t k = 0; k < half; k++) {
+        double angle = -std::numbers::pi * (double)k / (double)half;
+        _twiddle_re[half + k] = (float)std::cos(angle);
+        _twiddle_im[half + k] = (float)std::sin(angle);
+      }
+    }
+  }
+
+  void forward(float *re, float *im) const {
+    for (size_t i = 0; i < size; i++) {
+      auto j = _reversed[i];
+      if (i < j) {
+        std::swap(re[i], re[j]);
+        std::swap(im[i], im[j]);
+      }
+    }
+
+    _radix_4(re, im);
+    for (size_t half = 4; half < size; half *= 2)
+      _radix_2(re, im, half);
+  }
+
+  // The first two radix-2 stages at once, their twiddles are 1 and -i.
+  void _radix_4(float *re, float *im) const {
+    for (size_t i = 0; i < size; i += 4) {
+      float ar = re[i] + re[i + 1], ai = im[i] + im[i + 1];
+      float br = re[i] - re[i + 1], bi = im[i] - im[i + 1];
+      float cr = re[i + 2] + re[i + 3], ci = im[i + 2] + im[i + 3];
+      float dr = re[i + 2] - re[i + 3], di = im[i + 2] - im[i + 3];
+
+      re[i] = ar + cr;
+      im[i] = ai + ci;
+      re[i + 2] = ar - cr;
+      im[i + 2] = ai - ci;
+      // d times -i
+      re[i + 1] = br + di;
+      im[i + 1] = bi - dr;
+      re[i + 3] = br - di;
+      im[i + 3] = bi + dr;
+    }
+  }
+
+  void _radix_2(float *re, float *im, size_t half) const {
+    using namespace _fft;
+    const float *wr = _twiddle_re.data() + half;
+    const float *wi = _twiddle_im.data() + half;
+
+    for (size_t start = 0; start < size; start += half * 2) {
+      float *ar = re + start, *ai = im + start;
+      float *br = ar + half, *bi = ai + half;
+
+      size_t k = 0;
+      for (; k + LANES <= half; k += LANES) {
+        Lane xr = load(br + k), xi = load(bi + k);
+        Lane cr = load(wr + k), ci = load(wi + k);
+        Lane tr = sub(mul(xr, cr), mul(xi, ci));
+        Lane ti = add(mul(xr, ci), mul(xi, cr));
+        Lane yr = load(ar + k), yi = load(ai + k);
+        store(br + k, sub(yr, tr));
+        store(bi + k, sub(yi, ti));
+        store(ar + k, add(yr, tr));
+        store(ai + k, add(yi, ti));
+      }
+      for (; k < half; k++) {
+        float tr = br[k] * wr[k] - bi[k] * wi[k];
+        float ti = br[k] * wi[k] + bi[k] * wr[k];
+        br[k] = ar[k] - tr;
+        bi[k] = ai[k] - ti;
+        ar[k] += tr;
+        ai[k] += ti;
+      }
+    }
+  }
+};
+
+} // namespace retort
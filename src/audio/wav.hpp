@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace retort {
+
+// Reads the samples of a RIFF WAVE file a block at a time, mixed down to
+// mono floats, starting over at the end. Integer PCM of 8 to 32 bits and
+// 32-bit float are understood.
+struct WavStream {
+  std::unique_ptr<FILE, int (*)(FILE *)> file{nullptr, fclose};
+  uint32_t sample_rate = 0;
+  uint16_t channels = 0;
+  uint16_t bits_per_sample = 0;
+  bool is_float = false;
+  long data_offset = 0;
+  uint32_t data_size = 0;
+  uint32_t _position = 0;
+  std::vector<uint8_t> _bytes;
+
+  size_t frame_size() const { return (size_t)channels * bits_per_sample / 8; }
+
+  float _sample(const uint8_t *p) const {
+    switch (bits_per_sample) {
+    case 8:
+      return (p[0] - 128) / 128.f;
+    case 16:
+      return (int16_t)(p[0] | p[1] << 8) / 32768.f;
+    case 24:
+      return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+                       (uint32_t)p[2] << 24) /
+             2147483648.f;
+    case 32:
+      if (is_float) {
+        float value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+      }
+      return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24) /
+             2147483648.f;
+    }
+    return 0.f;
+  }
+
+  // Fills all of `out`, wrapping around at the end of the data.
+  void read_mono(float *out, size_t frame_count) {
+    auto size = frame_size();
+    auto sample_size = bits_per_sample / 8;
+    while (frame_count > 0) {
+      if (_position + size > data_size) {
+        fseek(file.get(), data_offset, SEEK_SET);
+        _position = 0;
+      }
+
+      auto frames = std::min<size_t>(frame_count,
+                                     (data_size - _position) / size);
+      _bytes.resize(frames * size);
+      auto read = fread(_bytes.data(), size, frames, file.get());
+      if (read == 0) {
+        // Truncated file, treat what is there as all of it
+        data_size = _position;
+        std::fill(out, out + frame_count, 0.f);
+        return;
+      }
+
+      for (size_t i = 0; i < read; i++) {
+        float sum = 0.f;
+        for (size_t channel = 0; channel < channels; channel++)
+          sum += _sample(&_bytes[i * size + channel * sample_size]);
+        out[i] = sum / channels;
+      }
+      out += read;
+      frame_count -= read;
+      _position += (uint32_t)(read * size);
+    }
+  }
+};
+
+auto open_wav(const std::filesystem::path &path, std::string &error)
+    -> std::optional<WavStream> {
+  const uint16_t FORMAT_PCM = 1;
+  const uint16_t FORMAT_FLOAT = 3;
+  const uint16_t FORMAT_EXTENSIBLE = 0xFFFE;
+
+  WavStream stream;
+  stream.file.reset(fopen(path.string().c_str(), "rb"));
+  if (!stream.file) {
+    error = "cannot open " + path.string();
+    return std::nullopt;
+  }
+
+  auto file = stream.file.get();
+  auto u16 = [](const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); };
+  auto u32 = [](const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+  };
+
+  uint8_t header[12];
+  if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) != 0 ||
+      memcmp(header + 8, "WAVE", 4) != 0) {
+    error = path.string() + " is not a WAVE file";
+    return std::nullopt;
+  }
+
+  bool has_format = false;
+  uint16_t format = 0;
+  uint8_t chunk[8];
+  while (fread(chunk, 1, 8, file) == 8) {
+    auto size = u32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      std::vector<uint8_t> fmt(size);
+      if (fread(fmt.data(), 1, size, file) != size)
+        break;
+      format = u16(&fmt[0]);
+      stream.channels = u16(&fmt[2]);
+      stream.sample_rate = u32(&fmt[4]);
+      stream.bits_per_sample = u16(&fmt[14]);
+      if (format == FORMAT_EXTENSIBLE && size >= 26)
+        format = u16(&fmt[24]);
+      has_format = true;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      stream.data_offset = ftell(file);
+      stream.data_size = size;
+      break;
+    } else {
+      fseek(file, size, SEEK_CUR);
+    }
+    // Chunks are padded to an even size
+    if (size % 2 == 1)
+      fseek(file, 1, SEEK_CUR);
+  }
+
+  stream.is_float = format == FORMAT_FLOAT;
+  bool is_supported =
+      (format == FORMAT_PCM && stream.bits_per_sample % 8 == 0 &&
+       stream.bits_per_sample >= 8 && stream.bits_per_sample <= 32) ||
+      (format == FORMAT_FLOAT && stream.bits_per_sample == 32);
+  if (!has_format || !is_supported || stream.channels == 0 ||
+      stream.sample_rate == 0) {
+    error = path.string() + " is not 8 to 32 bit PCM or 32 bit float";
+    return std::nullopt;
+  }
+  if (stream.data_size < stream.frame_size()) {
+    error = path.string() + " has no samples";
+    return std::nullopt;
+  }
+
+  return stream;
+}
+
+} // namespace retort
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "compare.hpp"
+#include "offscreen.hpp"
+#include "options.hpp"
+#include "renderer.hpp"
+#include "threading.hpp"
+#include "tracing.hpp"
+
+namespace retort {
+
+// Frames every permutation is compared to the reference at, this far apart.
+const uint32_t AUTOTUNE_SAMPLE_FRAMES = 4;
+const double AUTOTUNE_SAMPLE_SECONDS = 0.5;
+
+// The values tried for one `#define`, the first one is the reference.
+struct AutotuneParameter {
+  std::string name;
+  std::vector<std::string> values;
+};
+
+// Parses `NAME=a,b,c`.
+auto parse_autotune_parameter(const std::string &spec)
+    -> std::optional<AutotuneParameter> {
+  auto equals = spec.find('=');
+  if (equals == std::string::npos || equals == 0)
+    return std::nullopt;
+
+  AutotuneParameter parameter;
+  parameter.name = spec.substr(0, equals);
+  size_t start = equals + 1;
+  while (start <= spec.size()) {
+    auto comma = std::min(spec.find(',', start), spec.size());
+    parameter.values.push_back(spec.substr(start, comma - start));
+    start = comma + 1;
+  }
+  if (std::any_of(parameter.values.begin(), parameter.values.end(),
+                  [](auto &value) { return value.empty(); }))
+    return std::nullopt;
+  return parameter;
+}
+
+// Every combination of values, the reference first.
+auto autotune_permutations(const std::vector<AutotuneParameter> &parameters)
+    -> std::vector<ShaderDefines> {
+  std::vector<ShaderDefines> permutations = {{}};
+  for (auto &parameter : parameters) {
+    std::vector<ShaderDefines> extended;
+    for (auto &defines : permutations)
+      for (auto &value : parameter.values) {
+        extended.push_back(defines);
+        extended.back().emplace_back(parameter.name, value);
+      }
+    permutations = std::move(extended);
+  }
+  return permutations;
+}
+
+std::string describe_defines(const ShaderDefines &defines) {
+  std::string description;
+  for (auto &[name, value] : defines) {
+    if (!description.empty())
+      description += " ";
+    description += name + "=" + value;
+  }
+  return description;
+}
+
+// Root mean square difference of two 8-bit images, in [0, 1]. Alpha is left
+// out, the swapchain ignores it.
+double image_rmse(const uint8_t *a, const uint8_t *b, size_t pixel_count) {
+  double sum = 0.;
+  for (size_t i = 0; i < pixel_count * 4; i++) {
+    if (i % 4 == 3)
+      continue;
+    double difference = ((double)a[i] - (double)b[i]) / 255.;
+    sum += difference * difference;
+  }
+  return std::sqrt(sum / (pixel_count * 3));
+}
+
+struct AutotuneResult {
+  ShaderDefines defines;
+  std::string name;
+  std::optional<CompilationError> failure;
+  RunningStatistics gpu_ms;
+  // Against the reference, averaged over the sample frames
+  double rmse = 0.;
+  bool is_pareto_optimal = false;
+};
+
+// Marks the results that no other beats on both time and difference.
+void mark_pareto_front(std::vector<AutotuneResult> &results) {
+  for (auto &result : results) {
+    if (result.failure)
+      continue;
+    result.is_pareto_optimal = std::none_of(
+        results.begin(), results.end(), [&](const AutotuneResult &other) {
+          if (other.failure || &other == &result)
+            return false;
+          bool is_no_worse = other.gpu_ms.mean <= result.gpu_ms.mean &&
+                             other.rmse <= result.rmse;
+          bool is_better = other.gpu_ms.mean < result.gpu_ms.mean ||
+                           other.rmse < result.rmse;
+          return is_no_worse && is_better;
+        });
+  }
+}
+
+struct AutotuneSettings {
+  std::filesystem::path path;
+  std::vector<AutotuneParameter> parameters;
+  VkExtent2D extent;
+  uint32_t batch_size = 16;
+  uint32_t rounds = 8;
+};
+
+// Compiles every permutation of the defines of one shader in parallel, then
+// renders each offscreen to compare it against the reference and times it
+// with timestamps. Timing goes round by round through all permutations in a
+// rotating order, like `ShaderComparison` does for two.
+struct ShaderAutotuner {
+  Renderer &renderer;
+  AutotuneSettings settings;
+  OffscreenTarget target;
+  Buffer readback;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  VkQueryPool query_pool = VK_NULL_HANDLE;
+
+  std::vector<AutotuneResult> results;
+  // The sample frames of the reference, one after another
+  std::vector<uint8_t> reference;
+
+  ShaderAutotuner(Renderer &renderer, AutotuneSettings settings)
+      : renderer(renderer), settings(settings),
+        target(create_offscreen_target(
+            renderer.dispatch, renderer.physical_device.memory_properties,
+            renderer.surface_format.format, settings.extent)) {
+    EXPECT(renderer.timestamp_period_ns > 0.);
+    auto &dispatch = renderer.dispatch;
+
+    readback = create_buffer(dispatch,
+                             renderer.physical_device.memory_properties,
+                             _frame_size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                             VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex =
+        renderer.device.get_queue_index(vkb::QueueType::graphics).value();
+    CHECK_VK_ERRC(dispatch.createCommandPool(&pool_info, nullptr,
+                                             &command_pool));
+
+    VkCommandBufferAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+    CHECK_VK_ERRC(
+        dispatch.allocateCommandBuffers(&allocate_info, &command_buffer));
+
+    for (auto &defines : autotune_permutations(settings.parameters)) {
+      AutotuneResult result;
+      result.defines = defines;
+      result.name = settings.path.string() + " [" + describe_defines(defines) +
+                    "]";
+      results.push_back(result);
+    }
+
+    VkQueryPoolCreateInfo query_info = {};
+    query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_info.queryCount = _query_count();
+    CHECK_VK_ERRC(dispatch.createQueryPool(&query_info, nullptr, &query_pool));
+  }
+
+  ~ShaderAutotuner() {
+    auto &dispatch = renderer.dispatch;
+    CHECK_VK_ERRC(dispatch.deviceWaitIdle());
+    dispatch.destroyQueryPool(query_pool, nullptr);
+    dispatch.destroyCommandPool(command_pool, nullptr);
+    destroy_buffer(dispatch, readback);
+    destroy_offscreen_target(dispatch, target);
+  }
+
+  VkDeviceSize _frame_size() const {
+    return (VkDeviceSize)settings.extent.width * settings.extent.height * 4;
+  }
+
+  // Two timestamps per draw, a batch of draws per permutation.
+  uint32_t _query_count() const {
+    return (uint32_t)results.size() * settings.batch_size * 2;
+  }
+
+  ShaderInputs _inputs(uint64_t frame, double seconds_per_frame) const {
+    ShaderInputs inputs = {};
+    inputs.resolution[0] = (float)settings.extent.width;
+    inputs.resolution[1] = (float)settings.extent.height;
+    inputs.time = (float)(frame * seconds_per_frame);
+    inputs.delta_time = (float)seconds_per_frame;
+    inputs.frame = (uint32_t)frame;
+    return inputs;
+  }
+
+  // Everything that failed to compile is left out from here on.
+  void compile(ThreadPool &pool) {
+    TRACE_SCOPE("ShaderAutotuner::compile");
+    std::vector<ShaderVariant> variants;
+    for (auto &result : results)
+      variants.push_back({result.name, settings.path, result.defines});
+
+    for (auto &failure : renderer.prewarm_shader_variants(variants, pool))
+      for (auto &result : results)
+        if (result.name == failure.filename)
+          result.failure = failure.error;
+  }
+
+  bool has_reference() const { return !results[0].failure; }
+
+  void _begin() {
+    auto &dispatch = renderer.dispatch;
+    CHECK_VK_ERRC(dispatch.resetCommandBuffer(command_buffer, 0));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK_ERRC(dispatch.beginCommandBuffer(command_buffer, &begin_info));
+  }
+
+  void _submit_and_wait() {
+    auto &dispatch = renderer.dispatch;
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(command_buffer));
+
+    auto &timeline = *renderer.render_data.timeline;
+    TimelineSignal signal(1);
+    signal.values[0] = timeline.next();
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &timeline.semaphore;
+    signal.chain(submit_info);
+    CHECK_VK_ERRC(dispatch.queueSubmit(renderer.render_data.graphics_queue, 1,
+                                       &submit_info, VK_NULL_HANDLE));
+    timeline.wait(signal.values[0]);
+  }
+
+  // Renders the sample frames of every permutation, the reference first, and
+  // averages how far each is from it.
+  void measure_differences() {
+    TRACE_SCOPE("ShaderAutotuner::measure_differences");
+    auto frame_size = (size_t)_frame_size();
+    auto pixel_count = frame_size / 4;
+    reference.resize(frame_size * AUTOTUNE_SAMPLE_FRAMES);
+
+    for (size_t i = 0; i < results.size(); i++) {
+      auto &result = results[i];
+      if (result.failure)
+        continue;
+      auto pipeline =
+          renderer.prepared_shaders.at(result.name).graphics_pipeline;
+
+      double sum = 0.;
+      for (uint32_t frame = 0; frame < AUTOTUNE_SAMPLE_FRAMES; frame++) {
+        _begin();
+        renderer.record_shader_pass(command_buffer, pipeline,
+                                    target.render_pass, target.framebuffer,
+                                    settings.extent,
+                                    _inputs(frame, AUTOTUNE_SAMPLE_SECONDS));
+        record_readback(renderer.dispatch, command_buffer, target,
+                        readback.buffer, 0, {{0, 0}, settings.extent});
+        _submit_and_wait();
+
+        auto pixels = (const uint8_t *)readback.mapped;
+        auto expected = reference.data() + frame * frame_size;
+        if (i == 0)
+          memcpy(expected, pixels, frame_size);
+        sum += image_rmse(pixels, expected, pixel_count);
+      }
+      result.rmse = sum / AUTOTUNE_SAMPLE_FRAMES;
+    }
+  }
+
+  // Times one round of every permutation, blocking until the GPU is done.
+  void time_round(uint32_t round) {
+    TRACE_SCOPE("ShaderAutotuner::time_round");
+    auto &dispatch = renderer.dispatch;
+    std::vector<size_t> order;
+    for (size_t i = 0; i < results.size(); i++)
+      if (!results[i].failure)
+        order.push_back(i);
+    std::rotate(order.begin(), order.begin() + round % order.size(),
+                order.end());
+
+    _begin();
+    dispatch.cmdResetQueryPool(command_buffer, query_pool, 0, _query_count());
+    uint32_t query = 0;
+    for (auto i : order) {
+      auto pipeline =
+          renderer.prepared_shaders.at(results[i].name).graphics_pipeline;
+      for (uint32_t j = 0; j < settings.batch_size; j++) {
+        // Every permutation sees the same sequence of inputs within a round
+        auto frame = (uint64_t)round * settings.batch_size + j;
+        dispatch.cmdPipelineBarrier(
+            command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 0,
+            nullptr);
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                   query_pool, query++);
+        renderer.record_shader_pass(command_buffer, pipeline,
+                                    target.render_pass, target.framebuffer,
+                                    settings.extent, _inputs(frame, 1. / 60.));
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                   query_pool, query++);
+      }
+    }
+    _submit_and_wait();
+
+    std::vector<uint64_t> timestamps(query);
+    CHECK_VK_ERRC(dispatch.getQueryPoolResults(
+        query_pool, 0, query, timestamps.size() * sizeof(uint64_t),
+        timestamps.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+    if (round < COMPARISON_WARMUP_ROUNDS)
+      return;
+    for (size_t k = 0; k < order.size(); k++)
+      for (uint32_t j = 0; j < settings.batch_size; j++) {
+        auto first = (k * settings.batch_size + j) * 2;
+        double ms =
+            renderer.timestamp_ms(timestamps[first], timestamps[first + 1]);
+        results[order[k]].gpu_ms.add(ms);
+      }
+  }
+
+  void run(ThreadPool &pool) {
+    compile(pool);
+    if (!has_reference())
+      return;
+    measure_differences();
+    for (uint32_t round = 0;
+         round < settings.rounds + COMPARISON_WARMUP_ROUNDS; round++) {
+      time_round(round);
+      fprintf(stderr, "\rround %u/%u", round + 1,
+              settings.rounds + COMPARISON_WARMUP_ROUNDS);
+    }
+    fprintf(stderr, "\n");
+    mark_pareto_front(results);
+  }
+
+  // Fastest first, the Pareto front marked with a star.
+  void print() const {
+    std::vector<const AutotuneResult *> sorted;
+    for (auto &result : results)
+      if (!result.failure)
+        sorted.push_back(&result);
+    std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+      return a->gpu_ms.mean < b->gpu_ms.mean;
+    });
+
+    auto &reference = results[0];
+    fprintf(stderr, "reference: %s\n",
+            describe_defines(reference.defines).c_str());
+    fprintf(stderr, "  %10s %10s %10s  %s\n", "ms", "+-", "rmse", "defines");
+    for (auto result : sorted) {
+      auto speedup = reference.gpu_ms.mean / result->gpu_ms.mean;
+      fprintf(stderr, "%c %10.4f %10.4f %10.5f  %s (%.2fx)\n",
+              result->is_pareto_optimal ? '*' : ' ', result->gpu_ms.mean,
+              std::sqrt(result->gpu_ms.variance()), result->rmse,
+              describe_defines(result->defines).c_str(), speedup);
+    }
+    for (auto &result : results)
+      if (result.failure)
+        fprintf(stderr, "failed: %s\n%s\n",
+                describe_defines(result.defines).c_str(),
+                result.failure->messages.c_str());
+  }
+};
+
+int run_autotune(Bootstrap bootstrap, const Options &options) {
+  AutotuneSettings settings;
+  settings.path = options.files[0];
+  settings.extent = {options.width, options.height};
+  settings.batch_size = options.compare_batch;
+  settings.rounds = options.autotune_rounds;
+  for (auto &spec : options.autotune_defines) {
+    auto parameter = parse_autotune_parameter(spec);
+    if (!parameter)
+      usage_error("expected <name>=<value>,... for --define, got " + spec);
+    settings.parameters.push_back(parameter.value());
+  }
+
+  Renderer renderer(bootstrap);
+  renderer.optimizer_recipe = options.optimizer_recipe;
+  if (options.print_startup_times)
+    startup_times().print();
+  if (renderer.timestamp_period_ns <= 0.) {
+    std::cerr << "the graphics queue cannot write timestamps" << std::endl;
+    return 1;
+  }
+  if (!renderer.load_textures(options.textures))
+    return 1;
+
+  ThreadPool pool;
+  ShaderAutotuner autotuner(renderer, settings);
+  fprintf(stderr, "compiling %zu permutations\n", autotuner.results.size());
+  autotuner.run(pool);
+  if (!autotuner.has_reference()) {
+    std::cerr << autotuner.results[0].failure->messages << std::endl;
+    return 1;
+  }
+  autotuner.print();
+  return 0;
+}
+
+} // namespace retort
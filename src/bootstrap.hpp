@@ -1,6 +1,8 @@
 #pragma once
 
+#include <future>
 #include <iostream>
+#include <memory>
 
 #include <VkBootstrap.h>
 
@@ -11,6 +13,8 @@
 #include <backends/imgui_impl_vulkan.h>
 #include <imgui.h>
 
+#include "shaders/compiler.hpp"
+#include "startup.hpp"
 #include "utils.hpp"
 
 namespace retort {
@@ -20,11 +24,23 @@ struct Bootstrap {
   vkb::Device device;
   vkb::Instance instance;
   vkb::PhysicalDevice physical_device;
+  // Initialized on another thread while the device is being created
+  std::shared_future<std::shared_ptr<Compiler>> compiler;
 };
 
-Bootstrap bootstrap() {
-  EXPECT(glfwInit());
-  EXPECT(glfwVulkanSupported());
+// Headless runs still create a window to get a device that can present, it
+// just stays hidden.
+Bootstrap bootstrap(bool is_headless = false) {
+  auto compiler = std::async(std::launch::async, []() {
+                    StartupScope scope("shaderc initialization");
+                    return std::make_shared<Compiler>();
+                  }).share();
+
+  {
+    StartupScope scope("glfw initialization");
+    EXPECT(glfwInit());
+    EXPECT(glfwVulkanSupported());
+  }
 
   std::vector<const char *> vulkan_extensions;
 
@@ -34,6 +50,7 @@ Bootstrap bootstrap() {
   for (uint32_t i = 0; i < glfw_extension_count; i++)
     vulkan_extensions.push_back(glfw_extensions[i]);
 
+  std::optional<StartupScope> scope("instance creation");
   vkb::InstanceBuilder instance_builder;
   auto instance_builder_return = instance_builder.set_app_name("Retort")
                                      .set_engine_name("Retort In-House")
@@ -49,9 +66,10 @@ Bootstrap bootstrap() {
   }
   vkb::Instance vkb_instance = instance_builder_return.value();
 
-  vkb::PhysicalDeviceSelector selector{vkb_instance};
+  scope.emplace("window creation");
 
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  glfwWindowHint(GLFW_VISIBLE, is_headless ? GLFW_FALSE : GLFW_TRUE);
   GLFWwindow *window = glfwCreateWindow(640, 480, "Retort", NULL, NULL);
 
   VkSurfaceKHR surface;
@@ -61,9 +79,21 @@ Bootstrap bootstrap() {
     PANIC("sadge");
   }
 
+  scope.emplace("physical device selection");
+  VkPhysicalDeviceVulkan12Features features_12 = {};
+  features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  features_12.timelineSemaphore = VK_TRUE;
+  // The bindless texture table
+  features_12.runtimeDescriptorArray = VK_TRUE;
+  features_12.descriptorBindingPartiallyBound = VK_TRUE;
+  features_12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  features_12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+  features_12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
   auto phys_ret = vkb::PhysicalDeviceSelector(vkb_instance)
                       .set_surface(surface)
                       .set_minimum_version(1, 2)
+                      .set_required_features_12(features_12)
                       .require_dedicated_transfer_queue()
                       .select();
   if (!phys_ret) {
@@ -74,6 +104,7 @@ Bootstrap bootstrap() {
 
   auto vkb_physical = phys_ret.value();
 
+  scope.emplace("device creation");
   vkb::DeviceBuilder device_builder{vkb_physical};
   auto dev_ret = device_builder.build();
   if (!dev_ret) {
@@ -82,12 +113,14 @@ Bootstrap bootstrap() {
     PANIC("sadge");
   }
   vkb::Device vkb_device = dev_ret.value();
+  scope.reset();
 
   Bootstrap ret;
   ret.window = window;
   ret.device = vkb_device;
   ret.instance = vkb_instance;
   ret.physical_device = vkb_physical;
+  ret.compiler = compiler;
 
   return ret;
 }
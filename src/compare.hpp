@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "offscreen.hpp"
+#include "options.hpp"
+#include "renderer.hpp"
+#include "tracing.hpp"
+
+namespace retort {
+
+// Rounds whose timings are thrown away while clocks and caches settle.
+const uint32_t COMPARISON_WARMUP_ROUNDS = 2;
+// Samples per shader at the first look at the interval.
+const uint64_t COMPARISON_MINIMUM_SAMPLES = 64;
+// Looks at the interval, at sample counts doubling from the minimum, the last
+// one early if time runs out. Stopping at the first decisive look out of
+// many is far more likely to find a difference that is not there than a
+// single look, so each one spends an equal share of 1 - confidence
+// (Bonferroni) and the overall error rate stays within it.
+const uint32_t COMPARISON_LOOKS = 10;
+// Intervals that fit within this fraction of the mean time of A count as no
+// difference, so that two equal shaders do not run until the time limit.
+const double COMPARISON_EQUIVALENCE_MARGIN = 0.005;
+
+// Mean and variance without keeping the samples (Welford).
+struct RunningStatistics {
+  uint64_t count = 0;
+  double mean = 0.;
+  double _m2 = 0.;
+
+  void add(double x) {
+    count++;
+    double delta = x - mean;
+    mean += delta / count;
+    _m2 += delta * (x - mean);
+  }
+
+  double variance() const { return count > 1 ? _m2 / (count - 1) : 0.; }
+};
+
+double normal_quantile(double p) {
+  double lo = -10., hi = 10.;
+  for (int i = 0; i < 100; i++) {
+    double mid = (lo + hi) / 2.;
+    if (0.5 * std::erfc(-mid / std::sqrt(2.)) < p)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return (lo + hi) / 2.;
+}
+
+// Cornish-Fisher expansion around the normal quantile, accurate to well below
+// a percent for the degrees of freedom we get past the minimum sample count.
+double student_t_quantile(double p, double degrees_of_freedom) {
+  double z = normal_quantile(p), n = degrees_of_freedom;
+  double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z;
+  return z + (z3 + z) / (4. * n) +
+         (5. * z5 + 16. * z3 + 3. * z) / (96. * n * n) +
+         (3. * z7 + 19. * z5 + 17. * z3 - 15. * z) / (384. * n * n * n);
+}
+
+// B minus A, so a positive difference means B is slower.
+struct MeanDifference {
+  double difference_ms = 0.;
+  double half_width_ms = 0.;
+
+  double lower() const { return difference_ms - half_width_ms; }
+  double upper() const { return difference_ms + half_width_ms; }
+};
+
+// Welch's interval, the two shaders need not have the same variance.
+auto welch_interval(const RunningStatistics &a, const RunningStatistics &b,
+                    double confidence) -> MeanDifference {
+  double va = a.variance() / a.count, vb = b.variance() / b.count;
+  double degrees_of_freedom =
+      (va + vb) * (va + vb) /
+      (va * va / (a.count - 1) + vb * vb / (b.count - 1));
+  if (!std::isfinite(degrees_of_freedom))
+    degrees_of_freedom = (double)(a.count + b.count - 2);
+
+  double t =
+      student_t_quantile(1. - (1. - confidence) / 2., degrees_of_freedom);
+  return {b.mean - a.mean, t * std::sqrt(va + vb)};
+}
+
+enum struct ComparisonVerdict {
+  Running,
+  AFaster,
+  BFaster,
+  Equivalent,
+  Inconclusive,
+};
+
+const char *comparison_verdict_name(ComparisonVerdict verdict) {
+  switch (verdict) {
+  case ComparisonVerdict::Running:
+    return "running";
+  case ComparisonVerdict::AFaster:
+    return "A is faster";
+  case ComparisonVerdict::BFaster:
+    return "B is faster";
+  case ComparisonVerdict::Equivalent:
+    return "no difference";
+  case ComparisonVerdict::Inconclusive:
+    return "inconclusive";
+  }
+  return "unknown";
+}
+
+struct ComparisonSettings {
+  std::string a;
+  std::string b;
+  VkExtent2D extent;
+  uint32_t batch_size = 16;
+  double confidence = 0.95;
+  double max_seconds = 60.;
+};
+
+// Times two prepared shaders against each other offscreen. Every round draws
+// a batch of each with the same inputs, alternating which goes first so that
+// clock ramps and thermal drift do not favour either. Each draw is fenced off
+// from its neighbours and timed on its own.
+struct ShaderComparison {
+  Renderer &renderer;
+  ComparisonSettings settings;
+  OffscreenTarget target;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  VkQueryPool query_pool = VK_NULL_HANDLE;
+
+  RunningStatistics a;
+  RunningStatistics b;
+  uint64_t round = 0;
+  uint32_t looks = 0;
+  ComparisonVerdict verdict = ComparisonVerdict::Running;
+  std::chrono::steady_clock::time_point start;
+
+  ShaderComparison(Renderer &renderer, ComparisonSettings settings)
+      : renderer(renderer), settings(settings),
+        target(create_offscreen_target(
+            renderer.dispatch, renderer.physical_device.memory_properties,
+            renderer.surface_format.format, settings.extent)),
+        start(std::chrono::steady_clock::now()) {
+    EXPECT(renderer.timestamp_period_ns > 0.);
+    auto &dispatch = renderer.dispatch;
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex =
+        renderer.device.get_queue_index(vkb::QueueType::graphics).value();
+    CHECK_VK_ERRC(dispatch.createCommandPool(&pool_info, nullptr,
+                                             &command_pool));
+
+    VkCommandBufferAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+    CHECK_VK_ERRC(
+        dispatch.allocateCommandBuffers(&allocate_info, &command_buffer));
+
+    VkQueryPoolCreateInfo query_info = {};
+    query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_info.queryCount = _query_count();
+    CHECK_VK_ERRC(dispatch.createQueryPool(&query_info, nullptr, &query_pool));
+  }
+
+  ~ShaderComparison() {
+    auto &dispatch = renderer.dispatch;
+    CHECK_VK_ERRC(dispatch.deviceWaitIdle());
+    dispatch.destroyQueryPool(query_pool, nullptr);
+    dispatch.destroyCommandPool(command_pool, nullptr);
+    destroy_offscreen_target(dispatch, target);
+  }
+
+  // Two timestamps per draw, a batch of draws per shader.
+  uint32_t _query_count() const { return settings.batch_size * 4; }
+
+  double elapsed_seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+  }
+
+  double look_confidence() const {
+    return 1. - (1. - settings.confidence) / COMPARISON_LOOKS;
+  }
+
+  auto interval() const -> MeanDifference {
+    return welch_interval(a, b, look_confidence());
+  }
+
+  bool is_running() const { return verdict == ComparisonVerdict::Running; }
+
+  // Renders and times one round, blocking until the GPU is done with it.
+  void step() {
+    TRACE_SCOPE("ShaderComparison::step");
+    auto &dispatch = renderer.dispatch;
+    bool is_b_first = round % 2 == 1;
+    VkPipeline pipelines[2] = {
+        renderer.prepared_shaders.at(settings.a).graphics_pipeline,
+        renderer.prepared_shaders.at(settings.b).graphics_pipeline,
+    };
+    if (is_b_first)
+      std::swap(pipelines[0], pipelines[1]);
+
+    CHECK_VK_ERRC(dispatch.resetCommandBuffer(command_buffer, 0));
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK_ERRC(dispatch.beginCommandBuffer(command_buffer, &begin_info));
+    dispatch.cmdResetQueryPool(command_buffer, query_pool, 0, _query_count());
+
+    uint32_t query = 0;
+    for (auto pipeline : pipelines) {
+      for (uint32_t i = 0; i < settings.batch_size; i++) {
+        // Both shaders see the same sequence of inputs within a round
+        auto frame = round * settings.batch_size + i;
+        ShaderInputs inputs = {};
+        inputs.resolution[0] = (float)settings.extent.width;
+        inputs.resolution[1] = (float)settings.extent.height;
+        inputs.time = (float)(frame / 60.);
+        inputs.delta_time = (float)(1. / 60.);
+        inputs.frame = (uint32_t)frame;
+
+        dispatch.cmdPipelineBarrier(
+            command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 0,
+            nullptr);
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                   query_pool, query++);
+        renderer.record_shader_pass(command_buffer, pipeline,
+                                    target.render_pass, target.framebuffer,
+                                    settings.extent, inputs);
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                   query_pool, query++);
+      }
+    }
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(command_buffer));
+
+    auto &timeline = *renderer.render_data.timeline;
+    TimelineSignal signal(1);
+    signal.values[0] = timeline.next();
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &timeline.semaphore;
+    signal.chain(submit_info);
+    CHECK_VK_ERRC(dispatch.queueSubmit(renderer.render_data.graphics_queue, 1,
+                                       &submit_info, VK_NULL_HANDLE));
+    timeline.wait(signal.values[0]);
+
+    std::vector<uint64_t> timestamps(_query_count());
+    CHECK_VK_ERRC(dispatch.getQueryPoolResults(
+        query_pool, 0, _query_count(), timestamps.size() * sizeof(uint64_t),
+        timestamps.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+    if (round++ < COMPARISON_WARMUP_ROUNDS)
+      return;
+
+    for (uint32_t i = 0; i < settings.batch_size * 2; i++) {
+      double ms =
+          renderer.timestamp_ms(timestamps[i * 2], timestamps[i * 2 + 1]);
+      bool is_first_batch = i < settings.batch_size;
+      (is_first_batch != is_b_first ? a : b).add(ms);
+    }
+    verdict = _verdict();
+  }
+
+  ComparisonVerdict _verdict() {
+    bool is_out_of_time = elapsed_seconds() >= settings.max_seconds;
+    auto samples = std::min(a.count, b.count);
+    if (samples < COMPARISON_MINIMUM_SAMPLES)
+      return is_out_of_time ? ComparisonVerdict::Inconclusive
+                            : ComparisonVerdict::Running;
+    if (!is_out_of_time && samples < (COMPARISON_MINIMUM_SAMPLES << looks))
+      return ComparisonVerdict::Running;
+
+    looks++;
+    bool is_last_look = is_out_of_time || looks == COMPARISON_LOOKS;
+    auto difference = interval();
+    if (difference.lower() > 0.)
+      return ComparisonVerdict::AFaster;
+    if (difference.upper() < 0.)
+      return ComparisonVerdict::BFaster;
+    if (difference.half_width_ms < COMPARISON_EQUIVALENCE_MARGIN * a.mean)
+      return ComparisonVerdict::Equivalent;
+    return is_last_look ? ComparisonVerdict::Inconclusive
+                        : ComparisonVerdict::Running;
+  }
+
+  void print() const {
+    auto difference = interval();
+    fprintf(stderr, "A %s\n  %.4fms mean over %llu draws\n",
+            settings.a.c_str(), a.mean, (unsigned long long)a.count);
+    fprintf(stderr, "B %s\n  %.4fms mean over %llu draws\n",
+            settings.b.c_str(), b.mean, (unsigned long long)b.count);
+    fprintf(stderr,
+            "B - A: %+.4fms (%+.2f%%), %.2f%% interval [%+.4fms, %+.4fms]\n",
+            difference.difference_ms, 100. * difference.difference_ms / a.mean,
+            100. * look_confidence(), difference.lower(), difference.upper());
+    fprintf(stderr, "%s after %.1fs\n", comparison_verdict_name(verdict),
+            elapsed_seconds());
+  }
+};
+
+// Exits with 2 when B is significantly slower than A by more than the allowed
+// regression, so that scripts can gate on it.
+int run_comparison(Bootstrap bootstrap, const Options &options) {
+  Renderer renderer(bootstrap);
+  renderer.optimizer_recipe = options.optimizer_recipe;
+  if (options.print_startup_times)
+    startup_times().print();
+  if (renderer.timestamp_period_ns <= 0.) {
+    std::cerr << "the graphics queue cannot write timestamps" << std::endl;
+    return 1;
+  }
+  if (!renderer.load_textures(options.textures))
+    return 1;
+
+  ComparisonSettings settings;
+  settings.a = options.files[0].string();
+  settings.b = options.files[1].string();
+  settings.extent = {options.width, options.height};
+  settings.batch_size = options.compare_batch;
+  settings.confidence = options.compare_confidence;
+  settings.max_seconds = options.compare_seconds;
+
+  for (auto &path : {settings.a, settings.b}) {
+    auto source = utils::read_file(path.c_str());
+    auto result = renderer.set_fragment_shader(path.c_str(), source.c_str());
+    if (!result) {
+      std::cerr << result.unwrap_err().messages << std::endl;
+      return 1;
+    }
+  }
+
+  ShaderComparison comparison(renderer, settings);
+  auto last_report = comparison.start;
+  while (comparison.is_running()) {
+    comparison.step();
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_report < std::chrono::seconds(1))
+      continue;
+    last_report = now;
+    if (comparison.a.count > 1 && comparison.b.count > 1) {
+      auto difference = comparison.interval();
+      fprintf(stderr, "\r%llu draws each, B - A %+.4fms +- %.4fms",
+              (unsigned long long)comparison.a.count,
+              difference.difference_ms, difference.half_width_ms);
+    }
+  }
+  fprintf(stderr, "\n");
+  comparison.print();
+
+  // Only the lower end of the interval counts, a regression has to be certain
+  if (options.compare_max_regression) {
+    auto allowed_ms =
+        comparison.a.mean * options.compare_max_regression.value() / 100.;
+    if (comparison.interval().lower() > allowed_ms)
+      return 2;
+  }
+  return 0;
+}
+
+} // namespace retort
@@ -23,6 +23,8 @@ struct [[nodiscard]] ResultBase : private std::variant<Ok, Err...> {
   bool is_ok() { return std::get_if<Ok>(this); }
 
   operator bool() { return this->is_ok(); }
+
+  template <typename E> E *_get_if() { return std::get_if<E>(this); }
 };
 
 template <typename Ok, typename... Err>
@@ -34,7 +36,7 @@ template <typename Ok, typename Err> struct Result<Ok, Err> : ResultBase<Ok, Err
   using ResultBase<Ok, Err>::ResultBase;
 
   Err &unwrap_err() {
-    auto err_ptr = std::get_if<Err>();
+    auto err_ptr = this->template _get_if<Err>();
     if (err_ptr == nullptr)
       PANIC("Failed to unwrap object");
     return *err_ptr;
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <io.h>
+
+#include <stb_image_write.h>
+
+#include "offscreen.hpp"
+#include "options.hpp"
+#include "readback.hpp"
+#include "renderer.hpp"
+#include "replay.hpp"
+
+namespace retort {
+
+enum struct ExportFormat {
+  Ppm,
+  Png,
+  Y4m,
+  Raw,
+};
+
+auto parse_export_format(const std::string &name)
+    -> std::optional<ExportFormat> {
+  if (name == "ppm")
+    return ExportFormat::Ppm;
+  if (name == "png")
+    return ExportFormat::Png;
+  if (name == "y4m")
+    return ExportFormat::Y4m;
+  if (name == "raw")
+    return ExportFormat::Raw;
+  return std::nullopt;
+}
+
+struct ExportSettings {
+  // A directory for image sequences, a file or "-" for streamed formats.
+  std::string output;
+  ExportFormat format;
+  uint32_t frame_count;
+  double fps;
+  VkExtent2D extent;
+  size_t ring_size;
+
+  bool is_stream() const {
+    return format == ExportFormat::Y4m || format == ExportFormat::Raw;
+  }
+};
+
+// Converts a tightly packed 8-bit RGBA or BGRA frame into packed RGB.
+void pack_rgb(const uint8_t *pixels, size_t pixel_count, bool is_bgra,
+              std::vector<uint8_t> &rgb) {
+  rgb.resize(pixel_count * 3);
+  size_t r = is_bgra ? 2 : 0, b = is_bgra ? 0 : 2;
+  for (size_t i = 0; i < pixel_count; i++) {
+    rgb[i * 3 + 0] = pixels[i * 4 + r];
+    rgb[i * 3 + 1] = pixels[i * 4 + 1];
+    rgb[i * 3 + 2] = pixels[i * 4 + b];
+  }
+}
+
+std::string frame_path(const std::string &output, uint64_t frame,
+                       const char *extension) {
+  char filename[64];
+  snprintf(filename, sizeof(filename), "frame_%06llu.%s",
+           (unsigned long long)frame, extension);
+  return (std::filesystem::path(output) / filename).string();
+}
+
+// Only for the formats with a file per frame.
+void write_rgb_image(const std::string &path, ExportFormat format,
+                     const std::vector<uint8_t> &rgb, uint32_t width,
+                     uint32_t height) {
+  if (format == ExportFormat::Ppm) {
+    FILE *file = fopen(path.c_str(), "wb");
+    EXPECT(file != nullptr);
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    fwrite(rgb.data(), 1, rgb.size(), file);
+    fclose(file);
+    return;
+  }
+  EXPECT(format == ExportFormat::Png);
+  EXPECT(stbi_write_png(path.c_str(), width, height, 3, rgb.data(),
+                        width * 3));
+}
+
+bool is_bgra_format(VkFormat format) {
+  bool is_bgra = format == VK_FORMAT_B8G8R8A8_SRGB ||
+                 format == VK_FORMAT_B8G8R8A8_UNORM;
+  EXPECT(is_bgra || format == VK_FORMAT_R8G8B8A8_SRGB ||
+         format == VK_FORMAT_R8G8B8A8_UNORM);
+  return is_bgra;
+}
+
+// Renders the active shader at a fixed timestep into an offscreen target and
+// streams the frames to disk. Frames are copied into a ring of readback
+// buffers, a writer thread encodes them while the GPU already works on the
+// next ones.
+struct FrameExporter {
+  Renderer &renderer;
+  ExportSettings settings;
+  OffscreenTarget target;
+  ReadbackRing ring;
+
+  bool is_bgra;
+  FILE *stream = nullptr;
+  std::vector<uint8_t> _rgb;
+  std::vector<uint8_t> _planes;
+
+  std::chrono::steady_clock::time_point _start;
+  std::chrono::steady_clock::time_point _last_report;
+
+  FrameExporter(Renderer &renderer, ExportSettings settings)
+      : renderer(renderer), settings(settings),
+        target(create_offscreen_target(
+            renderer.dispatch, renderer.physical_device.memory_properties,
+            renderer.surface_format.format, settings.extent)),
+        ring(renderer.dispatch, *renderer.render_data.timeline,
+             renderer.physical_device.memory_properties,
+             renderer.device.get_queue_index(vkb::QueueType::graphics).value(),
+             settings.ring_size, _frame_size()) {
+    is_bgra = is_bgra_format(renderer.surface_format.format);
+
+    if (settings.is_stream()) {
+      if (settings.output == "-") {
+        _setmode(_fileno(stdout), _O_BINARY);
+        stream = stdout;
+      } else {
+        stream = fopen(settings.output.c_str(), "wb");
+        EXPECT(stream != nullptr);
+      }
+    } else {
+      std::filesystem::create_directories(settings.output);
+    }
+  }
+
+  ~FrameExporter() {
+    if (stream && stream != stdout)
+      fclose(stream);
+    CHECK_VK_ERRC(renderer.dispatch.deviceWaitIdle());
+    destroy_offscreen_target(renderer.dispatch, target);
+  }
+
+  VkDeviceSize _frame_size() const {
+    return (VkDeviceSize)settings.extent.width * settings.extent.height * 4;
+  }
+
+  void run() {
+    _start = std::chrono::steady_clock::now();
+    _last_report = _start;
+
+    if (settings.format == ExportFormat::Y4m) {
+      // Frame rates are written as a ratio, keep three decimals of the rate
+      fprintf(stream, "YUV4MPEG2 W%u H%u F%u:1000 Ip A1:1 C444\n",
+              settings.extent.width, settings.extent.height,
+              (uint32_t)std::round(settings.fps * 1000.));
+    }
+
+    std::thread writer([this]() { _writer_loop(); });
+    for (uint32_t frame = 0; frame < settings.frame_count; frame++)
+      _render_frame(frame);
+    ring.close();
+    writer.join();
+
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - _start)
+                       .count();
+    std::cerr << "\nexported " << settings.frame_count << " frames in "
+              << seconds << "s (" << settings.frame_count / seconds
+              << " frames/s)" << std::endl;
+  }
+
+  void _render_frame(uint32_t frame) {
+    TRACE_SCOPE("FrameExporter::render_frame");
+    auto index = ring.acquire(frame);
+    auto &slot = ring.slots[index];
+    auto &dispatch = renderer.dispatch;
+
+    ShaderInputs inputs = {};
+    inputs.resolution[0] = (float)settings.extent.width;
+    inputs.resolution[1] = (float)settings.extent.height;
+    inputs.time = (float)(frame / settings.fps);
+    inputs.delta_time = (float)(1. / settings.fps);
+    inputs.frame = frame;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK_ERRC(
+        dispatch.beginCommandBuffer(slot.command_buffer, &begin_info));
+
+    auto pipeline = renderer.window_pipeline(renderer.primary_window());
+    renderer.record_shader_pass(slot.command_buffer, pipeline,
+                                target.render_pass, target.framebuffer,
+                                settings.extent, inputs);
+    record_readback(dispatch, slot.command_buffer, target, slot.buffer.buffer,
+                    0, {{0, 0}, settings.extent});
+
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(slot.command_buffer));
+
+    ring.submit(index, renderer.render_data.graphics_queue);
+  }
+
+  void _writer_loop() {
+    TRACE_THREAD_NAME("export writer");
+    while (auto index = ring.next()) {
+      auto &slot = ring.slots[index.value()];
+      TRACE_SCOPE("FrameExporter::write_frame");
+      // The slot is the render thread's again once released
+      auto frame = slot.frame;
+      _write_frame(frame, (const uint8_t *)slot.buffer.mapped);
+      ring.release(index.value());
+      _report_progress(frame + 1);
+    }
+  }
+
+  void _write_frame(uint64_t frame, const uint8_t *pixels) {
+    auto width = settings.extent.width, height = settings.extent.height;
+    size_t pixel_count = (size_t)width * height;
+    pack_rgb(pixels, pixel_count, is_bgra, _rgb);
+
+    switch (settings.format) {
+    case ExportFormat::Ppm:
+      write_rgb_image(frame_path(settings.output, frame, "ppm"),
+                      ExportFormat::Ppm, _rgb, width, height);
+      break;
+    case ExportFormat::Png:
+      write_rgb_image(frame_path(settings.output, frame, "png"),
+                      ExportFormat::Png, _rgb, width, height);
+      break;
+    case ExportFormat::Y4m: {
+      // BT.601 limited range, no chroma subsampling
+      _planes.resize(pixel_count * 3);
+      uint8_t *y = _planes.data();
+      uint8_t *u = y + pixel_count;
+      uint8_t *v = u + pixel_count;
+      for (size_t i = 0; i < pixel_count; i++) {
+        int r = _rgb[i * 3 + 0], g = _rgb[i * 3 + 1], b = _rgb[i * 3 + 2];
+        y[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        u[i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v[i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+      }
+      fputs("FRAME\n", stream);
+      fwrite(_planes.data(), 1, _planes.size(), stream);
+      break;
+    }
+    case ExportFormat::Raw:
+      fwrite(_rgb.data(), 1, _rgb.size(), stream);
+      break;
+    }
+  }
+
+  void _report_progress(uint64_t written) {
+    using namespace std::chrono;
+
+    auto now = steady_clock::now();
+    if (now - _last_report < seconds(1) && written != settings.frame_count)
+      return;
+    _last_report = now;
+
+    auto elapsed = duration<double>(now - _start).count();
+    std::cerr << "\rexported " << written << "/" << settings.frame_count
+              << " frames (" << written / elapsed << " frames/s)"
+              << std::flush;
+  }
+};
+
+int run_export(Bootstrap bootstrap, const Options &options) {
+  auto format = parse_export_format(options.export_format);
+  if (!format)
+    usage_error("unknown export format " + options.export_format);
+
+  ExportSettings settings;
+  settings.output = options.export_output.value();
+  settings.format = format.value();
+  settings.frame_count = options.export_frames;
+  settings.fps = options.export_fps;
+  settings.extent = {options.width, options.height};
+  settings.ring_size = options.ring_size;
+
+  if (settings.output == "-" && !settings.is_stream())
+    usage_error("only y4m and raw exports can be written to stdout");
+
+  Renderer renderer(bootstrap);
+  renderer.optimizer_recipe = options.optimizer_recipe;
+  if (options.print_startup_times)
+    startup_times().print();
+  if (!renderer.load_textures(options.textures))
+    return 1;
+
+  auto path = options.files[0].string();
+  auto source = utils::read_file(path.c_str());
+  auto result = renderer.set_fragment_shader(path.c_str(), source.c_str());
+  if (!result) {
+    std::cerr << result.unwrap_err().messages << std::endl;
+    return 1;
+  }
+  if (options.print_shader_statistics) {
+    auto &prepared = renderer.prepared_shaders.at(path);
+    print_shader_statistics(path, prepared.statistics);
+    print_shader_cost(prepared.cost);
+  }
+
+  FrameExporter exporter(renderer, settings);
+  exporter.run();
+
+  return 0;
+}
+
+// Renders a trace with the time steps, input, resolution and shaders it was
+// recorded with, one frame at a time. Every image is written next to a CSV of
+// how long the GPU took for it, so two runs compare frame for frame.
+struct TraceReplayer {
+  Renderer &renderer;
+  std::string output;
+  ExportFormat format;
+  OffscreenTarget target;
+  Buffer readback;
+  VkQueryPool query_pool = VK_NULL_HANDLE;
+  bool is_bgra;
+  std::vector<uint8_t> _rgb;
+
+  TraceReplayer(Renderer &renderer, std::string output, ExportFormat format)
+      : renderer(renderer), output(output), format(format) {
+    is_bgra = is_bgra_format(renderer.surface_format.format);
+    std::filesystem::create_directories(output);
+
+    VkQueryPoolCreateInfo query_info = {};
+    query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_info.queryCount = 2;
+    CHECK_VK_ERRC(
+        renderer.dispatch.createQueryPool(&query_info, nullptr, &query_pool));
+  }
+
+  ~TraceReplayer() {
+    CHECK_VK_ERRC(renderer.dispatch.deviceWaitIdle());
+    renderer.dispatch.destroyQueryPool(query_pool, nullptr);
+    _destroy_target();
+  }
+
+  void _destroy_target() {
+    if (target.framebuffer == VK_NULL_HANDLE)
+      return;
+    destroy_buffer(renderer.dispatch, readback);
+    destroy_offscreen_target(renderer.dispatch, target);
+  }
+
+  // Nothing is in flight between frames, the old target can go right away.
+  void _resize(VkExtent2D extent) {
+    _destroy_target();
+    auto &props = renderer.physical_device.memory_properties;
+    target = create_offscreen_target(renderer.dispatch, props,
+                                     renderer.surface_format.format, extent);
+    readback = create_buffer(renderer.dispatch, props,
+                             (VkDeviceSize)extent.width * extent.height * 4,
+                             VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                             VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  }
+
+  // Stops at the first shader that does not compile.
+  bool run(const std::vector<TraceFrame> &frames) {
+    auto timings_path = std::filesystem::path(output) / "timings.csv";
+    std::unique_ptr<FILE, int (*)(FILE *)> timings{
+        fopen(timings_path.string().c_str(), "w"), fclose};
+    EXPECT(timings != nullptr);
+    fprintf(timings.get(), "frame,gpu_ms\n");
+
+    auto extension = format == ExportFormat::Ppm ? "ppm" : "png";
+    double time = 0.;
+    for (size_t i = 0; i < frames.size(); i++) {
+      auto &frame = frames[i];
+      if (frame.shader && !show_trace_shader(renderer, frame.shader.value()))
+        return false;
+      auto extent = target.color.extent;
+      if (target.framebuffer == VK_NULL_HANDLE ||
+          extent.width != frame.extent.width ||
+          extent.height != frame.extent.height)
+        _resize(frame.extent);
+
+      time += frame.dt;
+      ShaderInputs inputs = {};
+      inputs.resolution[0] = (float)frame.extent.width;
+      inputs.resolution[1] = (float)frame.extent.height;
+      inputs.time = (float)time;
+      inputs.delta_time = (float)frame.dt;
+      inputs.frame = (uint32_t)i;
+
+      auto ms = _render_frame(frame, inputs);
+      renderer.deferred.run_completed(*renderer.render_data.timeline);
+      fprintf(timings.get(), "%zu,%.6f\n", i, ms);
+
+      auto pixel_count = (size_t)frame.extent.width * frame.extent.height;
+      pack_rgb((const uint8_t *)readback.mapped, pixel_count, is_bgra, _rgb);
+      write_rgb_image(frame_path(output, i, extension), format, _rgb,
+                      frame.extent.width, frame.extent.height);
+      fprintf(stderr, "\rreplayed %zu/%zu frames", i + 1, frames.size());
+    }
+    fprintf(stderr, "\n");
+    return true;
+  }
+
+  // Waits for the frame and returns its GPU time in milliseconds.
+  double _render_frame(const TraceFrame &frame, const ShaderInputs &inputs) {
+    TRACE_SCOPE("TraceReplayer::render_frame");
+    auto &dispatch = renderer.dispatch;
+    write_offscreen_inputs(renderer.input_latch, frame.inputs);
+
+    auto pipeline = renderer.window_pipeline(renderer.primary_window());
+    renderer.submit_and_wait([&](VkCommandBuffer command_buffer) {
+      dispatch.cmdResetQueryPool(command_buffer, query_pool, 0, 2);
+      dispatch.cmdWriteTimestamp(command_buffer,
+                                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 query_pool, 0);
+      renderer.record_shader_pass(command_buffer, pipeline,
+                                  target.render_pass, target.framebuffer,
+                                  frame.extent, inputs);
+      dispatch.cmdWriteTimestamp(command_buffer,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                 query_pool, 1);
+      record_readback(dispatch, command_buffer, target, readback.buffer, 0,
+                      {{0, 0}, frame.extent});
+    });
+
+    uint64_t timestamps[2];
+    CHECK_VK_ERRC(dispatch.getQueryPoolResults(
+        query_pool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    return renderer.timestamp_ms(timestamps[0], timestamps[1]);
+  }
+};
+
+int run_replay_export(Bootstrap bootstrap, const Options &options) {
+  auto format = parse_export_format(options.export_format);
+  if (!format)
+    usage_error("unknown export format " + options.export_format);
+  if (format != ExportFormat::Ppm && format != ExportFormat::Png)
+    usage_error("replays are exported as ppm or png images");
+  if (options.export_output.value() == "-")
+    usage_error("replays are exported to a directory");
+
+  std::string error;
+  auto frames = read_trace(options.replay_trace.value(), error);
+  if (!frames) {
+    std::cerr << "retort: " << error << std::endl;
+    return 1;
+  }
+
+  Renderer renderer(bootstrap);
+  renderer.optimizer_recipe = options.optimizer_recipe;
+  if (options.print_startup_times)
+    startup_times().print();
+  if (renderer.timestamp_period_ns <= 0.) {
+    std::cerr << "the graphics queue cannot write timestamps" << std::endl;
+    return 1;
+  }
+  if (!renderer.load_textures(options.textures))
+    return 1;
+
+  TraceReplayer replayer(renderer, options.export_output.value(),
+                         format.value());
+  return replayer.run(frames.value()) ? 0 : 1;
+}
+
+} // namespace retort
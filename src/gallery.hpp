@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <future>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include <imgui.h>
+#include <imgui_impl_vulkan.h>
+
+#include "memory.hpp"
+#include "renderer.hpp"
+#include "threading.hpp"
+#include "tracing.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// What every thumbnail is drawn at, whatever the window shows it at.
+const VkExtent2D GALLERY_THUMBNAIL_EXTENT = {256, 144};
+// Thumbnails that can be on screen at once, one atlas layer each.
+const uint32_t GALLERY_CELL_COUNT = IMGUI_TEXTURE_LIMIT;
+// Assumed for a thumbnail until a draw of it has been timed.
+const double GALLERY_UNMEASURED_MS = 1.;
+
+const char *GALLERY_EXTENSIONS[] = {".frag", ".glsl"};
+
+// One image holding a cell per layer. Every thumbnail gets a layer of its own
+// rather than a region of a shared one, since the viewport does not move
+// `gl_FragCoord` and it has to start at the thumbnail's corner. The render
+// pass is compatible with the swapchain one, so the shaders' own pipelines
+// draw into it.
+struct GalleryAtlas {
+  VkImage image = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+  std::vector<VkImageView> views;
+  std::vector<VkFramebuffer> framebuffers;
+  // What ImGui draws each layer with
+  std::vector<VkDescriptorSet> textures;
+};
+
+GalleryAtlas
+create_gallery_atlas(vkb::DispatchTable &dispatch,
+                     const VkPhysicalDeviceMemoryProperties &props,
+                     VkFormat format) {
+  GalleryAtlas atlas;
+  auto extent = GALLERY_THUMBNAIL_EXTENT;
+
+  VkImageCreateInfo image_info = {};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.format = format;
+  image_info.extent = {extent.width, extent.height, 1};
+  image_info.mipLevels = 1;
+  image_info.arrayLayers = GALLERY_CELL_COUNT;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  CHECK_VK_ERRC(dispatch.createImage(&image_info, nullptr, &atlas.image));
+
+  VkMemoryRequirements requirements;
+  dispatch.getImageMemoryRequirements(atlas.image, &requirements);
+  atlas.memory = allocate_memory(dispatch, props, requirements,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  CHECK_VK_ERRC(dispatch.bindImageMemory(atlas.image, atlas.memory, 0));
+
+  // Every draw covers its whole layer, what was there before never matters
+  VkAttachmentDescription color_attachment = {};
+  color_attachment.format = format;
+  color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  color_attachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkAttachmentReference color_attachment_ref = {};
+  color_attachment_ref.attachment = 0;
+  color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color_attachment_ref;
+
+  // ImGui samples the layer in an earlier frame and again later in this one
+  VkSubpassDependency dependencies[2] = {};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  VkRenderPassCreateInfo render_pass_info = {};
+  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  render_pass_info.attachmentCount = 1;
+  render_pass_info.pAttachments = &color_attachment;
+  render_pass_info.subpassCount = 1;
+  render_pass_info.pSubpasses = &subpass;
+  render_pass_info.dependencyCount = 2;
+  render_pass_info.pDependencies = dependencies;
+  CHECK_VK_ERRC(dispatch.createRenderPass(&render_pass_info, nullptr,
+                                          &atlas.render_pass));
+
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = VK_FILTER_LINEAR;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  CHECK_VK_ERRC(dispatch.createSampler(&sampler_info, nullptr, &atlas.sampler));
+
+  for (uint32_t layer = 0; layer < GALLERY_CELL_COUNT; layer++) {
+    VkImageViewCreateInfo view_info = {};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = atlas.image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.baseArrayLayer = layer;
+    view_info.subresourceRange.layerCount = 1;
+    VkImageView view;
+    CHECK_VK_ERRC(dispatch.createImageView(&view_info, nullptr, &view));
+    atlas.views.push_back(view);
+
+    VkFramebufferCreateInfo framebuffer_info = {};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.renderPass = atlas.render_pass;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.pAttachments = &view;
+    framebuffer_info.width = extent.width;
+    framebuffer_info.height = extent.height;
+    framebuffer_info.layers = 1;
+    VkFramebuffer framebuffer;
+    CHECK_VK_ERRC(
+        dispatch.createFramebuffer(&framebuffer_info, nullptr, &framebuffer));
+    atlas.framebuffers.push_back(framebuffer);
+
+    atlas.textures.push_back(ImGui_ImplVulkan_AddTexture(
+        atlas.sampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+  }
+
+  return atlas;
+}
+
+void destroy_gallery_atlas(vkb::DispatchTable &dispatch, GalleryAtlas &atlas) {
+  for (auto texture : atlas.textures)
+    ImGui_ImplVulkan_RemoveTexture(texture);
+  for (auto framebuffer : atlas.framebuffers)
+    dispatch.destroyFramebuffer(framebuffer, nullptr);
+  for (auto view : atlas.views)
+    dispatch.destroyImageView(view, nullptr);
+  dispatch.destroySampler(atlas.sampler, nullptr);
+  dispatch.destroyRenderPass(atlas.render_pass, nullptr);
+  dispatch.destroyImage(atlas.image, nullptr);
+  dispatch.freeMemory(atlas.memory, nullptr);
+  atlas = {};
+}
+
+// Shader files directly in `directory`, by name.
+std::vector<std::filesystem::path>
+gallery_files(const std::filesystem::path &directory) {
+  std::vector<std::filesystem::path> files;
+  std::error_code error;
+  for (auto &file : std::filesystem::directory_iterator(directory, error)) {
+    auto extension = file.path().extension();
+    if (file.is_regular_file() &&
+        std::find(std::begin(GALLERY_EXTENSIONS), std::end(GALLERY_EXTENSIONS),
+                  extension) != std::end(GALLERY_EXTENSIONS))
+      files.push_back(file.path());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+using GalleryLoad = Result<PreparedShader, CompilationError>;
+
+// A shader file of the gallery. Compiled the first time it scrolls into
+// view and then stored in the renderer under its path, like any other shader,
+// so showing it in a window only swaps the pipeline.
+struct GalleryEntry {
+  std::filesystem::path path;
+  std::optional<std::future<GalleryLoad>> loading;
+  bool is_loaded = false;
+  std::optional<std::string> error;
+  bool is_visible = false;
+  // The atlas layer it draws into while it is on screen
+  std::optional<uint32_t> cell;
+  // What the cell holds a picture of, none until the first draw
+  VkPipeline drawn_pipeline = VK_NULL_HANDLE;
+  uint64_t drawn_frame = 0;
+  std::optional<double> gpu_time_ms;
+};
+
+// Live thumbnails of every shader in a directory, drawn into the atlas from
+// the frame's own command buffer. Only thumbnails on screen have a cell, and
+// only those that are out of date are drawn: ones that do not read time or
+// input once per pipeline, the rest least recently drawn first, as many as
+// fit the GPU time budget.
+struct Gallery {
+  Renderer &renderer;
+  ThreadPool &pool;
+  std::vector<GalleryEntry> entries;
+  double budget_ms;
+  GalleryAtlas atlas;
+  std::vector<uint32_t> free_cells;
+
+  // Per worker, like when prewarming
+  std::vector<Compiler> compilers;
+  std::vector<VkPipelineCache> caches;
+  size_t loads_in_flight = 0;
+
+  // Zero when the graphics queue cannot write timestamps
+  VkQueryPool timestamp_pool = VK_NULL_HANDLE;
+  // The entries each frame slot timed and the timeline value it signals
+  std::vector<std::vector<size_t>> slot_entries;
+  std::vector<uint64_t> slot_values;
+
+  uint64_t frame = 1;
+  // Of the last recorded frame
+  bool has_stale_thumbnails = false;
+  size_t stale_count = 0;
+  size_t drawn_count = 0;
+  double drawn_estimate_ms = 0.;
+
+  Gallery(Renderer &renderer, ThreadPool &pool,
+          std::vector<std::filesystem::path> files, double budget_ms)
+      : renderer(renderer), pool(pool), budget_ms(budget_ms),
+        atlas(create_gallery_atlas(renderer.dispatch,
+                                   renderer.physical_device.memory_properties,
+                                   renderer.surface_format.format)),
+        compilers(pool.size()), caches(pool.size(), VK_NULL_HANDLE),
+        slot_entries(MAXIMUM_FRAMES_IN_FLIGHT),
+        slot_values(MAXIMUM_FRAMES_IN_FLIGHT, 0) {
+    for (auto &file : files)
+      entries.push_back({file});
+    for (uint32_t cell = GALLERY_CELL_COUNT; cell > 0; cell--)
+      free_cells.push_back(cell - 1);
+
+    VkPipelineCacheCreateInfo cache_info = {};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    for (auto &cache : caches)
+      CHECK_VK_ERRC(
+          renderer.dispatch.createPipelineCache(&cache_info, nullptr, &cache));
+
+    if (renderer.timestamp_period_ns > 0.) {
+      VkQueryPoolCreateInfo query_info = {};
+      query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+      query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+      query_info.queryCount =
+          (uint32_t)MAXIMUM_FRAMES_IN_FLIGHT * GALLERY_CELL_COUNT * 2;
+      CHECK_VK_ERRC(renderer.dispatch.createQueryPool(&query_info, nullptr,
+                                                      &timestamp_pool));
+    }
+
+    renderer.record_offscreen_passes = [this](VkCommandBuffer command_buffer) {
+      record(command_buffer);
+    };
+  }
+
+  ~Gallery() {
+    renderer.record_offscreen_passes = nullptr;
+    for (auto &entry : entries) {
+      if (!entry.loading)
+        continue;
+      auto result = entry.loading->get();
+      if (result)
+        renderer.destroy_prepared_shader(result.unwrap());
+    }
+
+    auto &dispatch = renderer.dispatch;
+    CHECK_VK_ERRC(dispatch.deviceWaitIdle());
+    CHECK_VK_ERRC(dispatch.mergePipelineCaches(
+        renderer.render_data.pipeline_cache, (uint32_t)caches.size(),
+        caches.data()));
+    for (auto cache : caches)
+      dispatch.destroyPipelineCache(cache, nullptr);
+    if (timestamp_pool != VK_NULL_HANDLE)
+      dispatch.destroyQueryPool(timestamp_pool, nullptr);
+    destroy_gallery_atlas(dispatch, atlas);
+  }
+
+  // Hands finished loads to the renderer and reads the timings of frames the
+  // GPU is done with. Runs between frames.
+  void update() {
+    TRACE_SCOPE("Gallery::update");
+    for (auto &entry : entries) {
+      if (!entry.loading || entry.loading->wait_for(std::chrono::seconds(0)) !=
+                                std::future_status::ready)
+        continue;
+      auto result = entry.loading->get();
+      entry.loading.reset();
+      loads_in_flight--;
+      if (result) {
+        renderer.add_prepared_shader(entry.path.string(), result.unwrap());
+        entry.is_loaded = true;
+      } else {
+        entry.error = result.unwrap_err().messages;
+      }
+    }
+    _read_timestamps();
+
+    if (loads_in_flight > 0 || has_stale_thumbnails)
+      renderer.request_redraw();
+  }
+
+  // Marks the entry as on screen this frame, loading it if it was not yet.
+  // What its cell shows, once it has been drawn into.
+  std::optional<ImTextureID> show(size_t index) {
+    auto &entry = entries[index];
+    entry.is_visible = true;
+    if (!entry.is_loaded && !entry.loading && !entry.error)
+      _start_loading(entry);
+    if (entry.is_loaded && !entry.cell && !free_cells.empty()) {
+      entry.cell = free_cells.back();
+      free_cells.pop_back();
+    }
+    if (!entry.cell || entry.drawn_pipeline == VK_NULL_HANDLE)
+      return std::nullopt;
+    return (ImTextureID)atlas.textures[entry.cell.value()];
+  }
+
+  // At most one load per worker, so that scrolling past hundreds of files
+  // only compiles what stays on screen for a moment.
+  void _start_loading(GalleryEntry &entry) {
+    auto name = entry.path.string();
+    if (renderer.has_prepared_shader(name)) {
+      entry.is_loaded = true;
+      return;
+    }
+    if (loads_in_flight >= pool.size())
+      return;
+
+    loads_in_flight++;
+    // The GUI may change the renderer's recipe while this runs
+    auto recipe = renderer.optimizer_recipe;
+    entry.loading = pool.submit([this, path = entry.path, recipe]() {
+      TRACE_SCOPE("Gallery::load");
+      auto worker = ThreadPool::worker_index();
+      auto source = utils::read_file(path.string().c_str());
+      auto hash = shader_origin_hash(source, {}, recipe);
+      return renderer.compile_shader_variant({path.string(), path, {}}, source,
+                                             recipe, hash, compilers[worker],
+                                             caches[worker]);
+    });
+  }
+
+  uint32_t _first_query(size_t slot) const {
+    return (uint32_t)slot * GALLERY_CELL_COUNT * 2;
+  }
+
+  void _read_timestamps() {
+    auto &timeline = *renderer.render_data.timeline;
+    for (size_t slot = 0; slot < slot_entries.size(); slot++) {
+      auto &timed = slot_entries[slot];
+      if (timed.empty() || !timeline.is_complete(slot_values[slot]))
+        continue;
+
+      std::vector<uint64_t> timestamps(timed.size() * 2);
+      auto result = renderer.dispatch.getQueryPoolResults(
+          timestamp_pool, _first_query(slot), (uint32_t)timestamps.size(),
+          timestamps.size() * sizeof(uint64_t), timestamps.data(),
+          sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+      if (result == VK_SUCCESS) {
+        for (size_t i = 0; i < timed.size(); i++) {
+          double ms =
+              renderer.timestamp_ms(timestamps[i * 2], timestamps[i * 2 + 1]);
+          auto &gpu_time_ms = entries[timed[i]].gpu_time_ms;
+          gpu_time_ms = gpu_time_ms
+                            ? std::lerp(gpu_time_ms.value(), ms,
+                                        GPU_TIME_SMOOTHING)
+                            : ms;
+        }
+      }
+      timed.clear();
+    }
+  }
+
+  // Visible thumbnails whose cell does not show their current pipeline, or
+  // that change by the frame, least recently drawn first.
+  std::vector<size_t> _stale_thumbnails() {
+    std::vector<size_t> stale;
+    for (size_t i = 0; i < entries.size(); i++) {
+      auto &entry = entries[i];
+      if (!entry.is_visible || !entry.cell)
+        continue;
+      auto &prepared = renderer.prepared_shaders.at(entry.path.string());
+      if (entry.drawn_pipeline == prepared.graphics_pipeline &&
+          !prepared.is_time_varying)
+        continue;
+      stale.push_back(i);
+    }
+    std::stable_sort(stale.begin(), stale.end(), [&](size_t a, size_t b) {
+      return entries[a].drawn_frame < entries[b].drawn_frame;
+    });
+    return stale;
+  }
+
+  // Runs inside the renderer's frame recording. The cells of thumbnails that
+  // went off screen are handed to whatever scrolls in next.
+  void record(VkCommandBuffer command_buffer) {
+    TRACE_SCOPE("Gallery::record");
+    for (auto &entry : entries) {
+      if (entry.is_visible || !entry.cell)
+        continue;
+      free_cells.push_back(entry.cell.value());
+      entry.cell.reset();
+      entry.drawn_pipeline = VK_NULL_HANDLE;
+    }
+
+    auto stale = _stale_thumbnails();
+    std::vector<size_t> drawn;
+    double estimate_ms = 0.;
+    for (auto index : stale) {
+      auto cost_ms = entries[index].gpu_time_ms.value_or(GALLERY_UNMEASURED_MS);
+      if (!drawn.empty() && estimate_ms + cost_ms > budget_ms)
+        break;
+      drawn.push_back(index);
+      estimate_ms += cost_ms;
+    }
+
+    auto &dispatch = renderer.dispatch;
+    auto slot = renderer.render_data.current_frame;
+    auto first_query = _first_query(slot);
+    if (timestamp_pool != VK_NULL_HANDLE && !drawn.empty())
+      dispatch.cmdResetQueryPool(command_buffer, timestamp_pool, first_query,
+                                 (uint32_t)drawn.size() * 2);
+
+    auto inputs = renderer.shader_inputs(GALLERY_THUMBNAIL_EXTENT);
+    for (size_t i = 0; i < drawn.size(); i++) {
+      auto &entry = entries[drawn[i]];
+      auto pipeline =
+          renderer.prepared_shaders.at(entry.path.string()).graphics_pipeline;
+      auto query = first_query + (uint32_t)i * 2;
+      if (timestamp_pool != VK_NULL_HANDLE)
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                   timestamp_pool, query);
+      renderer.record_shader_pass(command_buffer, pipeline, atlas.render_pass,
+                                  atlas.framebuffers[entry.cell.value()],
+                                  GALLERY_THUMBNAIL_EXTENT, inputs);
+      if (timestamp_pool != VK_NULL_HANDLE)
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                   timestamp_pool, query + 1);
+      entry.drawn_pipeline = pipeline;
+      entry.drawn_frame = frame;
+    }
+
+    // Submitted right after recording, with the next timeline value
+    if (timestamp_pool != VK_NULL_HANDLE) {
+      slot_entries[slot] = drawn;
+      slot_values[slot] = renderer.render_data.timeline->submitted + 1;
+    }
+
+    // Drawn ones that change by the frame are out of date again right away
+    has_stale_thumbnails =
+        stale.size() > drawn.size() ||
+        std::any_of(drawn.begin(), drawn.end(), [&](size_t index) {
+          auto name = entries[index].path.string();
+          return renderer.prepared_shaders.at(name).is_time_varying;
+        });
+    stale_count = stale.size();
+    drawn_count = drawn.size();
+    drawn_estimate_ms = estimate_ms;
+    for (auto &entry : entries)
+      entry.is_visible = false;
+    frame++;
+  }
+};
+
+} // namespace retort
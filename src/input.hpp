@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+
+#include <GLFW/glfw3.h>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "memory.hpp"
+#include "shaders/inputs.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// How much a new measurement moves the average of how much fresher latched
+// input is than polled input.
+const double LATCH_GAIN_SMOOTHING = 0.05;
+
+// What shaders read as `retort_input`, written right before the frame is
+// submitted instead of when it started. Every window has a slot per frame in
+// flight, picked with a dynamic offset. The first slot is what offscreen
+// rendering sees, no input at all unless a trace is replayed.
+struct InputLatch {
+  Buffer buffer;
+  VkDeviceSize stride = 0;
+  size_t frame_count = 0;
+  size_t window_capacity = 0;
+};
+
+InputLatch create_input_latch(vkb::DispatchTable &dispatch,
+                              const VkPhysicalDeviceMemoryProperties &props,
+                              VkDeviceSize alignment, size_t frame_count,
+                              size_t window_capacity) {
+  InputLatch latch;
+  latch.stride =
+      (sizeof(LatchedInputs) + alignment - 1) / alignment * alignment;
+  latch.frame_count = frame_count;
+  latch.window_capacity = window_capacity;
+  auto slots = 1 + frame_count * window_capacity;
+  latch.buffer = create_buffer(dispatch, props, latch.stride * slots,
+                               VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  memset(latch.buffer.mapped, 0, latch.buffer.size);
+  return latch;
+}
+
+void destroy_input_latch(vkb::DispatchTable &dispatch, InputLatch &latch) {
+  destroy_buffer(dispatch, latch.buffer);
+  latch = {};
+}
+
+uint32_t input_latch_offset(const InputLatch &latch, size_t slot,
+                            size_t window) {
+  return (uint32_t)((1 + slot * latch.window_capacity + window) *
+                    latch.stride);
+}
+
+void write_input_latch(InputLatch &latch, size_t slot, size_t window,
+                       const LatchedInputs &inputs) {
+  auto mapped = (uint8_t *)latch.buffer.mapped;
+  memcpy(mapped + input_latch_offset(latch, slot, window), &inputs,
+         sizeof(inputs));
+}
+
+void write_offscreen_inputs(InputLatch &latch, const LatchedInputs &inputs) {
+  memcpy(latch.buffer.mapped, &inputs, sizeof(inputs));
+}
+
+// In framebuffer pixels from the top left, like `gl_FragCoord`.
+void cursor_in_pixels(GLFWwindow *window, VkExtent2D extent, float *cursor) {
+  double x, y;
+  int width, height;
+  glfwGetCursorPos(window, &x, &y);
+  glfwGetWindowSize(window, &width, &height);
+  cursor[0] = (float)(x * extent.width / std::max(width, 1));
+  cursor[1] = (float)(y * extent.height / std::max(height, 1));
+}
+
+// Buttons and keys are as of the last poll, GLFW only updates them then. The
+// cursor position is asked for again, which on most platforms reaches the
+// OS and is as fresh as it gets.
+void latch_window_inputs(GLFWwindow *window, VkExtent2D extent,
+                         LatchedInputs &inputs) {
+  cursor_in_pixels(window, extent, inputs.mouse);
+
+  uint32_t buttons = 0;
+  for (int button = 0; button <= GLFW_MOUSE_BUTTON_LAST; button++)
+    if (glfwGetMouseButton(window, button) == GLFW_PRESS)
+      buttons |= 1u << button;
+
+  bool was_down = inputs.buttons & 1u;
+  bool is_down = buttons & 1u;
+  if (is_down && !was_down) {
+    inputs.mouse[2] = inputs.mouse[0];
+    inputs.mouse[3] = inputs.mouse[1];
+  } else if (!is_down && inputs.mouse[2] > 0.f) {
+    inputs.mouse[2] = -inputs.mouse[2];
+    inputs.mouse[3] = -inputs.mouse[3];
+  }
+  inputs.buttons = buttons;
+
+  memset(inputs.keys, 0, sizeof(inputs.keys));
+  for (int key = GLFW_KEY_SPACE; key <= GLFW_KEY_LAST; key++)
+    if (glfwGetKey(window, key) == GLFW_PRESS)
+      inputs.keys[key / 32] |= 1u << (key % 32);
+}
+
+} // namespace retort
@@ -2,21 +2,96 @@
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3.h>
 
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
 #include "app.hpp"
+#include "autotune.hpp"
+#include "compare.hpp"
+#include "export.hpp"
+#include "options.hpp"
+#include "tiled.hpp"
 
 #include "watching.hpp"
 
 using namespace retort;
 using namespace retort::utils;
 
-int main(void) {
-  auto bootstrapped = bootstrap();
+int main(int argc, char **argv) {
+  auto options = parse_options(argc, argv);
+  auto bootstrapped = bootstrap(options.is_headless());
+
+  if (options.export_output && options.replay_trace)
+    return run_replay_export(bootstrapped, options);
+  if (options.export_output && options.tiled)
+    return run_tiled_export(bootstrapped, options);
+  if (options.export_output)
+    return run_export(bootstrapped, options);
+  if (options.compare)
+    return run_comparison(bootstrapped, options);
+  if (options.autotune)
+    return run_autotune(bootstrapped, options);
+
   App app(bootstrapped);
+  app.renderer.optimizer_recipe = options.optimizer_recipe;
+  app.is_on_demand = options.on_demand;
+  if (options.accumulation.is_enabled)
+    app.renderer.set_accumulation(options.accumulation);
+  if (options.print_startup_times)
+    startup_times().print();
+  if (!options.files.empty())
+    app.add_files(options.files);
+  if (options.one_window_per_file)
+    for (size_t i = 1; i < options.files.size(); i++)
+      app.open_window(options.files[i]);
+  if (options.print_shader_statistics)
+    app.print_shader_statistics();
+  if (options.shm_name)
+    app.start_publishing(options.shm_name.value(),
+                         {options.width, options.height}, options.shm_slots);
+  if (options.audio_file && !app.start_audio(options.audio_file.value()))
+    return 1;
+  for (auto &texture : options.textures)
+    if (!app.add_texture(texture))
+      return 1;
+  if (options.vertex_file &&
+      !app.start_vertex_stream(options.vertex_file.value(),
+                               options.vertex_shader.value(),
+                               options.vertex_topology))
+    return 1;
+  if (options.gallery_directory &&
+      !app.open_gallery(options.gallery_directory.value(),
+                        options.gallery_budget_ms))
+    return 1;
+  if (options.record_trace &&
+      !app.start_recording(options.record_trace.value()))
+    return 1;
+  if (options.replay_trace && !app.start_replay(options.replay_trace.value()))
+    return 1;
+
+  std::optional<ReloadBenchmark> reload_benchmark;
+  if (options.reload_benchmark_count)
+    reload_benchmark.emplace(options.files[0],
+                             options.reload_benchmark_count.value());
 
   while (!app.should_close()) {
     app.poll_events();
-    app.draw_frame();
+    if (app.should_draw())
+      app.draw_frame();
+
+    if (reload_benchmark) {
+      reload_benchmark->update(app.renderer.reloads);
+      if (reload_benchmark->is_done()) {
+        print_reload_latencies(reload_benchmark->timings);
+        break;
+      }
+    }
   }
 
+  if (app.replay)
+    std::cerr << "replayed " << app.replay->next_frame << " frames"
+              << std::endl;
   return 0;
 }
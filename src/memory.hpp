@@ -0,0 +1,202 @@
+#pragma once
+
+#include <optional>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "utils.hpp"
+
+namespace retort {
+
+struct Buffer {
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  // Persistently mapped for host-visible allocations, `nullptr` otherwise.
+  void *mapped = nullptr;
+};
+
+struct Image {
+  VkImage image = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkImageView view = VK_NULL_HANDLE;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {};
+};
+
+auto find_memory_type(const VkPhysicalDeviceMemoryProperties &properties,
+                      uint32_t type_bits, VkMemoryPropertyFlags flags)
+    -> std::optional<uint32_t> {
+  for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+    bool is_allowed = type_bits & (1u << i);
+    bool has_flags =
+        (properties.memoryTypes[i].propertyFlags & flags) == flags;
+    if (is_allowed && has_flags)
+      return i;
+  }
+  return std::nullopt;
+}
+
+// Picks a memory type with all of `required` and as many of `preferred` as
+// possible, falling back to `required` alone.
+VkDeviceMemory allocate_memory(vkb::DispatchTable &dispatch,
+                               const VkPhysicalDeviceMemoryProperties &props,
+                               VkMemoryRequirements requirements,
+                               VkMemoryPropertyFlags required,
+                               VkMemoryPropertyFlags preferred = 0) {
+  auto memory_type = find_memory_type(props, requirements.memoryTypeBits,
+                                      required | preferred);
+  if (!memory_type)
+    memory_type =
+        find_memory_type(props, requirements.memoryTypeBits, required);
+  if (!memory_type)
+    PANIC("NO SUITABLE MEMORY TYPE");
+
+  VkMemoryAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = requirements.size;
+  alloc_info.memoryTypeIndex = memory_type.value();
+
+  VkDeviceMemory memory;
+  CHECK_VK_ERRC(dispatch.allocateMemory(&alloc_info, nullptr, &memory));
+  return memory;
+}
+
+Buffer create_buffer(vkb::DispatchTable &dispatch,
+                     const VkPhysicalDeviceMemoryProperties &props,
+                     VkDeviceSize size, VkBufferUsageFlags usage,
+                     VkMemoryPropertyFlags required,
+                     VkMemoryPropertyFlags preferred = 0) {
+  Buffer buffer;
+  buffer.size = size;
+
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.usage = usage;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  CHECK_VK_ERRC(dispatch.createBuffer(&buffer_info, nullptr, &buffer.buffer));
+
+  VkMemoryRequirements requirements;
+  dispatch.getBufferMemoryRequirements(buffer.buffer, &requirements);
+  buffer.memory =
+      allocate_memory(dispatch, props, requirements, required, preferred);
+  CHECK_VK_ERRC(dispatch.bindBufferMemory(buffer.buffer, buffer.memory, 0));
+
+  if (required & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    CHECK_VK_ERRC(
+        dispatch.mapMemory(buffer.memory, 0, VK_WHOLE_SIZE, 0, &buffer.mapped));
+
+  return buffer;
+}
+
+void destroy_buffer(vkb::DispatchTable &dispatch, Buffer &buffer) {
+  if (buffer.mapped)
+    dispatch.unmapMemory(buffer.memory);
+  dispatch.destroyBuffer(buffer.buffer, nullptr);
+  dispatch.freeMemory(buffer.memory, nullptr);
+  buffer = {};
+}
+
+Image create_image(vkb::DispatchTable &dispatch,
+                   const VkPhysicalDeviceMemoryProperties &props,
+                   VkFormat format, VkExtent2D extent,
+                   VkImageUsageFlags usage) {
+  Image image;
+  image.format = format;
+  image.extent = extent;
+
+  VkImageCreateInfo image_info = {};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.format = format;
+  image_info.extent = {extent.width, extent.height, 1};
+  image_info.mipLevels = 1;
+  image_info.arrayLayers = 1;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.usage = usage;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  CHECK_VK_ERRC(dispatch.createImage(&image_info, nullptr, &image.image));
+
+  VkMemoryRequirements requirements;
+  dispatch.getImageMemoryRequirements(image.image, &requirements);
+  image.memory = allocate_memory(dispatch, props, requirements,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  CHECK_VK_ERRC(dispatch.bindImageMemory(image.image, image.memory, 0));
+
+  VkImageViewCreateInfo view_info = {};
+  view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  view_info.image = image.image;
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  view_info.format = format;
+  view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  view_info.subresourceRange.levelCount = 1;
+  view_info.subresourceRange.layerCount = 1;
+  CHECK_VK_ERRC(dispatch.createImageView(&view_info, nullptr, &image.view));
+
+  return image;
+}
+
+void destroy_image(vkb::DispatchTable &dispatch, Image &image) {
+  dispatch.destroyImageView(image.view, nullptr);
+  dispatch.destroyImage(image.image, nullptr);
+  dispatch.freeMemory(image.memory, nullptr);
+  image = {};
+}
+
+// Moves the whole of a single mip, single layer color image to `new_layout`.
+void record_image_barrier(vkb::DispatchTable &dispatch, VkCommandBuffer cmd,
+                          VkImage image, VkImageLayout old_layout,
+                          VkImageLayout new_layout,
+                          VkPipelineStageFlags src_stage,
+                          VkAccessFlags src_access,
+                          VkPipelineStageFlags dst_stage,
+                          VkAccessFlags dst_access) {
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.layerCount = 1;
+  dispatch.cmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, nullptr, 0,
+                              nullptr, 1, &barrier);
+}
+
+// Replaces the contents of a sampled image with the tightly packed pixels in
+// `buffer`, leaving it ready for fragment shaders to read.
+void record_image_upload(vkb::DispatchTable &dispatch, VkCommandBuffer cmd,
+                         const Image &image, VkBuffer buffer,
+                         VkImageLayout old_layout) {
+  record_image_barrier(dispatch, cmd, image.image, old_layout,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_ACCESS_SHADER_READ_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT);
+
+  VkBufferImageCopy copy = {};
+  copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copy.imageSubresource.layerCount = 1;
+  copy.imageExtent = {image.extent.width, image.extent.height, 1};
+  dispatch.cmdCopyBufferToImage(cmd, buffer, image.image,
+                                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+  record_image_barrier(dispatch, cmd, image.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_ACCESS_TRANSFER_WRITE_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_ACCESS_SHADER_READ_BIT);
+}
+
+} // namespace retort
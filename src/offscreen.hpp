@@ -0,0 +1,125 @@
+#pragma once
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "memory.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// A color target that is not presented. Its render pass only differs from the
+// swapchain one in the final layout, so both are compatible and the same
+// pipelines draw into either.
+struct OffscreenTarget {
+  Image color;
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+};
+
+OffscreenTarget
+create_offscreen_target(vkb::DispatchTable &dispatch,
+                        const VkPhysicalDeviceMemoryProperties &props,
+                        VkFormat format, VkExtent2D extent) {
+  OffscreenTarget target;
+  target.color = create_image(dispatch, props, format, extent,
+                              VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                  VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+
+  VkAttachmentDescription color_attachment = {};
+  color_attachment.format = format;
+  color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  color_attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  VkAttachmentReference color_attachment_ref = {};
+  color_attachment_ref.attachment = 0;
+  color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = 1;
+  subpass.pColorAttachments = &color_attachment_ref;
+
+  VkSubpassDependency dependencies[2] = {};
+  dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+  dependencies[1].srcSubpass = 0;
+  dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  VkRenderPassCreateInfo render_pass_info = {};
+  render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  render_pass_info.attachmentCount = 1;
+  render_pass_info.pAttachments = &color_attachment;
+  render_pass_info.subpassCount = 1;
+  render_pass_info.pSubpasses = &subpass;
+  render_pass_info.dependencyCount = 2;
+  render_pass_info.pDependencies = dependencies;
+  CHECK_VK_ERRC(dispatch.createRenderPass(&render_pass_info, nullptr,
+                                          &target.render_pass));
+
+  VkFramebufferCreateInfo framebuffer_info = {};
+  framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebuffer_info.renderPass = target.render_pass;
+  framebuffer_info.attachmentCount = 1;
+  framebuffer_info.pAttachments = &target.color.view;
+  framebuffer_info.width = extent.width;
+  framebuffer_info.height = extent.height;
+  framebuffer_info.layers = 1;
+  CHECK_VK_ERRC(dispatch.createFramebuffer(&framebuffer_info, nullptr,
+                                           &target.framebuffer));
+
+  return target;
+}
+
+void destroy_offscreen_target(vkb::DispatchTable &dispatch,
+                              OffscreenTarget &target) {
+  dispatch.destroyFramebuffer(target.framebuffer, nullptr);
+  dispatch.destroyRenderPass(target.render_pass, nullptr);
+  destroy_image(dispatch, target.color);
+  target = {};
+}
+
+// Copies `region` of the target into `buffer` at `offset`, tightly packed,
+// and makes the result visible to the host once the submission completes.
+void record_readback(vkb::DispatchTable &dispatch, VkCommandBuffer cmd,
+                     const OffscreenTarget &target, VkBuffer buffer,
+                     VkDeviceSize offset, VkRect2D region) {
+  VkBufferImageCopy copy = {};
+  copy.bufferOffset = offset;
+  copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copy.imageSubresource.layerCount = 1;
+  copy.imageOffset = {region.offset.x, region.offset.y, 0};
+  copy.imageExtent = {region.extent.width, region.extent.height, 1};
+  dispatch.cmdCopyImageToBuffer(cmd, target.color.image,
+                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1,
+                                &copy);
+
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  dispatch.cmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                              VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                              &barrier, 0, nullptr);
+}
+
+} // namespace retort
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "accumulation.hpp"
+#include "shaders/optimizer.hpp"
+
+namespace retort {
+
+const char *USAGE = R"(usage: retort [options] [shader files...]
+
+export:
+  --export <path>    render offline into a directory of images, a file, or
+                     - for stdout
+  --format <format>  ppm, png, y4m or raw (default ppm)
+  --frames <count>   number of frames to render (default 600)
+  --fps <rate>       simulated frame rate (default 60)
+  --size <w>x<h>     output resolution (default 1920x1080)
+  --ring <count>     readback buffers in flight (default 4)
+  --tiled            render a single still at --size into a ppm file, in
+                     tiles of at most --tile-size, for sizes beyond what the
+                     device can render at once
+  --tile-size <n>    edge length of a tile, capped by the device
+                     (default 4096)
+
+window:
+  --windows          open a window for each shader file instead of one
+                     window for all of them
+  --on-demand        only redraw when the shader, the input or the window
+                     changes, or when the shader reads time
+
+shaders:
+  --optimize <recipe>
+                     run the SPIR-V optimizer after compiling: none, size,
+                     performance or strip-debug (default none)
+  --shader-stats     print word, function, loop and instruction counts of
+                     every shader module, before and after optimizing, and
+                     its estimated per fragment cost
+
+compare:
+  --compare          time the two given shaders against each other offscreen
+                     at --size until the difference is significant, exits
+                     with 2 when the second is slower by more than
+                     --max-regression
+  --batch <count>    draws of each shader per round (default 16)
+  --confidence <p>   confidence of the verdict over all looks at the
+                     interval (default 0.95)
+  --max-seconds <s>  give up as inconclusive after this long (default 60)
+  --max-regression <percent>
+                     slowdown of the second shader that fails the run
+
+autotune:
+  --autotune         compile every combination of --define values for the
+                     given shader in parallel, time each offscreen at --size
+                     and print them by cost, starring those no other beats on
+                     both time and difference from the first combination
+  --define <name>=<value>,<value>...
+                     values to try for a #define, the first is the reference;
+                     can be repeated
+  --rounds <count>   timing rounds of --batch draws each (default 8)
+
+record and replay:
+  --record <trace>   write the time step, resolution, mouse, keys and shader
+                     loads of every frame of the primary window to a file
+  --replay <trace>   show the recorded frames again with exactly those inputs
+                     and the shader sources as recorded, then exit; with
+                     --export, render them offscreen into images along with
+                     a timings.csv of GPU times instead
+
+startup:
+  --startup-times    print how long each startup phase took
+
+reloading:
+  --reload-bench <count>
+                     touch the first shader file this many times, waiting
+                     for each reload to be presented, then print how long
+                     every stage took and exit
+
+accumulation:
+  --accumulate       keep averaging samples of a still image instead of
+                     redrawing it, frame is the sample index and time stays
+                     put until the shader or the input changes
+  --samples <n>      stop after this many samples (default 1024)
+  --tile-budget <ms> draw only as many tiles of a sample per frame as the GPU
+                     gets through in this long
+
+vertices:
+  --vertices <file>  stream a vertex file into the GPU while drawing it with
+                     --vertex-shader and the shader files as the fragment
+                     stage; the file starts with "RVTX", a version, the
+                     vertex count, data offset, stride and attribute count,
+                     then a location, format and offset per attribute
+  --vertex-shader <file.vert>
+                     reads the attributes at their locations, writes
+                     gl_PointSize when drawing points
+  --primitives <kind>
+                     points, lines or triangles (default points)
+
+textures:
+  --texture <image>  load an image into the texture table, the first one
+                     given is retort_textures[0]; can be repeated
+
+audio:
+  --audio <file.wav> play a WAV file silently, looping, and feed its spectrum
+                     and waveform to the shaders as a texture
+
+gallery:
+  --gallery <dir>    show every .frag and .glsl file in a directory as a live
+                     thumbnail, each compiled once it scrolls into view;
+                     clicking one shows it in the focused window
+  --gallery-budget <ms>
+                     GPU time thumbnails may take per frame, the ones drawn
+                     least recently go first (default 4)
+
+shared memory:
+  --shm <name>       publish every frame, rendered at --size, into a named
+                     shared memory ring
+  --shm-slots <n>    frame slots in the ring (default 3)
+)";
+
+struct Options {
+  std::vector<std::filesystem::path> files;
+
+  std::optional<std::string> export_output;
+  std::string export_format = "ppm";
+  uint32_t export_frames = 600;
+  double export_fps = 60.;
+  uint32_t width = 1920;
+  uint32_t height = 1080;
+  uint32_t ring_size = 4;
+  bool tiled = false;
+  uint32_t tile_size = 4096;
+
+  bool one_window_per_file = false;
+  bool on_demand = false;
+  bool print_startup_times = false;
+  std::optional<uint32_t> reload_benchmark_count;
+  std::optional<std::filesystem::path> audio_file;
+  std::vector<std::filesystem::path> textures;
+  std::optional<std::filesystem::path> vertex_file;
+  std::optional<std::filesystem::path> vertex_shader;
+  VkPrimitiveTopology vertex_topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+  AccumulationSettings accumulation;
+  std::optional<std::filesystem::path> gallery_directory;
+  double gallery_budget_ms = 4.;
+
+  OptimizerRecipe optimizer_recipe = OptimizerRecipe::None;
+  bool print_shader_statistics = false;
+
+  std::optional<std::string> shm_name;
+  uint32_t shm_slots = 3;
+
+  std::optional<std::filesystem::path> record_trace;
+  std::optional<std::filesystem::path> replay_trace;
+
+  bool autotune = false;
+  std::vector<std::string> autotune_defines;
+  uint32_t autotune_rounds = 8;
+
+  bool compare = false;
+  uint32_t compare_batch = 16;
+  double compare_confidence = 0.95;
+  double compare_seconds = 60.;
+  std::optional<double> compare_max_regression;
+
+  bool is_headless() const {
+    return export_output.has_value() || compare || autotune;
+  }
+};
+
+[[noreturn]] void usage_error(const std::string &message) {
+  std::cerr << "retort: " << message << "\n\n" << USAGE;
+  exit(1);
+}
+
+Options parse_options(int argc, char **argv) {
+  Options options;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        usage_error("missing value for " + arg);
+      return argv[++i];
+    };
+
+    auto number = [&]() -> double {
+      auto str = value();
+      char *end = nullptr;
+      double parsed = strtod(str.c_str(), &end);
+      if (end == str.c_str() || *end != '\0' || parsed <= 0.)
+        usage_error("expected a positive number for " + arg);
+      return parsed;
+    };
+
+    auto count = [&]() -> uint32_t {
+      auto str = value();
+      char *end = nullptr;
+      auto parsed = strtoull(str.c_str(), &end, 10);
+      if (!isdigit((unsigned char)str[0]) || *end != '\0' || parsed < 1 ||
+          parsed > UINT32_MAX)
+        usage_error("expected a whole number of at least 1 for " + arg);
+      return (uint32_t)parsed;
+    };
+
+    if (arg == "--help" || arg == "-h") {
+      std::cout << USAGE;
+      exit(0);
+    } else if (arg == "--windows") {
+      options.one_window_per_file = true;
+    } else if (arg == "--on-demand") {
+      options.on_demand = true;
+    } else if (arg == "--startup-times") {
+      options.print_startup_times = true;
+    } else if (arg == "--reload-bench") {
+      options.reload_benchmark_count = count();
+    } else if (arg == "--accumulate") {
+      options.accumulation.is_enabled = true;
+    } else if (arg == "--samples") {
+      options.accumulation.sample_limit = count();
+    } else if (arg == "--tile-budget") {
+      options.accumulation.tile_budget_ms = number();
+    } else if (arg == "--texture") {
+      options.textures.push_back(value());
+    } else if (arg == "--gallery") {
+      options.gallery_directory = value();
+    } else if (arg == "--gallery-budget") {
+      options.gallery_budget_ms = number();
+    } else if (arg == "--vertices") {
+      options.vertex_file = value();
+    } else if (arg == "--vertex-shader") {
+      options.vertex_shader = value();
+    } else if (arg == "--primitives") {
+      auto kind = value();
+      if (kind == "points")
+        options.vertex_topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+      else if (kind == "lines")
+        options.vertex_topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+      else if (kind == "triangles")
+        options.vertex_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+      else
+        usage_error("expected points, lines or triangles for --primitives");
+    } else if (arg == "--audio") {
+      options.audio_file = value();
+    } else if (arg == "--optimize") {
+      auto name = value();
+      auto recipe = parse_optimizer_recipe(name);
+      if (!recipe)
+        usage_error("unknown optimizer recipe " + name);
+      options.optimizer_recipe = recipe.value();
+    } else if (arg == "--shader-stats") {
+      options.print_shader_statistics = true;
+    } else if (arg == "--export") {
+      options.export_output = value();
+    } else if (arg == "--format") {
+      options.export_format = value();
+    } else if (arg == "--frames") {
+      options.export_frames = count();
+    } else if (arg == "--fps") {
+      options.export_fps = number();
+    } else if (arg == "--ring") {
+      options.ring_size = count();
+    } else if (arg == "--tiled") {
+      options.tiled = true;
+    } else if (arg == "--tile-size") {
+      options.tile_size = count();
+    } else if (arg == "--shm") {
+      options.shm_name = value();
+    } else if (arg == "--shm-slots") {
+      options.shm_slots = count();
+    } else if (arg == "--record") {
+      options.record_trace = value();
+    } else if (arg == "--replay") {
+      options.replay_trace = value();
+    } else if (arg == "--autotune") {
+      options.autotune = true;
+    } else if (arg == "--define") {
+      options.autotune_defines.push_back(value());
+    } else if (arg == "--rounds") {
+      options.autotune_rounds = count();
+    } else if (arg == "--compare") {
+      options.compare = true;
+    } else if (arg == "--batch") {
+      options.compare_batch = count();
+    } else if (arg == "--confidence") {
+      options.compare_confidence = number();
+      if (options.compare_confidence >= 1.)
+        usage_error("expected a confidence below 1");
+    } else if (arg == "--max-seconds") {
+      options.compare_seconds = number();
+    } else if (arg == "--max-regression") {
+      options.compare_max_regression = number();
+    } else if (arg == "--size") {
+      auto str = value();
+      if (sscanf(str.c_str(), "%ux%u", &options.width, &options.height) != 2 ||
+          options.width == 0 || options.height == 0)
+        usage_error("expected <width>x<height> for --size");
+    } else if (arg.starts_with("--")) {
+      usage_error("unknown option " + arg);
+    } else {
+      options.files.push_back(arg);
+    }
+  }
+
+  if (options.replay_trace && !options.files.empty())
+    usage_error("--replay takes its shaders from the trace");
+  if (options.export_output && !options.replay_trace &&
+      options.files.size() != 1)
+    usage_error("--export takes exactly one shader file");
+  if (options.tiled && !options.export_output)
+    usage_error("--tiled needs --export");
+  if (options.tiled && options.replay_trace)
+    usage_error("--tiled cannot be combined with --replay");
+  if (options.export_output && options.shm_name)
+    usage_error("--export and --shm cannot be combined");
+  if (options.reload_benchmark_count && options.files.empty())
+    usage_error("--reload-bench needs a shader file");
+  if (options.reload_benchmark_count && options.is_headless())
+    usage_error("--reload-bench needs a window to present to");
+  if (options.audio_file && options.is_headless())
+    usage_error("--audio needs a window to play along with");
+  if (options.accumulation.is_enabled && options.is_headless())
+    usage_error("--accumulate needs a window to converge in");
+  if (options.gallery_directory && options.is_headless())
+    usage_error("--gallery needs a window to show the thumbnails in");
+  if (options.vertex_file.has_value() != options.vertex_shader.has_value())
+    usage_error("--vertices and --vertex-shader need each other");
+  if (options.vertex_file && options.is_headless())
+    usage_error("--vertices needs a window to draw in");
+  if (options.vertex_file && options.accumulation.is_enabled)
+    usage_error("--vertices cannot be combined with --accumulate");
+  if (options.compare && options.files.size() != 2)
+    usage_error("--compare takes exactly two shader files");
+  if (options.compare && (options.export_output || options.shm_name))
+    usage_error("--compare cannot be combined with --export or --shm");
+  if (options.autotune && options.files.size() != 1)
+    usage_error("--autotune takes exactly one shader file");
+  if (options.autotune && options.autotune_defines.empty())
+    usage_error("--autotune needs at least one --define");
+  if (options.autotune &&
+      (options.export_output || options.shm_name || options.compare))
+    usage_error("--autotune cannot be combined with --export, --shm or "
+                "--compare");
+  if (options.record_trace && options.is_headless())
+    usage_error("--record needs a window to take input from");
+  if (options.record_trace && options.replay_trace)
+    usage_error("--record and --replay cannot be combined");
+  if (options.replay_trace && options.reload_benchmark_count)
+    usage_error("--replay cannot be combined with --reload-bench");
+
+  return options;
+}
+
+} // namespace retort
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstring>
+#include <span>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "memory.hpp"
+#include "shaders/interface.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// What shaders read as their `Parameters` block. Laid out like the input
+// latch: a slot per window and frame in flight, picked with a dynamic offset,
+// and a first slot for offscreen rendering that stays zero. Mapped for as
+// long as it lives, each slot is written while building the frame that reads
+// it.
+struct ParameterRing {
+  Buffer buffer;
+  VkDeviceSize stride = 0;
+  size_t frame_count = 0;
+  size_t window_capacity = 0;
+};
+
+ParameterRing
+create_parameter_ring(vkb::DispatchTable &dispatch,
+                      const VkPhysicalDeviceMemoryProperties &props,
+                      VkDeviceSize alignment, size_t frame_count,
+                      size_t window_capacity) {
+  ParameterRing ring;
+  ring.stride =
+      (PARAMETER_BLOCK_SIZE + alignment - 1) / alignment * alignment;
+  ring.frame_count = frame_count;
+  ring.window_capacity = window_capacity;
+  auto slots = 1 + frame_count * window_capacity;
+  ring.buffer = create_buffer(dispatch, props, ring.stride * slots,
+                              VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  memset(ring.buffer.mapped, 0, ring.buffer.size);
+  return ring;
+}
+
+void destroy_parameter_ring(vkb::DispatchTable &dispatch,
+                            ParameterRing &ring) {
+  destroy_buffer(dispatch, ring.buffer);
+  ring = {};
+}
+
+uint32_t parameter_ring_offset(const ParameterRing &ring, size_t slot,
+                               size_t window) {
+  return (uint32_t)((1 + slot * ring.window_capacity + window) * ring.stride);
+}
+
+// Anything past `values` in the slot is left as it was, no member reads it.
+void write_parameters(ParameterRing &ring, size_t slot, size_t window,
+                      std::span<const uint8_t> values) {
+  auto mapped = (uint8_t *)ring.buffer.mapped;
+  memcpy(mapped + parameter_ring_offset(ring, slot, window), values.data(),
+         values.size());
+}
+
+} // namespace retort
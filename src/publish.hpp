@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "offscreen.hpp"
+#include "readback.hpp"
+#include "renderer.hpp"
+#include "shared_frames.hpp"
+
+namespace retort {
+
+// Renders the primary window's shader again into an offscreen target of the
+// requested size every frame and publishes it into a shared memory ring. The
+// render loop never waits for it: when all readback slots are still in use the
+// frame is dropped.
+struct SharedFramePublisher {
+  Renderer &renderer;
+  VkExtent2D extent;
+  SharedFrameRing shared;
+  OffscreenTarget target;
+  ReadbackRing ring;
+  std::thread thread;
+
+  uint64_t next_frame = 0;
+  uint64_t dropped_frames = 0;
+  // What last read the mirror slot of each frame slot
+  std::array<uint64_t, MAXIMUM_FRAMES_IN_FLIGHT> mirror_values = {};
+
+  SharedFramePublisher(Renderer &renderer, const std::string &name,
+                       VkExtent2D extent, uint32_t slot_count)
+      : renderer(renderer), extent(extent),
+        target(create_offscreen_target(
+            renderer.dispatch, renderer.physical_device.memory_properties,
+            renderer.surface_format.format, extent)),
+        ring(renderer.dispatch, *renderer.render_data.timeline,
+             renderer.physical_device.memory_properties,
+             renderer.device.get_queue_index(vkb::QueueType::graphics).value(),
+             slot_count, (VkDeviceSize)extent.width * extent.height * 4) {
+    auto format = renderer.surface_format.format;
+    bool is_bgra = format == VK_FORMAT_B8G8R8A8_SRGB ||
+                   format == VK_FORMAT_B8G8R8A8_UNORM;
+    if (!shared.create(name, extent.width, extent.height, slot_count,
+                       is_bgra ? SharedFrameFormat::Bgra8
+                               : SharedFrameFormat::Rgba8))
+      PANIC("FAILED TO CREATE SHARED MEMORY");
+
+    thread = std::thread([this]() { _publisher_loop(); });
+  }
+
+  ~SharedFramePublisher() {
+    ring.close();
+    thread.join();
+    CHECK_VK_ERRC(renderer.dispatch.deviceWaitIdle());
+    destroy_offscreen_target(renderer.dispatch, target);
+  }
+
+  void capture() {
+    TRACE_SCOPE("SharedFramePublisher::capture");
+    EXPECT(!renderer.is_frame_in_progress);
+
+    auto index = ring.try_acquire(next_frame);
+    if (!index) {
+      dropped_frames++;
+      return;
+    }
+    next_frame++;
+
+    auto &slot = ring.slots[index.value()];
+    auto &dispatch = renderer.dispatch;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK_ERRC(
+        dispatch.beginCommandBuffer(slot.command_buffer, &begin_info));
+
+    // The frame that just ended, with the inputs and parameters it was
+    // drawn with
+    auto frame_slot =
+        (renderer.render_data.current_frame + MAXIMUM_FRAMES_IN_FLIGHT - 1) %
+        MAXIMUM_FRAMES_IN_FLIGHT;
+    renderer.render_data.timeline->wait(mirror_values[frame_slot]);
+    auto offsets = renderer.mirror_primary_window(frame_slot);
+
+    auto pipeline = renderer.window_pipeline(renderer.primary_window());
+    renderer.record_shader_pass(slot.command_buffer, pipeline,
+                                target.render_pass, target.framebuffer, extent,
+                                renderer.shader_inputs(extent), offsets);
+    record_readback(dispatch, slot.command_buffer, target, slot.buffer.buffer,
+                    0, {{0, 0}, extent});
+
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(slot.command_buffer));
+
+    ring.submit(index.value(), renderer.render_data.graphics_queue);
+    mirror_values[frame_slot] = renderer.render_data.timeline->submitted;
+  }
+
+  void _publisher_loop() {
+    using namespace std::chrono;
+    TRACE_THREAD_NAME("shared frame publisher");
+
+    while (auto index = ring.next()) {
+      TRACE_SCOPE("SharedFramePublisher::publish");
+      auto &slot = ring.slots[index.value()];
+      auto submitted_ns =
+          duration_cast<nanoseconds>(slot.submitted_at.time_since_epoch())
+              .count();
+      shared.publish(slot.frame, slot.buffer.mapped, submitted_ns);
+      ring.release(index.value());
+    }
+  }
+};
+
+} // namespace retort
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "memory.hpp"
+#include "timeline.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+struct ReadbackSlot {
+  Buffer buffer;
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  // What the queue timeline reaches once the copy has landed
+  uint64_t timeline_value = 0;
+  uint64_t frame = 0;
+  std::chrono::steady_clock::time_point submitted_at;
+};
+
+// Host-visible buffers that rendered frames are copied into. The render loop
+// records into free slots and hands them over right after submitting, the
+// consumer thread waits for the copy to land, reads the mapped memory and
+// releases the slot. The render loop only ever blocks when every slot is
+// still owned by the consumer.
+struct ReadbackRing {
+  vkb::DispatchTable dispatch;
+  QueueTimeline &timeline;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  std::vector<ReadbackSlot> slots;
+
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<size_t> _free;
+  std::deque<size_t> _submitted;
+  bool _is_closed = false;
+
+  ReadbackRing(vkb::DispatchTable dispatch, QueueTimeline &timeline,
+               const VkPhysicalDeviceMemoryProperties &props,
+               uint32_t queue_family, size_t slot_count, VkDeviceSize slot_size)
+      : dispatch(dispatch), timeline(timeline), slots(slot_count) {
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = queue_family;
+    CHECK_VK_ERRC(
+        this->dispatch.createCommandPool(&pool_info, nullptr, &command_pool));
+
+    for (size_t i = 0; i < slot_count; i++) {
+      auto &slot = slots[i];
+      slot.buffer = create_buffer(this->dispatch, props, slot_size,
+                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+      VkCommandBufferAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      alloc_info.commandPool = command_pool;
+      alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      alloc_info.commandBufferCount = 1;
+      CHECK_VK_ERRC(this->dispatch.allocateCommandBuffers(
+          &alloc_info, &slot.command_buffer));
+
+      _free.push_back(i);
+    }
+  }
+
+  ReadbackRing(const ReadbackRing &) = delete;
+  ReadbackRing &operator=(const ReadbackRing &) = delete;
+
+  ~ReadbackRing() {
+    for (auto &slot : slots) {
+      timeline.wait(slot.timeline_value);
+      destroy_buffer(dispatch, slot.buffer);
+    }
+    dispatch.destroyCommandPool(command_pool, nullptr);
+  }
+
+  // Render side: blocks until a slot is free, then resets it for recording.
+  size_t acquire(uint64_t frame) {
+    size_t index;
+    {
+      std::unique_lock lock(_mutex);
+      _condition.wait(lock, [this]() { return !_free.empty(); });
+      index = _free.front();
+      _free.pop_front();
+    }
+
+    _reset_slot(index, frame);
+    return index;
+  }
+
+  // Render side: like `acquire`, but gives up instead of waiting so that a
+  // slow consumer drops frames rather than stalling the render loop.
+  std::optional<size_t> try_acquire(uint64_t frame) {
+    size_t index;
+    {
+      std::lock_guard lock(_mutex);
+      if (_free.empty())
+        return std::nullopt;
+      index = _free.front();
+      _free.pop_front();
+    }
+
+    _reset_slot(index, frame);
+    return index;
+  }
+
+  void _reset_slot(size_t index, uint64_t frame) {
+    auto &slot = slots[index];
+    slot.frame = frame;
+    CHECK_VK_ERRC(dispatch.resetCommandBuffer(slot.command_buffer, 0));
+  }
+
+  // Render side: submits the recorded command buffer to `queue`, which the
+  // timeline belongs to, and hands the slot over to the consumer.
+  void submit(size_t index, VkQueue queue) {
+    auto &slot = slots[index];
+    slot.timeline_value = timeline.next();
+
+    TimelineSignal signal(1);
+    signal.values[0] = slot.timeline_value;
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &slot.command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &timeline.semaphore;
+    signal.chain(submit_info);
+    CHECK_VK_ERRC(dispatch.queueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE));
+
+    slot.submitted_at = std::chrono::steady_clock::now();
+    {
+      std::lock_guard lock(_mutex);
+      _submitted.push_back(index);
+    }
+    _condition.notify_all();
+  }
+
+  // Render side: no more slots will be submitted.
+  void close() {
+    {
+      std::lock_guard lock(_mutex);
+      _is_closed = true;
+    }
+    _condition.notify_all();
+  }
+
+  // Consumer side: the oldest submitted slot once its copy has finished, or
+  // nothing after `close` when every slot has been consumed.
+  std::optional<size_t> next() {
+    size_t index;
+    {
+      std::unique_lock lock(_mutex);
+      _condition.wait(lock,
+                      [this]() { return _is_closed || !_submitted.empty(); });
+      if (_submitted.empty())
+        return std::nullopt;
+      index = _submitted.front();
+      _submitted.pop_front();
+    }
+
+    timeline.wait(slots[index].timeline_value);
+    return index;
+  }
+
+  // Consumer side: done reading the slot's memory.
+  void release(size_t index) {
+    {
+      std::lock_guard lock(_mutex);
+      _free.push_back(index);
+    }
+    _condition.notify_all();
+  }
+};
+
+} // namespace retort
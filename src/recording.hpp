@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "threading.hpp"
+#include "tracing.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+const size_t MAXIMUM_RECORDING_THREADS = 4;
+
+// Secondary command buffers of one recording thread for one frame slot. The
+// whole pool is reset at once when the slot comes around again, buffers are
+// kept and handed out again.
+struct ThreadCommands {
+  VkCommandPool pool = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> buffers;
+  size_t used = 0;
+};
+
+// Work recorded into a secondary command buffer that continues `render_pass`
+// on `framebuffer`. `record` runs on any of the recording threads.
+struct SecondaryPass {
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  std::function<void(VkCommandBuffer)> record;
+
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+};
+
+// Records the passes of a frame in parallel. Every thread allocates from its
+// own pool for the current frame slot, so nothing is shared between threads
+// and nothing has to be locked.
+struct RecordingScheduler {
+  vkb::DispatchTable dispatch;
+  ThreadPool threads;
+  // Indexed by frame slot, then by worker, the calling thread goes last
+  std::vector<std::vector<ThreadCommands>> _frames;
+  size_t _frame = 0;
+
+  RecordingScheduler(vkb::DispatchTable dispatch, uint32_t queue_family,
+                     size_t frame_count)
+      : dispatch(dispatch),
+        threads(std::clamp<size_t>(std::thread::hardware_concurrency(), 1,
+                                   MAXIMUM_RECORDING_THREADS)),
+        _frames(frame_count) {
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_info.queueFamilyIndex = queue_family;
+
+    for (auto &frame : _frames) {
+      frame.resize(threads.size() + 1);
+      for (auto &commands : frame)
+        CHECK_VK_ERRC(this->dispatch.createCommandPool(&pool_info, nullptr,
+                                                       &commands.pool));
+    }
+  }
+
+  RecordingScheduler(const RecordingScheduler &) = delete;
+  RecordingScheduler &operator=(const RecordingScheduler &) = delete;
+
+  // The device must be done with every frame slot.
+  ~RecordingScheduler() {
+    for (auto &frame : _frames)
+      for (auto &commands : frame)
+        dispatch.destroyCommandPool(commands.pool, nullptr);
+  }
+
+  // The GPU must be done with the previous use of `frame`.
+  void begin_frame(size_t frame) {
+    _frame = frame;
+    for (auto &commands : _frames[frame]) {
+      if (commands.used == 0)
+        continue;
+      CHECK_VK_ERRC(dispatch.resetCommandPool(commands.pool, 0));
+      commands.used = 0;
+    }
+  }
+
+  VkCommandBuffer _allocate(ThreadCommands &commands) {
+    if (commands.used == commands.buffers.size()) {
+      VkCommandBufferAllocateInfo allocate_info = {};
+      allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocate_info.commandPool = commands.pool;
+      allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      allocate_info.commandBufferCount = 1;
+      CHECK_VK_ERRC(dispatch.allocateCommandBuffers(
+          &allocate_info, &commands.buffers.emplace_back()));
+    }
+    return commands.buffers[commands.used++];
+  }
+
+  void _record(SecondaryPass &pass) {
+    TRACE_SCOPE("RecordingScheduler::record");
+    auto worker = std::min(ThreadPool::worker_index(), threads.size());
+    auto command_buffer = _allocate(_frames[_frame][worker]);
+
+    VkCommandBufferInheritanceInfo inheritance_info = {};
+    inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritance_info.renderPass = pass.render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = pass.framebuffer;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                       VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance_info;
+    CHECK_VK_ERRC(dispatch.beginCommandBuffer(command_buffer, &begin_info));
+    pass.record(command_buffer);
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(command_buffer));
+
+    pass.command_buffer = command_buffer;
+  }
+
+  // Blocks until every pass has its command buffer. A single pass is not
+  // worth the hand-off and is recorded on the calling thread.
+  void record(std::vector<SecondaryPass> &passes) {
+    TRACE_SCOPE("RecordingScheduler::record_all");
+    if (passes.size() == 1)
+      _record(passes[0]);
+    else
+      threads.parallel_for(passes.size(),
+                           [&](size_t i) { _record(passes[i]); });
+  }
+};
+
+} // namespace retort
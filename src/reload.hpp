@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace retort {
+
+// Reloads kept around for display.
+const size_t RELOAD_HISTORY = 64;
+
+// The benchmark lets the loop settle between reloads, and touches the file
+// again when a reload got lost.
+const std::chrono::milliseconds RELOAD_BENCHMARK_PAUSE{50};
+const std::chrono::seconds RELOAD_BENCHMARK_TIMEOUT{10};
+
+// The steps between saving a shader and seeing it, in the order they happen.
+enum struct ReloadStage {
+  Detected,
+  Read,
+  Compiled,
+  PipelineCreated,
+  Submitted,
+  Presented,
+};
+
+const size_t RELOAD_STAGE_COUNT = (size_t)ReloadStage::Presented + 1;
+
+const char *reload_stage_name(ReloadStage stage) {
+  switch (stage) {
+  case ReloadStage::Detected:
+    return "detected";
+  case ReloadStage::Read:
+    return "read";
+  case ReloadStage::Compiled:
+    return "compiled";
+  case ReloadStage::PipelineCreated:
+    return "pipeline";
+  case ReloadStage::Submitted:
+    return "submitted";
+  case ReloadStage::Presented:
+    return "presented";
+  }
+  return "unknown";
+}
+
+struct ReloadTiming {
+  std::string shader;
+  // From the file's write time to noticing it, unknown for files that were
+  // opened rather than saved
+  std::optional<double> detection_delay_ms;
+  std::array<std::chrono::steady_clock::time_point, RELOAD_STAGE_COUNT> stages;
+  size_t stage_count = 0;
+
+  // Time spent in `stage`, i.e. since the stage before it.
+  double stage_ms(ReloadStage stage) const {
+    auto i = (size_t)stage;
+    if (i == 0)
+      return detection_delay_ms.value_or(0.);
+    return std::chrono::duration<double, std::milli>(stages[i] -
+                                                     stages[i - 1])
+        .count();
+  }
+
+  double total_ms() const {
+    return detection_delay_ms.value_or(0.) +
+           std::chrono::duration<double, std::milli>(stages.back() -
+                                                     stages.front())
+               .count();
+  }
+};
+
+// Follows each shader from the moment its file changed until a frame that
+// uses it has been presented. Stages arrive from the app and the renderer,
+// reloads that stop half way are dropped when the shader reloads again.
+struct ReloadLatencies {
+  std::unordered_map<std::string, ReloadTiming> pending;
+  std::deque<ReloadTiming> history;
+  uint64_t completed_count = 0;
+
+  void begin(const std::string &shader,
+             std::optional<double> detection_delay_ms) {
+    auto &timing = pending[shader];
+    timing = {};
+    timing.shader = shader;
+    timing.detection_delay_ms = detection_delay_ms;
+    timing.stages[0] = std::chrono::steady_clock::now();
+    timing.stage_count = 1;
+  }
+
+  // Stages have to arrive in order, a frame submitted before the pipeline
+  // was swapped does not count.
+  void mark(const std::string &shader, ReloadStage stage) {
+    auto it = pending.find(shader);
+    if (it == pending.end() || it->second.stage_count != (size_t)stage)
+      return;
+
+    auto &timing = it->second;
+    timing.stages[timing.stage_count++] = std::chrono::steady_clock::now();
+    if (stage != ReloadStage::Presented)
+      return;
+
+    history.push_back(std::move(timing));
+    if (history.size() > RELOAD_HISTORY)
+      history.pop_front();
+    pending.erase(it);
+    completed_count++;
+  }
+
+  void cancel(const std::string &shader) { pending.erase(shader); }
+};
+
+// Milliseconds the file has existed in its current state.
+std::optional<double> time_since_write_ms(const std::filesystem::path &path) {
+  std::error_code error;
+  auto written = std::filesystem::last_write_time(path, error);
+  if (error)
+    return std::nullopt;
+  auto since = std::chrono::file_clock::now() - written;
+  return std::max(0., std::chrono::duration<double, std::milli>(since).count());
+}
+
+void print_reload_latencies(const std::vector<ReloadTiming> &timings) {
+  if (timings.empty())
+    return;
+
+  std::vector<double> values(timings.size());
+  auto row = [&](const char *label, auto &&value_of) {
+    for (size_t i = 0; i < timings.size(); i++)
+      values[i] = value_of(timings[i]);
+    std::sort(values.begin(), values.end());
+    auto percentile = [&](double p) {
+      return values[(size_t)(p * (values.size() - 1) + 0.5)];
+    };
+    fprintf(stderr, "%-12s %9.2f %9.2f %9.2f %9.2f %9.2f\n", label,
+            values.front(), percentile(0.5), percentile(0.9),
+            percentile(0.99), values.back());
+  };
+
+  fprintf(stderr, "%zu reloads, milliseconds\n", timings.size());
+  fprintf(stderr, "%-12s %9s %9s %9s %9s %9s\n", "stage", "min", "p50", "p90",
+          "p99", "max");
+  for (size_t i = 0; i < RELOAD_STAGE_COUNT; i++) {
+    auto stage = (ReloadStage)i;
+    row(reload_stage_name(stage),
+        [&](const ReloadTiming &timing) { return timing.stage_ms(stage); });
+  }
+  row("total", [](const ReloadTiming &timing) { return timing.total_ms(); });
+}
+
+// Touches a shader file, waits for the reload to reach the screen, and does
+// so again until it has enough samples.
+struct ReloadBenchmark {
+  std::filesystem::path file;
+  uint32_t count;
+  std::vector<ReloadTiming> timings;
+
+  uint64_t _seen_count = 0;
+  std::optional<std::chrono::steady_clock::time_point> _touched;
+  std::chrono::steady_clock::time_point _last_completion;
+
+  ReloadBenchmark(std::filesystem::path file, uint32_t count)
+      : file(std::move(file)), count(count) {}
+
+  bool is_done() const { return timings.size() >= count; }
+
+  void update(const ReloadLatencies &latencies) {
+    auto now = std::chrono::steady_clock::now();
+    if (latencies.completed_count > _seen_count) {
+      _seen_count = latencies.completed_count;
+      if (_touched && latencies.history.back().shader == file.string())
+        timings.push_back(latencies.history.back());
+      _touched.reset();
+      _last_completion = now;
+    }
+
+    if (is_done() || now - _last_completion < RELOAD_BENCHMARK_PAUSE)
+      return;
+    if (_touched && now - _touched.value() < RELOAD_BENCHMARK_TIMEOUT)
+      return;
+
+    std::filesystem::last_write_time(file, std::chrono::file_clock::now());
+    _touched = now;
+  }
+};
+
+} // namespace retort
@@ -1,12 +1,22 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cmath>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <list>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string>
+#include <unordered_map>
 
 #include <GLFW/glfw3.h>
 
@@ -16,61 +26,248 @@
 
 #include <imgui.h>
 
+#include "accumulation.hpp"
+#include "audio.hpp"
 #include "bootstrap.hpp"
 #include "error.hpp"
+#include "input.hpp"
+#include "parameters.hpp"
+#include "recording.hpp"
+#include "reload.hpp"
 #include "shaders.hpp"
+#include "startup.hpp"
+#include "textures.hpp"
+#include "threading.hpp"
+#include "timeline.hpp"
+#include "tracing.hpp"
+#include "vertices.hpp"
 
 namespace retort {
 
 const size_t MAXIMUM_FRAMES_IN_FLIGHT = 12;
 
+// How much a new GPU time measurement moves the displayed average.
+const double GPU_TIME_SMOOTHING = 0.1;
+
+// A suboptimal swapchain keeps presenting, scaled, for at least this long
+// after the last recreation, so dragging a window edge does not recreate it
+// on every step.
+const std::chrono::milliseconds SWAPCHAIN_RECREATE_INTERVAL(50);
+
+// Frames presented after a swapchain was retired before it is destroyed.
+// Presentation is not on the timeline, so this stands in for knowing when
+// the presentation engine let go of its images.
+const uint64_t SWAPCHAIN_RETIRE_FRAMES = 2;
+
+// Images ImGui can show besides its font, such as gallery thumbnails.
+const uint32_t IMGUI_TEXTURE_LIMIT = 64;
+
+// Shared by every window.
 struct RenderData {
   VkQueue graphics_queue;
   VkQueue present_queue;
   VkPipelineLayout pipeline_layout;
+  VkPipelineCache pipeline_cache;
   VkRenderPass render_pass;
+  // Compatible with `render_pass`, draws over a blitted image instead
+  VkRenderPass overlay_render_pass;
+
+  // Created the first time accumulation is turned on
+  VkRenderPass accumulation_render_pass = VK_NULL_HANDLE;
+  VkFormat accumulation_format = VK_FORMAT_UNDEFINED;
+
+  // Built from `SHADER_INTERFACE`, bound for every shader
+  std::array<VkDescriptorSetLayout, SHADER_SET_COUNT> set_layouts = {};
+  std::array<VkDescriptorSet, SHADER_SET_COUNT> sets = {};
+  VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
 
-  VkPipeline graphics_pipeline;
   VkShaderModule vertex_shader_module = VK_NULL_HANDLE;
-  VkShaderModule fragment_shader_module = VK_NULL_HANDLE;
+  // Draws the vertex stream instead of the full screen quad when there is one
+  VkShaderModule stream_vertex_module = VK_NULL_HANDLE;
+
+  VkCommandPool command_pool;
+  // One primary per frame slot, running the render passes of every window
+  std::array<VkCommandBuffer, MAXIMUM_FRAMES_IN_FLIGHT> frame_command_buffers;
+
+  // One submission covers all windows and signals the next value of the
+  // graphics queue timeline, remembered per frame slot
+  std::unique_ptr<QueueTimeline> timeline;
+  std::array<uint64_t, MAXIMUM_FRAMES_IN_FLIGHT> frame_values = {};
+  size_t current_frame = 0;
+  // Frames that presented to at least one window
+  uint64_t presented_frames = 0;
+};
+
+// A window with its own swapchain and per-frame resources, showing one of the
+// prepared shaders.
+struct RenderWindow {
+  GLFWwindow *window;
+  VkSurfaceKHR surface;
+  vkb::Swapchain swapchain;
+  std::string shader;
 
   std::vector<VkImage> swapchain_images;
   std::vector<VkImageView> swapchain_image_views;
   std::vector<VkFramebuffer> framebuffers;
 
-  VkCommandPool command_pool;
-  std::vector<VkCommandBuffer> command_buffers;
-
   std::vector<VkSemaphore> available_semaphores;
   std::vector<VkSemaphore> finished_semaphore;
-  std::vector<VkFence> in_flight_fences;
-  std::vector<VkFence> image_in_flight;
-  size_t current_frame = 0;
+  // Timeline value of the last frame that drew into each image
+  std::vector<uint64_t> image_in_flight;
+
+  // Two timestamps around the shader pass per frame in flight, and the shader
+  // they measured until they are read back
+  VkQueryPool timestamp_pool = VK_NULL_HANDLE;
+  std::vector<std::optional<std::string>> timestamp_shaders;
 
-  VkCommandPool imgui_command_pool;
-  std::vector<VkCommandBuffer> imgui_buffers;
+  // Present while accumulating, sized like the swapchain
+  std::optional<AccumulationTarget> accumulation;
+
+  // What was last latched, kept for where the left button went down
+  LatchedInputs latched_inputs = {};
 
   uint32_t image_index;
+  bool is_acquired = false;
+  // Both are recreated once the interval since the last recreation has
+  // passed. A suboptimal swapchain keeps presenting until then, the window of
+  // an out of date one sits frames out.
+  bool is_suboptimal = false;
+  bool is_out_of_date = false;
+  std::chrono::steady_clock::time_point recreated_at;
+};
+
+// A swapchain replaced by a new one, with what was made from its images.
+// Destroyed once the last frame submitted before the replacement is done and
+// enough frames were presented since.
+struct RetiredSwapchain {
+  uint64_t last_frame_value;
+  uint64_t destroy_after_presented;
+  std::function<void()> destroy;
+};
+
+// How many replaced shaders are kept around to switch back to without
+// compiling.
+const size_t RECENT_SHADER_LIMIT = 16;
+
+// What a fragment shader was compiled from. Every fragment shader shares the
+// rest of the pipeline state, so the same origin always makes the same
+// pipeline.
+struct ShaderOrigin {
+  size_t hash;
+  std::string source;
+  ShaderDefines defines;
+  OptimizerRecipe recipe;
+  std::vector<uint32_t> code;
+
+  bool matches(size_t other_hash, const std::string &other_source,
+               const ShaderDefines &other_defines,
+               OptimizerRecipe other_recipe) const {
+    return hash == other_hash && recipe == other_recipe &&
+           defines == other_defines && source == other_source;
+  }
+};
+
+size_t shader_origin_hash(const std::string &source,
+                          const ShaderDefines &defines,
+                          OptimizerRecipe recipe) {
+  auto key = source;
+  for (auto &[name, value] : defines)
+    key += "\n#define " + name + " " + value;
+  key += "\n" + std::to_string((int)recipe);
+  return std::hash<std::string>{}(key);
+}
+
+struct PreparedShader {
+  VkShaderModule fragment_shader_module = VK_NULL_HANDLE;
+  VkPipeline graphics_pipeline = VK_NULL_HANDLE;
+  // Blends into an accumulation target, created when first needed
+  VkPipeline accumulation_pipeline = VK_NULL_HANDLE;
+  // Draws the vertex stream, created when first needed
+  VkPipeline vertex_pipeline = VK_NULL_HANDLE;
+  bool is_time_varying = false;
+  bool reads_audio = false;
+  ShaderStatistics statistics;
+  ShaderCost cost;
+  std::optional<double> gpu_time_ms;
+  // Built in shaders have none and are destroyed once replaced
+  std::shared_ptr<const ShaderOrigin> origin;
+  // The shader's own uniform block and what its members are set to
+  std::optional<UniformBlock> parameters;
+  std::vector<uint8_t> parameter_values;
+};
+
+// Of `retort_input` and the parameters, in binding order. The default picks
+// the offscreen slots.
+using DynamicOffsets = std::array<uint32_t, 2>;
+
+struct PrewarmFailure {
+  std::string filename;
+  CompilationError error;
+};
+
+// A shader file compiled with `defines`, prepared under `name`.
+struct ShaderVariant {
+  std::string name;
+  std::filesystem::path path;
+  ShaderDefines defines;
 };
 
 struct Renderer {
-  GLFWwindow *window;
   vkb::Instance instance;
   vkb::PhysicalDevice physical_device;
   vkb::Device device;
-  vkb::Swapchain swapchain;
   vkb::DispatchTable dispatch;
 
   RenderData render_data;
 
-  Compiler shader_compiler;
+  // The first window is the primary one, it owns ImGui and closing it quits
+  std::vector<std::unique_ptr<RenderWindow>> windows;
+  size_t focused_window = 0;
+  // Every swapchain uses it so that all of them share one render pass
+  VkSurfaceFormatKHR surface_format = {};
+  // Zero when the graphics queue cannot write timestamps
+  double timestamp_period_ns = 0.;
+  // The bits of a timestamp the graphics queue writes, the rest are garbage
+  uint64_t timestamp_mask = 0;
+
+  std::shared_future<std::shared_ptr<Compiler>> _compiler;
+
+  std::unordered_map<std::string, PreparedShader> prepared_shaders;
+  // Replaced shaders, most recently replaced first
+  std::list<PreparedShader> recent_shaders;
+  ReloadLatencies reloads;
+  DeferredWork deferred;
+  std::deque<RetiredSwapchain> retired_swapchains;
+  std::unique_ptr<RecordingScheduler> recording;
+  AudioTexture audio;
+  TextureTable textures;
+  AccumulationSettings accumulation;
+  std::unique_ptr<VertexStream> vertices;
+  // Records offscreen passes into the frame's primary command buffer ahead
+  // of every window, whose ImGui may then sample what they drew
+  std::function<void(VkCommandBuffer)> record_offscreen_passes;
+  InputLatch input_latch;
+  ParameterRing parameter_ring;
+  std::chrono::steady_clock::time_point inputs_polled_at;
+  // How much older input polled at the start of the frame would have been
+  std::optional<double> latch_gain_ms;
+  // Stand in for the clock and the primary window's input when replaying
+  std::optional<double> scripted_dt;
+  std::optional<LatchedInputs> scripted_inputs;
+  bool is_audio_playing = false;
+  // The staging buffer of the current frame slot holds new audio
+  bool _has_audio_upload = false;
+  OptimizerRecipe optimizer_recipe = OptimizerRecipe::None;
 
   bool is_frame_in_progress;
+  uint32_t pending_redraws = 1;
 
   std::chrono::steady_clock delta_clock;
   std::optional<std::chrono::steady_clock::time_point> last_delta_point =
       std::nullopt;
   double dt;
+  double time = 0.;
+  uint32_t frame_count = 0;
   std::chrono::steady_clock::time_point last_fps_point;
   uint32_t frames = 0.;
   uint32_t fps;
@@ -87,7 +284,7 @@ struct Renderer {
 
     ImGui::StyleColorsDark();
 
-    ImGui_ImplGlfw_InitForVulkan(window, true);
+    ImGui_ImplGlfw_InitForVulkan(primary_window().window, true);
     ImGui_ImplVulkan_InitInfo init_info = {};
     init_info.Instance = instance;
     init_info.PhysicalDevice = physical_device;
@@ -104,12 +301,13 @@ struct Renderer {
 
     {
       VkDescriptorPoolSize pool_sizes[] = {
-          {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
+          {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+           1 + IMGUI_TEXTURE_LIMIT},
       };
       VkDescriptorPoolCreateInfo pool_info = {};
       pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
       pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
-      pool_info.maxSets = 1;
+      pool_info.maxSets = 1 + IMGUI_TEXTURE_LIMIT;
       pool_info.poolSizeCount = (uint32_t)IM_ARRAYSIZE(pool_sizes);
       pool_info.pPoolSizes = pool_sizes;
       CHECK_VK_ERRC(vkCreateDescriptorPool(device, &pool_info, nullptr,
@@ -124,37 +322,42 @@ struct Renderer {
     init_info.CheckVkResultFn = [](VkResult result) { CHECK_VK_ERRC(result); };
     init_info.Allocator = nullptr;
     ImGui_ImplVulkan_Init(&init_info);
+  }
 
-    VkCommandPoolCreateInfo command_pool_create_info = {};
-    command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    command_pool_create_info.pNext = nullptr;
-    command_pool_create_info.queueFamilyIndex = init_info.QueueFamily;
-    command_pool_create_info.flags =
-        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    CHECK_VK_ERRC(dispatch.createCommandPool(&command_pool_create_info, nullptr,
-                                             &render_data.imgui_command_pool));
-
-    VkCommandBufferAllocateInfo buffer_alloc_info = {};
-    buffer_alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    buffer_alloc_info.commandPool = render_data.imgui_command_pool;
-    buffer_alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    buffer_alloc_info.commandBufferCount =
-        (uint32_t)render_data.imgui_buffers.size();
+  RenderWindow &primary_window() { return *windows[0]; }
 
-    CHECK_VK_ERRC(dispatch.allocateCommandBuffers(
-        &buffer_alloc_info, render_data.imgui_buffers.data()));
+  std::optional<size_t> window_index(GLFWwindow *window) {
+    for (size_t i = 0; i < windows.size(); i++)
+      if (windows[i]->window == window)
+        return i;
+    return std::nullopt;
   }
 
-  vkb::Result<vkb::Swapchain> create_swapchain(
-      std::optional<std::reference_wrapper<vkb::Swapchain>> old_swapchain =
-          std::nullopt) {
-    vkb::SwapchainBuilder swapchain_builder(device);
-    if (old_swapchain)
-      swapchain_builder.set_old_swapchain(*old_swapchain);
+  // Replaces the window's swapchain, if it has one. Once the render pass
+  // exists every new swapchain has to match its format.
+  VkResult create_swapchain(RenderWindow &target) {
+    vkb::SwapchainBuilder swapchain_builder(physical_device, device,
+                                            target.surface);
+    bool has_old_swapchain = target.swapchain.swapchain != VK_NULL_HANDLE;
+    if (has_old_swapchain)
+      swapchain_builder.set_old_swapchain(target.swapchain);
+    if (surface_format.format != VK_FORMAT_UNDEFINED)
+      swapchain_builder.set_desired_format(surface_format);
+    // Accumulated images are blitted in
+    swapchain_builder.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
     auto swap_ret = swapchain_builder.build();
-    if (old_swapchain)
-      vkb::destroy_swapchain(*old_swapchain);
-    return swap_ret;
+    if (!swap_ret)
+      PANIC("SWAPCHAIN CREATION FAILED");
+    target.swapchain = swap_ret.value();
+
+    if (surface_format.format == VK_FORMAT_UNDEFINED)
+      surface_format = {target.swapchain.image_format,
+                        target.swapchain.color_space};
+    else if (target.swapchain.image_format != surface_format.format)
+      PANIC("SWAPCHAIN FORMAT DIFFERS FROM THE OTHER WINDOWS");
+
+    return VK_SUCCESS;
   }
 
   VkResult create_queues() {
@@ -173,7 +376,7 @@ struct Renderer {
 
   VkResult create_render_pass() {
     VkAttachmentDescription color_attachment = {};
-    color_attachment.format = swapchain.image_format;
+    color_attachment.format = surface_format.format;
     color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
     color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
@@ -214,6 +417,13 @@ struct Renderer {
       PANIC("RENDERPASS CREATION FAILED");
     }
 
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    color_attachment.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependency.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    CHECK_VK_ERRC(dispatch.createRenderPass(&render_pass_info, nullptr,
+                                            &render_data.overlay_render_pass));
+
     return VK_SUCCESS;
   }
 
@@ -230,49 +440,154 @@ struct Renderer {
     return shader_module;
   }
 
-  VkShaderModule create_shader_module(std::vector<char> code) {
-    return create_shader_module((uint32_t *)code.data(), code.size());
+  VkShaderModule create_shader_module(std::span<const uint32_t> code) {
+    return create_shader_module(code.data(), code.size_bytes());
+  }
+
+  VkResult create_shader_modules() {
+    render_data.vertex_shader_module =
+        create_shader_module(builtins::vertex_shader_spirv);
+    return VK_SUCCESS;
   }
 
-  VkResult create_shader_modules(std::optional<std::vector<uint32_t>>
-                                     fragment_shader_code = std::nullopt) {
-    if (render_data.vertex_shader_module == VK_NULL_HANDLE) {
-      auto vertex_compilation_result =
-          shader_compiler.create_inline_vertex_shader_code();
-      CHECK_RESULT(vertex_compilation_result);
-      auto vertex_code = vertex_compilation_result.unwrap();
+  VkResult create_builtin_pipeline(VkShaderModule fragment_shader_module) {
+    PreparedShader builtin;
+    builtin.fragment_shader_module = fragment_shader_module;
+    builtin.graphics_pipeline = create_graphics_pipeline(
+        fragment_shader_module, render_data.pipeline_cache);
+    builtin.is_time_varying =
+        reads_time_varying_inputs(builtins::fragment_shader_spirv,
+                                  std::size(builtins::fragment_shader_spirv));
+    builtin.reads_audio =
+        reads_textures(builtins::fragment_shader_spirv,
+                       std::size(builtins::fragment_shader_spirv));
+
+    _store_prepared_shader(builtins::fragment_shader_filename, builtin);
+    for (auto &window : windows)
+      window->shader = builtins::fragment_shader_filename;
+    request_redraw();
+    return VK_SUCCESS;
+  }
 
-      render_data.vertex_shader_module = create_shader_module(
-          vertex_code.data(), vertex_code.size() * sizeof(uint32_t));
+  // Runs `recipe` over freshly compiled code, recording what the module
+  // looked like before and after. Safe to call from worker threads.
+  auto optimize_shader(std::vector<uint32_t> code, OptimizerRecipe recipe,
+                       ShaderStatistics &statistics) -> CompilationResult {
+    statistics = {module_statistics(code)};
+    if (recipe == OptimizerRecipe::None)
+      return code;
+
+    auto optimized = optimize_spirv(code, recipe);
+    TRY(optimized);
+    statistics.optimized = module_statistics(optimized.unwrap());
+    return optimized;
+  }
+
+  // Blocks until the compiler that was being set up during bootstrap is ready.
+  Compiler &shader_compiler() { return *_compiler.get(); }
+
+  // Arrays are bindless: partially bound and updated after binding, so a
+  // slot that no frame in flight reads can be written at any time.
+  VkDescriptorSetLayout _create_set_layout(uint32_t set) {
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    std::vector<VkDescriptorBindingFlags> binding_flags;
+    bool is_bindless = false;
+    for (auto &provided : SHADER_INTERFACE) {
+      if (provided.set != set)
+        continue;
+
+      VkDescriptorSetLayoutBinding binding = {};
+      binding.binding = provided.binding;
+      binding.descriptorType = descriptor_type(provided.kind);
+      binding.descriptorCount = provided.count;
+      binding.stageFlags = SHADER_STAGES;
+      bindings.push_back(binding);
+
+      VkDescriptorBindingFlags flags = 0;
+      if (provided.count > 1) {
+        flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+        is_bindless = true;
+      }
+      binding_flags.push_back(flags);
     }
 
-    dispatch.destroyShaderModule(render_data.fragment_shader_module, nullptr);
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {};
+    flags_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flags_info.bindingCount = (uint32_t)binding_flags.size();
+    flags_info.pBindingFlags = binding_flags.data();
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+    set_layout_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_info.pNext = &flags_info;
+    if (is_bindless)
+      set_layout_info.flags =
+          VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    set_layout_info.bindingCount = (uint32_t)bindings.size();
+    set_layout_info.pBindings = bindings.data();
+
+    VkDescriptorSetLayout layout;
+    CHECK_VK_ERRC(
+        dispatch.createDescriptorSetLayout(&set_layout_info, nullptr, &layout));
+    return layout;
+  }
 
-    auto fragment_code =
-        fragment_shader_code.has_value()
-            ? fragment_shader_code.value()
-            : shader_compiler.create_inline_fragment_shader_code().unwrap();
+  VkResult create_pipeline_layout() {
+    for (uint32_t set = 0; set < SHADER_SET_COUNT; set++)
+      render_data.set_layouts[set] = _create_set_layout(set);
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount = SHADER_SET_COUNT;
+    pipeline_layout_info.pSetLayouts = render_data.set_layouts.data();
+
+    VkPushConstantRange push_constant_range = {};
+    push_constant_range.stageFlags = SHADER_STAGES;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(ShaderInputs);
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+    CHECK_VK_ERRC(dispatch.createPipelineLayout(&pipeline_layout_info, nullptr,
+                                                &render_data.pipeline_layout));
+    return VK_SUCCESS;
+  }
 
-    render_data.fragment_shader_module = create_shader_module(
-        fragment_code.data(), fragment_code.size() * sizeof(uint32_t));
+  VkResult create_pipeline_cache() {
+    VkPipelineCacheCreateInfo cache_info = {};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
 
+    CHECK_VK_ERRC(dispatch.createPipelineCache(&cache_info, nullptr,
+                                               &render_data.pipeline_cache));
     return VK_SUCCESS;
   }
 
-  VkResult create_graphics_pipeline() {
+  // Safe to call from several threads at once as long as each one passes its
+  // own `cache`, since pipeline caches are externally synchronized. An
+  // accumulating pipeline blends with the blend constants' alpha instead.
+  // With `stream`, draws its vertices with the stream's vertex shader instead
+  // of the full screen quad.
+  VkPipeline create_graphics_pipeline(VkShaderModule fragment_shader_module,
+                                      VkPipelineCache cache,
+                                      bool is_accumulating = false,
+                                      const VertexStream *stream = nullptr) {
     EXPECT(render_data.vertex_shader_module != VK_NULL_HANDLE);
-    EXPECT(render_data.fragment_shader_module != VK_NULL_HANDLE);
+    EXPECT(fragment_shader_module != VK_NULL_HANDLE);
 
     VkPipelineShaderStageCreateInfo vert_stage_info = {};
     vert_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     vert_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vert_stage_info.module = render_data.vertex_shader_module;
+    vert_stage_info.module = stream ? render_data.stream_vertex_module
+                                    : render_data.vertex_shader_module;
     vert_stage_info.pName = "main";
 
     VkPipelineShaderStageCreateInfo frag_stage_info = {};
     frag_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     frag_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    frag_stage_info.module = render_data.fragment_shader_module;
+    frag_stage_info.module = fragment_shader_module;
     frag_stage_info.pName = "main";
 
     VkPipelineShaderStageCreateInfo shader_stages[] = {vert_stage_info,
@@ -290,25 +605,35 @@ struct Renderer {
     input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
     input_assembly.primitiveRestartEnable = VK_FALSE;
 
-    VkViewport viewport = {};
-    viewport.x = 0.;
-    viewport.y = 0.;
-    viewport.width = swapchain.extent.width;
-    viewport.height = swapchain.extent.height;
-    viewport.minDepth = 0.;
-    viewport.maxDepth = 1.;
-
-    VkRect2D scissors = {};
-    scissors.offset = {0, 0};
-    scissors.extent = swapchain.extent;
+    VkVertexInputBindingDescription vertex_binding = {};
+    std::vector<VkVertexInputAttributeDescription> vertex_attributes;
+    if (stream) {
+      vertex_binding.binding = 0;
+      vertex_binding.stride = stream->layout.stride;
+      vertex_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+      for (auto &attribute : stream->layout.attributes) {
+        VkVertexInputAttributeDescription description = {};
+        description.location = attribute.location;
+        description.binding = 0;
+        description.format = describe_vertex_format(attribute.format)->format;
+        description.offset = attribute.offset;
+        vertex_attributes.push_back(description);
+      }
+      vertex_input_info.vertexBindingDescriptionCount = 1;
+      vertex_input_info.pVertexBindingDescriptions = &vertex_binding;
+      vertex_input_info.vertexAttributeDescriptionCount =
+          (uint32_t)vertex_attributes.size();
+      vertex_input_info.pVertexAttributeDescriptions =
+          vertex_attributes.data();
+      input_assembly.topology = stream->topology;
+    }
 
+    // Both are dynamic, the same pipeline draws into windows of any size
     VkPipelineViewportStateCreateInfo viewport_state = {};
     viewport_state.sType =
         VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewport_state.viewportCount = 1;
-    viewport_state.pViewports = &viewport;
     viewport_state.scissorCount = 1;
-    viewport_state.pScissors = &scissors;
 
     VkPipelineRasterizationStateCreateInfo rasterizer = {};
     rasterizer.sType =
@@ -317,7 +642,7 @@ struct Renderer {
     rasterizer.rasterizerDiscardEnable = VK_FALSE;
     rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
     rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.cullMode = stream ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
     rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
     rasterizer.depthBiasEnable = VK_FALSE;
 
@@ -332,6 +657,19 @@ struct Renderer {
         VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
         VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
     colorBlendAttachment.blendEnable = VK_FALSE;
+    if (is_accumulating) {
+      colorBlendAttachment.blendEnable = VK_TRUE;
+      colorBlendAttachment.srcColorBlendFactor =
+          VK_BLEND_FACTOR_CONSTANT_ALPHA;
+      colorBlendAttachment.dstColorBlendFactor =
+          VK_BLEND_FACTOR_ONE_MINUS_CONSTANT_ALPHA;
+      colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+      colorBlendAttachment.srcAlphaBlendFactor =
+          VK_BLEND_FACTOR_CONSTANT_ALPHA;
+      colorBlendAttachment.dstAlphaBlendFactor =
+          VK_BLEND_FACTOR_ONE_MINUS_CONSTANT_ALPHA;
+      colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    }
 
     VkPipelineColorBlendStateCreateInfo color_blending = {};
     color_blending.sType =
@@ -345,16 +683,10 @@ struct Renderer {
     color_blending.blendConstants[2] = 0.0f;
     color_blending.blendConstants[3] = 0.0f;
 
-    VkPipelineLayoutCreateInfo pipeline_layout_info = {};
-    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_info.setLayoutCount = 0;
-    pipeline_layout_info.pushConstantRangeCount = 0;
-
-    CHECK_VK_ERRC(dispatch.createPipelineLayout(&pipeline_layout_info, nullptr,
-                                                &render_data.pipeline_layout));
-
     std::vector<VkDynamicState> dynamic_states = {VK_DYNAMIC_STATE_VIEWPORT,
                                                   VK_DYNAMIC_STATE_SCISSOR};
+    if (is_accumulating)
+      dynamic_states.push_back(VK_DYNAMIC_STATE_BLEND_CONSTANTS);
 
     VkPipelineDynamicStateCreateInfo dynamic_info = {};
     dynamic_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
@@ -374,180 +706,1363 @@ struct Renderer {
     pipeline_info.pColorBlendState = &color_blending;
     pipeline_info.pDynamicState = &dynamic_info;
     pipeline_info.layout = render_data.pipeline_layout;
-    pipeline_info.renderPass = render_data.render_pass;
+    pipeline_info.renderPass = is_accumulating
+                                   ? render_data.accumulation_render_pass
+                                   : render_data.render_pass;
     pipeline_info.subpass = 0;
     pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
 
-    CHECK_VK_ERRC(dispatch.createGraphicsPipelines(
-        VK_NULL_HANDLE, 1, &pipeline_info, nullptr,
-        &render_data.graphics_pipeline));
-    return VK_SUCCESS;
+    VkPipeline pipeline;
+    CHECK_VK_ERRC(dispatch.createGraphicsPipelines(cache, 1, &pipeline_info,
+                                                   nullptr, &pipeline));
+    return pipeline;
+  }
+
+  // `parameters` come from the code before it was optimized, which may strip
+  // the member names.
+  PreparedShader prepare_shader(std::span<const uint32_t> fragment_code,
+                                std::optional<UniformBlock> parameters,
+                                VkPipelineCache cache) {
+    PreparedShader prepared;
+    prepared.fragment_shader_module = create_shader_module(fragment_code);
+    prepared.graphics_pipeline =
+        create_graphics_pipeline(prepared.fragment_shader_module, cache);
+    prepared.is_time_varying =
+        reads_time_varying_inputs(fragment_code.data(), fragment_code.size());
+    prepared.reads_audio =
+        reads_textures(fragment_code.data(), fragment_code.size());
+    prepared.cost = estimate_shader_cost(fragment_code);
+    prepared.parameters = std::move(parameters);
+    if (prepared.parameters)
+      prepared.parameter_values.assign(prepared.parameters->size, 0);
+    return prepared;
+  }
+
+  std::optional<UniformBlock>
+  _reflect_parameters(std::span<const uint32_t> fragment_code) {
+    return reflect_uniform_block(fragment_code.data(), fragment_code.size(),
+                                 INPUT_SET, PARAMETER_BINDING);
+  }
+
+  // Members of the same name and type keep their values across reloads.
+  // Unnamed ones cannot be told apart and start at zero.
+  void _carry_parameters(const PreparedShader &from, PreparedShader &to) {
+    if (!from.parameters || !to.parameters)
+      return;
+    for (auto &member : to.parameters->members) {
+      if (member.name.empty())
+        continue;
+      auto &members = from.parameters->members;
+      auto old = std::find_if(members.begin(), members.end(), [&](auto &old) {
+        return old.name == member.name && old.kind == member.kind &&
+               old.component_count == member.component_count;
+      });
+      if (old != members.end())
+        memcpy(to.parameter_values.data() + member.offset,
+               from.parameter_values.data() + old->offset,
+               member.component_count * 4);
+    }
+  }
+
+  void destroy_prepared_shader(PreparedShader prepared) {
+    dispatch.destroyPipeline(prepared.graphics_pipeline, nullptr);
+    if (prepared.accumulation_pipeline != VK_NULL_HANDLE)
+      dispatch.destroyPipeline(prepared.accumulation_pipeline, nullptr);
+    if (prepared.vertex_pipeline != VK_NULL_HANDLE)
+      dispatch.destroyPipeline(prepared.vertex_pipeline, nullptr);
+    dispatch.destroyShaderModule(prepared.fragment_shader_module, nullptr);
+  }
+
+  auto prewarm_fragment_shaders(const std::vector<std::filesystem::path> &paths,
+                                ThreadPool &pool)
+      -> std::vector<PrewarmFailure> {
+    std::vector<ShaderVariant> variants;
+    for (auto &path : paths)
+      variants.push_back({path.string(), path, {}});
+    return prewarm_shader_variants(variants, pool);
+  }
+
+  // Compiles every variant and creates its pipeline on the pool. Each worker
+  // gets its own compiler and pipeline cache, the caches are merged into the
+  // main one afterwards. Variants compiled from the same source before reuse
+  // that.
+  auto prewarm_shader_variants(const std::vector<ShaderVariant> &variants,
+                               ThreadPool &pool)
+      -> std::vector<PrewarmFailure> {
+    TRACE_SCOPE("Renderer::prewarm_shader_variants");
+    EXPECT(!is_frame_in_progress);
+
+    std::vector<Compiler> compilers(pool.size());
+    std::vector<VkPipelineCache> caches(pool.size(), VK_NULL_HANDLE);
+
+    VkPipelineCacheCreateInfo cache_info = {};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    for (auto &cache : caches)
+      CHECK_VK_ERRC(dispatch.createPipelineCache(&cache_info, nullptr, &cache));
+
+    auto recipe = optimizer_recipe;
+    auto count = variants.size();
+    std::vector<std::optional<PreparedShader>> prepared(count);
+    std::vector<std::optional<CompilationError>> errors(count);
+    std::vector<std::string> sources(count);
+    std::vector<size_t> hashes(count);
+
+    for (size_t i = 0; i < count; i++) {
+      sources[i] = utils::read_file(variants[i].path.string().c_str());
+      hashes[i] =
+          shader_origin_hash(sources[i], variants[i].defines, recipe);
+      prepared[i] = _reusable_shader(variants[i].name, hashes[i], sources[i],
+                                     variants[i].defines);
+    }
+
+    pool.parallel_for(count, [&](size_t i) {
+      if (prepared[i])
+        return;
+      auto worker = ThreadPool::worker_index();
+      auto result = compile_shader_variant(variants[i], sources[i], recipe,
+                                           hashes[i], compilers[worker],
+                                           caches[worker]);
+      if (result)
+        prepared[i] = result.unwrap();
+      else
+        errors[i] = result.unwrap_err();
+    });
+
+    CHECK_VK_ERRC(dispatch.mergePipelineCaches(render_data.pipeline_cache,
+                                               (uint32_t)caches.size(),
+                                               caches.data()));
+    for (auto cache : caches)
+      dispatch.destroyPipelineCache(cache, nullptr);
+
+    std::vector<PrewarmFailure> failures;
+    for (size_t i = 0; i < count; i++) {
+      auto &name = variants[i].name;
+      if (prepared[i])
+        _store_prepared_shader(name, prepared[i].value());
+      else
+        failures.push_back({name, errors[i].value()});
+    }
+
+    request_redraw();
+    return failures;
+  }
+
+  // Compiles `source`, read from the variant's path, and creates its
+  // pipeline without touching anything shared. Safe to call from several
+  // threads at once as long as each one passes its own compiler and cache.
+  // `hash` is the origin hash of the source, defines and `recipe`.
+  auto compile_shader_variant(const ShaderVariant &variant,
+                              const std::string &source,
+                              OptimizerRecipe recipe, size_t hash,
+                              Compiler &compiler, VkPipelineCache cache)
+      -> Result<PreparedShader, CompilationError> {
+    auto filename = variant.path.string();
+    ShaderStatistics statistics;
+    std::optional<UniformBlock> parameters;
+    auto compilation_result = compiler.compile_fragment_shader(
+        filename.c_str(), source.c_str(), variant.defines);
+    if (compilation_result) {
+      parameters = _reflect_parameters(compilation_result.unwrap());
+      compilation_result =
+          optimize_shader(compilation_result.unwrap(), recipe, statistics);
+    }
+    if (compilation_result) {
+      auto interface_error = check_shader_interface(
+          filename.c_str(), compilation_result.unwrap());
+      if (interface_error)
+        compilation_result = interface_error.value();
+    }
+    if (!compilation_result)
+      return compilation_result.unwrap_err();
+
+    auto &code = compilation_result.unwrap();
+    auto prepared = prepare_shader(code, std::move(parameters), cache);
+    prepared.statistics = statistics;
+    prepared.origin = std::make_shared<ShaderOrigin>(ShaderOrigin{
+        hash, source, variant.defines, recipe, code});
+    return prepared;
+  }
+
+  // Takes ownership of `prepared`, compiled elsewhere, and stores it under
+  // `name` like any other shader.
+  void add_prepared_shader(const std::string &name, PreparedShader prepared) {
+    EXPECT(!is_frame_in_progress);
+    _store_prepared_shader(name, prepared);
+    request_redraw();
+  }
+
+  bool has_prepared_shader(const std::string &name) {
+    return prepared_shaders.contains(name);
+  }
+
+  void use_prepared_shader(const std::string &name, size_t window) {
+    EXPECT(!is_frame_in_progress);
+    EXPECT(prepared_shaders.contains(name));
+    windows.at(window)->shader = name;
+    reset_accumulation();
+    request_redraw();
+  }
+
+  // Switches `window` to the built-in latency test pattern, created the
+  // first time it is asked for.
+  void use_latency_test(size_t window) {
+    auto name = builtins::latency_shader_filename;
+    if (!prepared_shaders.contains(name)) {
+      PreparedShader latency;
+      latency.fragment_shader_module =
+          create_shader_module(builtins::latency_shader_spirv);
+      latency.graphics_pipeline = create_graphics_pipeline(
+          latency.fragment_shader_module, render_data.pipeline_cache);
+      latency.is_time_varying = true;
+      _store_prepared_shader(name, latency);
+    }
+    use_prepared_shader(name, window);
+  }
+
+  bool is_shader_shown(const std::string &name) {
+    return std::any_of(windows.begin(), windows.end(),
+                       [&](auto &window) { return window->shader == name; });
+  }
+
+  // Takes ownership of `prepared`. Whatever was stored under `name` before is
+  // kept as a recent shader, or destroyed once everything submitted so far
+  // has finished with it.
+  void _store_prepared_shader(const std::string &name,
+                              PreparedShader prepared) {
+    auto it = prepared_shaders.find(name);
+    if (it != prepared_shaders.end()) {
+      if (it->second.graphics_pipeline == prepared.graphics_pipeline)
+        return;
+      _carry_parameters(it->second, prepared);
+      _keep_recent_shader(it->second);
+    }
+    prepared_shaders[name] = prepared;
+    if (is_shader_shown(name))
+      reset_accumulation();
+  }
+
+  void _keep_recent_shader(PreparedShader prepared) {
+    if (prepared.origin)
+      recent_shaders.push_front(prepared);
+    else
+      _destroy_when_unused(prepared);
+    while (recent_shaders.size() > RECENT_SHADER_LIMIT) {
+      _destroy_when_unused(recent_shaders.back());
+      recent_shaders.pop_back();
+    }
+  }
+
+  void _destroy_when_unused(PreparedShader prepared) {
+    deferred.defer(render_data.timeline->submitted,
+                   [this, prepared]() { destroy_prepared_shader(prepared); });
+  }
+
+  // What `name` shows already or a recent shader, if either was compiled from
+  // exactly this. A recent shader is taken out of the recent ones.
+  auto _reusable_shader(const std::string &name, size_t hash,
+                        const std::string &source, const ShaderDefines &defines)
+      -> std::optional<PreparedShader> {
+    auto current = prepared_shaders.find(name);
+    if (current != prepared_shaders.end() && current->second.origin &&
+        current->second.origin->matches(hash, source, defines,
+                                        optimizer_recipe))
+      return current->second;
+
+    auto it = std::find_if(
+        recent_shaders.begin(), recent_shaders.end(), [&](auto &prepared) {
+          return prepared.origin->matches(hash, source, defines,
+                                          optimizer_recipe);
+        });
+    if (it == recent_shaders.end())
+      return std::nullopt;
+    auto prepared = *it;
+    recent_shaders.erase(it);
+    return prepared;
+  }
+
+  VkPipeline window_pipeline(const RenderWindow &target) {
+    return prepared_shaders.at(target.shader).graphics_pipeline;
   }
 
-  VkResult create_framebuffers() {
-    render_data.swapchain_images = swapchain.get_images().value();
-    render_data.swapchain_image_views = swapchain.get_image_views().value();
+  VkPipeline _accumulation_pipeline(const RenderWindow &target) {
+    auto &prepared = prepared_shaders.at(target.shader);
+    if (prepared.accumulation_pipeline == VK_NULL_HANDLE)
+      prepared.accumulation_pipeline =
+          create_graphics_pipeline(prepared.fragment_shader_module,
+                                   render_data.pipeline_cache, true);
+    return prepared.accumulation_pipeline;
+  }
 
-    render_data.framebuffers.resize(render_data.swapchain_image_views.size());
-    for (size_t i = 0; i < render_data.swapchain_image_views.size(); i++) {
-      VkImageView attachments[] = {render_data.swapchain_image_views[i]};
+  VkPipeline _vertex_pipeline(const RenderWindow &target) {
+    auto &prepared = prepared_shaders.at(target.shader);
+    if (prepared.vertex_pipeline == VK_NULL_HANDLE)
+      prepared.vertex_pipeline = create_graphics_pipeline(
+          prepared.fragment_shader_module, render_data.pipeline_cache, false,
+          vertices.get());
+    return prepared.vertex_pipeline;
+  }
+
+  bool _is_converged(const AccumulationTarget &target) {
+    return target.samples >= accumulation.sample_limit;
+  }
+
+  // Whether some window's output changes even when nothing else does.
+  bool is_animated() {
+    if (vertices && !vertices->is_uploaded())
+      return true;
+    return std::any_of(windows.begin(), windows.end(), [&](auto &window) {
+      if (window->accumulation)
+        return !_is_converged(window->accumulation.value());
+      auto &prepared = prepared_shaders.at(window->shader);
+      return prepared.is_time_varying ||
+             (is_audio_playing && prepared.reads_audio);
+    });
+  }
+
+  bool needs_redraw() { return pending_redraws > 0 || is_animated(); }
+
+  void request_redraw(uint32_t frames = 1) {
+    pending_redraws = std::max(pending_redraws, frames);
+  }
+
+  VkResult create_framebuffers(RenderWindow &target) {
+    target.swapchain_images = target.swapchain.get_images().value();
+    target.swapchain_image_views = target.swapchain.get_image_views().value();
+
+    target.framebuffers.resize(target.swapchain_image_views.size());
+    for (size_t i = 0; i < target.swapchain_image_views.size(); i++) {
+      VkImageView attachments[] = {target.swapchain_image_views[i]};
 
       VkFramebufferCreateInfo framebuffer_info = {};
       framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
       framebuffer_info.renderPass = render_data.render_pass;
       framebuffer_info.attachmentCount = 1;
       framebuffer_info.pAttachments = attachments;
-      framebuffer_info.width = swapchain.extent.width;
-      framebuffer_info.height = swapchain.extent.height;
+      framebuffer_info.width = target.swapchain.extent.width;
+      framebuffer_info.height = target.swapchain.extent.height;
       framebuffer_info.layers = 1;
 
       CHECK_VK_ERRC(dispatch.createFramebuffer(&framebuffer_info, nullptr,
-                                               &render_data.framebuffers[i]));
+                                               &target.framebuffers[i]));
     }
 
     return VK_SUCCESS;
   }
 
   VkResult create_sync_objects() {
-    render_data.available_semaphores.resize(MAXIMUM_FRAMES_IN_FLIGHT);
-    render_data.finished_semaphore.resize(MAXIMUM_FRAMES_IN_FLIGHT);
-    render_data.in_flight_fences.resize(MAXIMUM_FRAMES_IN_FLIGHT);
-    render_data.image_in_flight.resize(swapchain.image_count, VK_NULL_HANDLE);
+    render_data.timeline = std::make_unique<QueueTimeline>(dispatch);
+    return VK_SUCCESS;
+  }
+
+  // Records with `record` into a command buffer of its own and waits until
+  // the graphics queue has run it.
+  void submit_and_wait(std::function<void(VkCommandBuffer)> record) {
+    VkCommandBufferAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = render_data.command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+    VkCommandBuffer command_buffer;
+    CHECK_VK_ERRC(
+        dispatch.allocateCommandBuffers(&allocate_info, &command_buffer));
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK_ERRC(dispatch.beginCommandBuffer(command_buffer, &begin_info));
+    record(command_buffer);
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(command_buffer));
+
+    auto &timeline = *render_data.timeline;
+    TimelineSignal signal(1);
+    signal.values[0] = timeline.next();
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &timeline.semaphore;
+    signal.chain(submit_info);
+    CHECK_VK_ERRC(dispatch.queueSubmit(render_data.graphics_queue, 1,
+                                       &submit_info, VK_NULL_HANDLE));
+    timeline.wait(signal.values[0]);
+
+    dispatch.freeCommandBuffers(render_data.command_pool, 1, &command_buffer);
+  }
+
+  // One pool for the lifetime of the renderer holds every set in
+  // `SHADER_INTERFACE`. The audio texture starts out silent, the texture
+  // table empty.
+  VkResult create_descriptor_sets() {
+    std::vector<VkDescriptorPoolSize> pool_sizes;
+    for (auto &provided : SHADER_INTERFACE)
+      pool_sizes.push_back({descriptor_type(provided.kind), provided.count});
+
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    pool_info.maxSets = SHADER_SET_COUNT;
+    pool_info.poolSizeCount = (uint32_t)pool_sizes.size();
+    pool_info.pPoolSizes = pool_sizes.data();
+    CHECK_VK_ERRC(dispatch.createDescriptorPool(&pool_info, nullptr,
+                                                &render_data.descriptor_pool));
+
+    VkDescriptorSetAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocate_info.descriptorPool = render_data.descriptor_pool;
+    allocate_info.descriptorSetCount = SHADER_SET_COUNT;
+    allocate_info.pSetLayouts = render_data.set_layouts.data();
+    CHECK_VK_ERRC(dispatch.allocateDescriptorSets(&allocate_info,
+                                                  render_data.sets.data()));
+
+    audio = create_audio_texture(dispatch, physical_device.memory_properties,
+                                 MAXIMUM_FRAMES_IN_FLIGHT);
+
+    VkDescriptorImageInfo image_info = {};
+    image_info.sampler = audio.sampler;
+    image_info.imageView = audio.image.view;
+    image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = render_data.sets[INPUT_SET];
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &image_info;
+    dispatch.updateDescriptorSets(1, &write, 0, nullptr);
+
+    submit_and_wait([&](VkCommandBuffer command_buffer) {
+      record_audio_clear(dispatch, command_buffer, audio);
+    });
+
+    _create_input_latch(windows.size() + 1);
+    _create_parameter_ring(windows.size() + 1);
+
+    textures.set = render_data.sets[TEXTURE_SET];
+    textures.sampler = create_texture_sampler(dispatch);
+    return VK_SUCCESS;
+  }
+
+  void _create_input_latch(size_t window_capacity) {
+    input_latch = create_input_latch(
+        dispatch, physical_device.memory_properties,
+        physical_device.properties.limits.minUniformBufferOffsetAlignment,
+        MAXIMUM_FRAMES_IN_FLIGHT, window_capacity);
+
+    VkDescriptorBufferInfo buffer_info = {};
+    buffer_info.buffer = input_latch.buffer.buffer;
+    buffer_info.range = sizeof(LatchedInputs);
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = render_data.sets[INPUT_SET];
+    write.dstBinding = 1;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo = &buffer_info;
+    dispatch.updateDescriptorSets(1, &write, 0, nullptr);
+  }
+
+  void _create_parameter_ring(size_t window_capacity) {
+    parameter_ring = create_parameter_ring(
+        dispatch, physical_device.memory_properties,
+        physical_device.properties.limits.minUniformBufferOffsetAlignment,
+        MAXIMUM_FRAMES_IN_FLIGHT, window_capacity);
+
+    VkDescriptorBufferInfo buffer_info = {};
+    buffer_info.buffer = parameter_ring.buffer.buffer;
+    buffer_info.range = PARAMETER_BLOCK_SIZE;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = render_data.sets[INPUT_SET];
+    write.dstBinding = PARAMETER_BINDING;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo = &buffer_info;
+    dispatch.updateDescriptorSets(1, &write, 0, nullptr);
+  }
+
+  // Grows the latch and the parameter ring to fit `window_count` windows and
+  // the mirror column. The descriptors are not updated after binding, so
+  // nothing submitted may still use them.
+  void _reserve_input_slots(size_t window_count) {
+    if (window_count + 1 <= input_latch.window_capacity)
+      return;
+    render_data.timeline->wait(render_data.timeline->submitted);
+    destroy_input_latch(dispatch, input_latch);
+    destroy_parameter_ring(dispatch, parameter_ring);
+    _create_input_latch((window_count + 1) * 2);
+    _create_parameter_ring((window_count + 1) * 2);
+  }
+
+  // The last column of the latch and the parameter ring, past every window.
+  size_t _mirror_column() { return input_latch.window_capacity - 1; }
+
+  // Writes what the primary window was last drawn with into the mirror column
+  // of frame `slot`, to draw it again offscreen. Nothing submitted may still
+  // read that slot.
+  DynamicOffsets mirror_primary_window(size_t slot) {
+    auto &primary = primary_window();
+    auto column = _mirror_column();
+    auto &values = prepared_shaders.at(primary.shader).parameter_values;
+    write_input_latch(input_latch, slot, column, primary.latched_inputs);
+    write_parameters(parameter_ring, slot, column, values);
+    return {input_latch_offset(input_latch, slot, column),
+            parameter_ring_offset(parameter_ring, slot, column)};
+  }
+
+  // Writes the parameters of the window's shader into its slot of this frame
+  // too, nothing submitted before reads that slot anymore.
+  DynamicOffsets _dynamic_offsets(const RenderWindow &target) {
+    auto index = window_index(target.window).value();
+    auto slot = render_data.current_frame;
+    auto &values = prepared_shaders.at(target.shader).parameter_values;
+    write_parameters(parameter_ring, slot, index, values);
+    return {input_latch_offset(input_latch, slot, index),
+            parameter_ring_offset(parameter_ring, slot, index)};
+  }
+
+  // Where the cursor was as events were polled, to compare the latched
+  // position against.
+  void mark_inputs_polled() {
+    inputs_polled_at = delta_clock.now();
+    for (auto &window : windows)
+      cursor_in_pixels(window->window, window->swapchain.extent,
+                       window->latched_inputs.polled_mouse);
+  }
+
+  // Reads input once more for every window that is about to be submitted.
+  void _latch_inputs(const std::vector<RenderWindow *> &targets) {
+    TRACE_SCOPE("Renderer::latch_inputs");
+    for (auto target : targets) {
+      auto &inputs = target->latched_inputs;
+      if (scripted_inputs && target == windows[0].get())
+        inputs = scripted_inputs.value();
+      else
+        latch_window_inputs(target->window, target->swapchain.extent, inputs);
+      write_input_latch(input_latch, render_data.current_frame,
+                        window_index(target->window).value(), inputs);
+    }
+
+    using namespace std::chrono;
+    auto gain = delta_clock.now() - inputs_polled_at;
+    double ms = duration<double, milliseconds::period>(gain).count();
+    if (latch_gain_ms)
+      ms = std::lerp(latch_gain_ms.value(), ms, LATCH_GAIN_SMOOTHING);
+    latch_gain_ms = ms;
+  }
+
+  // Puts the image at `path` into the texture table, or replaces the one
+  // already loaded from there, and returns its index.
+  auto load_texture(const std::filesystem::path &path, std::string &error)
+      -> std::optional<uint32_t> {
+    TRACE_SCOPE("Renderer::load_texture");
+    EXPECT(!is_frame_in_progress);
+    auto existing = textures.find(path);
+    if (!existing && textures.is_full()) {
+      error = "the texture table is full";
+      return std::nullopt;
+    }
+
+    VkExtent2D extent;
+    auto &props = physical_device.memory_properties;
+    auto staging = read_texture_file(dispatch, props, path, extent, error);
+    if (!staging)
+      return std::nullopt;
+
+    auto image = create_image(dispatch, props, VK_FORMAT_R8G8B8A8_UNORM,
+                              extent,
+                              VK_IMAGE_USAGE_SAMPLED_BIT |
+                                  VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    submit_and_wait([&](VkCommandBuffer command_buffer) {
+      record_image_upload(dispatch, command_buffer, image,
+                          staging->buffer, VK_IMAGE_LAYOUT_UNDEFINED);
+    });
+    destroy_buffer(dispatch, staging.value());
+
+    uint32_t index;
+    if (existing) {
+      // Frames in flight may still sample the slot, which rules out writing
+      // its descriptor before they are done
+      index = existing.value();
+      render_data.timeline->wait(render_data.timeline->submitted);
+      destroy_image(dispatch, textures.textures[index].image);
+      textures.textures[index].image = image;
+    } else {
+      index = (uint32_t)textures.textures.size();
+      textures.textures.push_back({path, image});
+    }
+    write_texture_descriptor(dispatch, textures, index);
+
+    request_redraw();
+    return index;
+  }
+
+  // Prints why the first one that cannot be loaded failed.
+  bool load_textures(const std::vector<std::filesystem::path> &paths) {
+    for (auto &path : paths) {
+      std::string error;
+      if (!load_texture(path, error)) {
+        std::cerr << "retort: " << error << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Takes the latest analysis of the audio being played, uploaded with the
+  // frame in progress. A frame that draws nothing drops it, the next analysis
+  // is never far behind.
+  void update_audio(const AudioFrame &frame) {
+    EXPECT(is_frame_in_progress);
+    write_audio_frame(audio, render_data.current_frame, frame);
+    _has_audio_upload = true;
+  }
+
+  VkResult create_window_sync_objects(RenderWindow &target) {
+    target.available_semaphores.resize(MAXIMUM_FRAMES_IN_FLIGHT);
+    target.finished_semaphore.resize(MAXIMUM_FRAMES_IN_FLIGHT);
+    target.image_in_flight.assign(target.swapchain.image_count, 0);
 
     VkSemaphoreCreateInfo semaphore_info = {};
     semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    VkFenceCreateInfo fence_info = {};
-    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
     for (size_t i = 0; i < MAXIMUM_FRAMES_IN_FLIGHT; i++) {
       CHECK_VK_ERRC(dispatch.createSemaphore(
-          &semaphore_info, nullptr, &render_data.available_semaphores[i]));
-      CHECK_VK_ERRC(dispatch.createSemaphore(
-          &semaphore_info, nullptr, &render_data.finished_semaphore[i]));
-      CHECK_VK_ERRC(dispatch.createFence(&fence_info, nullptr,
-                                         &render_data.in_flight_fences[i]));
+          &semaphore_info, nullptr, &target.available_semaphores[i]));
+      CHECK_VK_ERRC(dispatch.createSemaphore(&semaphore_info, nullptr,
+                                             &target.finished_semaphore[i]));
     }
 
+    target.timestamp_shaders.assign(MAXIMUM_FRAMES_IN_FLIGHT, std::nullopt);
+    if (timestamp_period_ns > 0.) {
+      VkQueryPoolCreateInfo query_info = {};
+      query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+      query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+      query_info.queryCount = (uint32_t)MAXIMUM_FRAMES_IN_FLIGHT * 2;
+      CHECK_VK_ERRC(dispatch.createQueryPool(&query_info, nullptr,
+                                             &target.timestamp_pool));
+    }
+
+    return VK_SUCCESS;
+  }
+
+  VkResult create_timestamp_support() {
+    auto family = device.get_queue_index(vkb::QueueType::graphics).value();
+    auto families = physical_device.get_queue_families();
+    auto valid_bits = families[family].timestampValidBits;
+    if (valid_bits > 0)
+      timestamp_period_ns = physical_device.properties.limits.timestampPeriod;
+    timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
     return VK_SUCCESS;
   }
 
+  // Between two timestamps of the graphics queue, also when the counter
+  // wrapped around in between.
+  double timestamp_ms(uint64_t begin, uint64_t end) const {
+    auto ticks = ((end & timestamp_mask) - (begin & timestamp_mask)) &
+                 timestamp_mask;
+    return ticks * timestamp_period_ns / 1e6;
+  }
+
+  // Folds the shader pass timings of the frame slot that just finished into
+  // the shaders they measured.
+  void _read_timestamps() {
+    auto slot = render_data.current_frame;
+    for (auto &window : windows) {
+      auto &shader = window->timestamp_shaders[slot];
+      if (!shader)
+        continue;
+
+      uint64_t timestamps[2];
+      auto result = dispatch.getQueryPoolResults(
+          window->timestamp_pool, (uint32_t)slot * 2, 2, sizeof(timestamps),
+          timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+      auto it = prepared_shaders.find(shader.value());
+      shader.reset();
+      if (result != VK_SUCCESS || it == prepared_shaders.end())
+        continue;
+
+      double ms = timestamp_ms(timestamps[0], timestamps[1]);
+      if (window->accumulation) {
+        auto &accumulating = window->accumulation.value();
+        auto tiles = accumulating.slot_tiles[slot];
+        if (tiles == 0)
+          continue;
+        auto ms_per_tile = ms / tiles;
+        if (accumulating.ms_per_tile > 0.)
+          ms_per_tile = std::lerp(accumulating.ms_per_tile, ms_per_tile,
+                                  TILE_TIME_SMOOTHING);
+        accumulating.ms_per_tile = ms_per_tile;
+        continue;
+      }
+
+      auto &gpu_time_ms = it->second.gpu_time_ms;
+      if (gpu_time_ms)
+        ms = std::lerp(gpu_time_ms.value(), ms, GPU_TIME_SMOOTHING);
+      gpu_time_ms = ms;
+    }
+  }
+
   VkResult create_command_pool() {
     VkCommandPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     pool_info.queueFamilyIndex =
         device.get_queue_index(vkb::QueueType::graphics).value();
 
     CHECK_VK_ERRC(dispatch.createCommandPool(&pool_info, nullptr,
                                              &render_data.command_pool));
+
+    VkCommandBufferAllocateInfo allocate_info = {};
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.commandPool = render_data.command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = (uint32_t)MAXIMUM_FRAMES_IN_FLIGHT;
+    CHECK_VK_ERRC(dispatch.allocateCommandBuffers(
+        &allocate_info, render_data.frame_command_buffers.data()));
+
+    recording = std::make_unique<RecordingScheduler>(
+        dispatch, pool_info.queueFamilyIndex, MAXIMUM_FRAMES_IN_FLIGHT);
     return VK_SUCCESS;
   }
 
-  VkResult create_command_buffers() {
-    render_data.imgui_buffers.resize(render_data.framebuffers.size());
-    render_data.command_buffers.resize(render_data.framebuffers.size());
+  void _create_accumulation_target(RenderWindow &target) {
+    target.accumulation = create_accumulation_target(
+        dispatch, physical_device.memory_properties,
+        render_data.accumulation_render_pass, render_data.accumulation_format,
+        target.swapchain.extent, MAXIMUM_FRAMES_IN_FLIGHT);
+    reset_accumulation_target(target.accumulation.value(), (float)time);
+  }
 
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = render_data.command_pool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (uint32_t)render_data.command_buffers.size();
+  // Once everything submitted so far is done with it.
+  void _destroy_accumulation_target(RenderWindow &target) {
+    if (!target.accumulation)
+      return;
+    auto old = target.accumulation.value();
+    target.accumulation.reset();
+    deferred.defer(render_data.timeline->submitted, [this, old]() mutable {
+      destroy_accumulation_target(dispatch, old);
+    });
+  }
 
-    CHECK_VK_ERRC(dispatch.allocateCommandBuffers(
-        &allocInfo, render_data.command_buffers.data()));
+  // Draws the vertices in the file at `path` in every window, with the
+  // vertex shader at `shader_path` and the window's shader as the fragment
+  // shader, instead of the full screen quad.
+  bool set_vertex_stream(const std::filesystem::path &path,
+                         const std::filesystem::path &shader_path,
+                         VkPrimitiveTopology topology, std::string &error) {
+    EXPECT(!is_frame_in_progress);
+    EXPECT(!vertices);
+    vertices = std::make_unique<VertexStream>(
+        dispatch, *render_data.timeline, physical_device.memory_properties,
+        topology);
+    if (!vertices->open(path, error) ||
+        !load_vertex_shader(shader_path, error)) {
+      vertices.reset();
+      return false;
+    }
+    return true;
+  }
 
-    for (size_t i = 0; i < render_data.command_buffers.size(); i++) {
-      VkCommandBufferBeginInfo begin_info = {};
-      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  // Compiles the vertex shader of the vertex stream and checks its inputs
+  // against the vertex file. Pipelines are created with it as they are drawn.
+  bool load_vertex_shader(const std::filesystem::path &path,
+                          std::string &error) {
+    TRACE_SCOPE("Renderer::load_vertex_shader");
+    EXPECT(!is_frame_in_progress);
+    EXPECT(vertices);
+    auto filename = path.string();
+    auto source = utils::read_file(filename.c_str());
+    auto result = shader_compiler().compile_vertex_shader(filename.c_str(),
+                                                          source.c_str());
+    if (!result) {
+      error = result.unwrap_err().messages;
+      return false;
+    }
+    auto code = std::move(result.unwrap());
+    if (auto interface_error = check_shader_interface(filename.c_str(), code)) {
+      error = interface_error->messages;
+      return false;
+    }
+    auto inputs = reflect_shader_inputs(code.data(), code.size());
+    if (auto mismatch = check_vertex_inputs(vertices->layout, inputs)) {
+      error = filename + ": " + mismatch.value();
+      return false;
+    }
 
-      CHECK_VK_ERRC(dispatch.beginCommandBuffer(render_data.command_buffers[i],
-                                                &begin_info));
+    std::vector<VkPipeline> old_pipelines;
+    auto drop_vertex_pipeline = [&](PreparedShader &prepared) {
+      if (prepared.vertex_pipeline == VK_NULL_HANDLE)
+        return;
+      old_pipelines.push_back(prepared.vertex_pipeline);
+      prepared.vertex_pipeline = VK_NULL_HANDLE;
+    };
+    for (auto &[_, prepared] : prepared_shaders)
+      drop_vertex_pipeline(prepared);
+    for (auto &prepared : recent_shaders)
+      drop_vertex_pipeline(prepared);
+    auto old_module = render_data.stream_vertex_module;
+    deferred.defer(render_data.timeline->submitted, [=, this]() {
+      for (auto pipeline : old_pipelines)
+        dispatch.destroyPipeline(pipeline, nullptr);
+      if (old_module != VK_NULL_HANDLE)
+        dispatch.destroyShaderModule(old_module, nullptr);
+    });
+
+    render_data.stream_vertex_module = create_shader_module(code);
+    request_redraw();
+    return true;
+  }
 
-      VkRenderPassBeginInfo render_pass_info = {};
-      render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-      render_pass_info.renderPass = render_data.render_pass;
-      render_pass_info.framebuffer = render_data.framebuffers[i];
-      render_pass_info.renderArea.offset = {0, 0};
-      render_pass_info.renderArea.extent = swapchain.extent;
-      VkClearValue clearColor{{{0.0f, 0.0f, 0.0f, 1.0f}}};
-      render_pass_info.clearValueCount = 1;
-      render_pass_info.pClearValues = &clearColor;
+  // Turns accumulation on or off for every window, or changes its settings.
+  // Either way it starts over. Vertex streams are drawn as they are, there is
+  // no full screen sample to average.
+  void set_accumulation(const AccumulationSettings &settings) {
+    EXPECT(!is_frame_in_progress);
+    if (vertices && settings.is_enabled)
+      return;
+    if (settings.is_enabled &&
+        render_data.accumulation_render_pass == VK_NULL_HANDLE) {
+      render_data.accumulation_format =
+          pick_accumulation_format(physical_device);
+      render_data.accumulation_render_pass = create_accumulation_render_pass(
+          dispatch, render_data.accumulation_format);
+    }
 
-      VkViewport viewport = {};
-      viewport.x = 0.0f;
-      viewport.y = 0.0f;
-      viewport.width = (float)swapchain.extent.width;
-      viewport.height = (float)swapchain.extent.height;
-      viewport.minDepth = 0.0f;
-      viewport.maxDepth = 1.0f;
+    accumulation = settings;
+    for (auto &window : windows) {
+      if (settings.is_enabled && !window->accumulation)
+        _create_accumulation_target(*window);
+      else if (!settings.is_enabled)
+        _destroy_accumulation_target(*window);
+    }
+    reset_accumulation();
+  }
 
-      VkRect2D scissor = {};
-      scissor.offset = {0, 0};
-      scissor.extent = swapchain.extent;
+  void reset_accumulation() {
+    for (auto &window : windows)
+      if (window->accumulation)
+        reset_accumulation_target(window->accumulation.value(), (float)time);
+    request_redraw();
+  }
 
-      dispatch.cmdSetViewport(render_data.command_buffers[i], 0, 1, &viewport);
-      dispatch.cmdSetScissor(render_data.command_buffers[i], 0, 1, &scissor);
+  void _destroy_swapchain_resources(RenderWindow &target) {
+    for (auto framebuffer : target.framebuffers)
+      dispatch.destroyFramebuffer(framebuffer, nullptr);
 
-      dispatch.cmdBeginRenderPass(render_data.command_buffers[i],
-                                  &render_pass_info,
-                                  VK_SUBPASS_CONTENTS_INLINE);
+    target.swapchain.destroy_image_views(target.swapchain_image_views);
+  }
 
-      dispatch.cmdBindPipeline(render_data.command_buffers[i],
-                               VK_PIPELINE_BIND_POINT_GRAPHICS,
-                               render_data.graphics_pipeline);
+  // Creates what `target` needs for drawing once it has a swapchain.
+  void _create_window_resources(RenderWindow &target) {
+    CHECK_VK_ERRC(create_framebuffers(target));
+    CHECK_VK_ERRC(create_window_sync_objects(target));
+    if (accumulation.is_enabled)
+      _create_accumulation_target(target);
+  }
+
+  // Opens another window showing `shader`, sharing the device, pipelines and
+  // command pools with all others.
+  RenderWindow &create_window(const std::string &shader) {
+    EXPECT(!is_frame_in_progress);
+    EXPECT(prepared_shaders.contains(shader));
+
+    auto target = std::make_unique<RenderWindow>();
+    target->shader = shader;
+    target->window = glfwCreateWindow(640, 480, "Retort", NULL, NULL);
+    EXPECT(target->window != nullptr);
+    CHECK_VK_ERRC(glfwCreateWindowSurface(instance, target->window, nullptr,
+                                          &target->surface));
+
+    // All presents go through the present queue picked for the first surface
+    VkBool32 is_supported = VK_FALSE;
+    CHECK_VK_ERRC(vkGetPhysicalDeviceSurfaceSupportKHR(
+        physical_device,
+        device.get_queue_index(vkb::QueueType::present).value(),
+        target->surface, &is_supported));
+    if (!is_supported)
+      PANIC("PRESENT QUEUE CANNOT PRESENT TO THE NEW WINDOW");
+
+    CHECK_VK_ERRC(create_swapchain(*target));
+    _create_window_resources(*target);
+
+    windows.push_back(std::move(target));
+    _reserve_input_slots(windows.size());
+    request_redraw();
+    update_window_title();
+    return *windows.back();
+  }
 
-      dispatch.cmdDraw(render_data.command_buffers[i], 4, 1, 0, 0);
+  void close_window(size_t index) {
+    EXPECT(!is_frame_in_progress);
+    EXPECT(index > 0 && index < windows.size());
+    CHECK_VK_ERRC(dispatch.deviceWaitIdle());
 
-      dispatch.cmdEndRenderPass(render_data.command_buffers[i]);
+    // A retired swapchain must not outlive its surface
+    for (auto &retired : retired_swapchains)
+      retired.destroy();
+    retired_swapchains.clear();
 
-      CHECK_VK_ERRC(dispatch.endCommandBuffer(render_data.command_buffers[i]));
+    auto &target = *windows[index];
+    _destroy_swapchain_resources(target);
+    for (size_t i = 0; i < MAXIMUM_FRAMES_IN_FLIGHT; i++) {
+      dispatch.destroySemaphore(target.available_semaphores[i], nullptr);
+      dispatch.destroySemaphore(target.finished_semaphore[i], nullptr);
     }
-    return VK_SUCCESS;
+    if (target.timestamp_pool != VK_NULL_HANDLE)
+      dispatch.destroyQueryPool(target.timestamp_pool, nullptr);
+    if (target.accumulation)
+      destroy_accumulation_target(dispatch, target.accumulation.value());
+    vkb::destroy_swapchain(target.swapchain);
+    vkb::destroy_surface(instance, target.surface);
+    glfwDestroyWindow(target.window);
+
+    windows.erase(windows.begin() + index);
+    if (focused_window >= windows.size())
+      focused_window = 0;
+    update_window_title();
+  }
+
+  ShaderInputs shader_inputs(VkExtent2D extent) {
+    ShaderInputs inputs = {};
+    inputs.resolution[0] = (float)extent.width;
+    inputs.resolution[1] = (float)extent.height;
+    inputs.time = (float)time;
+    inputs.delta_time = (float)dt;
+    inputs.frame = frame_count;
+    return inputs;
   }
 
-  VkResult recreate_swapchain() {
-    dispatch.deviceWaitIdle();
-    dispatch.destroyCommandPool(render_data.command_pool, nullptr);
+  // Records the render pass drawing the active shader into `framebuffer`.
+  void record_shader_pass(VkCommandBuffer command_buffer, VkPipeline pipeline,
+                          VkRenderPass render_pass, VkFramebuffer framebuffer,
+                          VkExtent2D extent, const ShaderInputs &inputs,
+                          DynamicOffsets offsets = {}) {
+    VkRenderPassBeginInfo render_pass_info = {};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_info.renderPass = render_pass;
+    render_pass_info.framebuffer = framebuffer;
+    render_pass_info.renderArea.offset = {0, 0};
+    render_pass_info.renderArea.extent = extent;
+    VkClearValue clearColor{{{0.0f, 0.0f, 0.0f, 1.0f}}};
+    render_pass_info.clearValueCount = 1;
+    render_pass_info.pClearValues = &clearColor;
+
+    dispatch.cmdBeginRenderPass(command_buffer, &render_pass_info,
+                                VK_SUBPASS_CONTENTS_INLINE);
+    record_shader_draw(command_buffer, pipeline, extent, inputs, offsets);
+    dispatch.cmdEndRenderPass(command_buffer);
+  }
 
-    for (auto framebuffer : render_data.framebuffers) {
-      dispatch.destroyFramebuffer(framebuffer, nullptr);
+  // Draws the shader inside a render pass that is already running.
+  // `offsets` pick the input latch and parameter slots, the default ones are
+  // empty.
+  void record_shader_draw(VkCommandBuffer command_buffer, VkPipeline pipeline,
+                          VkExtent2D extent, const ShaderInputs &inputs,
+                          DynamicOffsets offsets = {}) {
+    _record_shader_state(command_buffer, pipeline, extent, inputs, offsets);
+    dispatch.cmdDraw(command_buffer, 4, 1, 0, 0);
+  }
+
+  void _record_vertex_draws(VkCommandBuffer command_buffer,
+                            VkPipeline pipeline, VkExtent2D extent,
+                            const ShaderInputs &inputs, DynamicOffsets offsets,
+                            const std::vector<VertexDraw> &draws) {
+    _record_shader_state(command_buffer, pipeline, extent, inputs, offsets);
+    for (auto &draw : draws) {
+      VkDeviceSize offset = 0;
+      dispatch.cmdBindVertexBuffers(command_buffer, 0, 1, &draw.buffer,
+                                    &offset);
+      dispatch.cmdDraw(command_buffer, draw.vertex_count, 1, 0, 0);
     }
+  }
 
-    swapchain.destroy_image_views(render_data.swapchain_image_views);
+  void _record_shader_state(VkCommandBuffer command_buffer,
+                            VkPipeline pipeline, VkExtent2D extent,
+                            const ShaderInputs &inputs,
+                            DynamicOffsets offsets) {
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)extent.width;
+    viewport.height = (float)extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor = {};
+    scissor.offset = {0, 0};
+    scissor.extent = extent;
+
+    dispatch.cmdSetViewport(command_buffer, 0, 1, &viewport);
+    dispatch.cmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    dispatch.cmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                             pipeline);
+    dispatch.cmdBindDescriptorSets(command_buffer,
+                                   VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                   render_data.pipeline_layout, 0,
+                                   SHADER_SET_COUNT, render_data.sets.data(),
+                                   (uint32_t)offsets.size(), offsets.data());
+    dispatch.cmdPushConstants(command_buffer, render_data.pipeline_layout,
+                              SHADER_STAGES, 0, sizeof(ShaderInputs), &inputs);
+  }
 
-    this->swapchain = create_swapchain(swapchain).value();
-    CHECK_VK_ERRC(create_framebuffers());
-    CHECK_VK_ERRC(create_command_pool());
-    CHECK_VK_ERRC(create_command_buffers());
+  // Draws the window's shader between the two timestamps that measure it.
+  // Everything the recording needs is captured here, on the main thread.
+  SecondaryPass _shader_pass(RenderWindow &target) {
+    SecondaryPass pass;
+    pass.render_pass = render_data.render_pass;
+    pass.framebuffer = target.framebuffers[target.image_index];
+
+    auto query_pool = target.timestamp_pool;
+    auto first_query = (uint32_t)render_data.current_frame * 2;
+    if (query_pool != VK_NULL_HANDLE)
+      target.timestamp_shaders[render_data.current_frame] = target.shader;
+
+    auto extent = target.swapchain.extent;
+    if (target.accumulation)
+      return _accumulation_pass(target, pass, first_query);
+
+    auto pipeline =
+        vertices ? _vertex_pipeline(target) : window_pipeline(target);
+    auto inputs = shader_inputs(extent);
+    auto offsets = _dynamic_offsets(target);
+    bool is_streaming = vertices != nullptr;
+    std::vector<VertexDraw> draws;
+    if (is_streaming)
+      draws = vertices->draws();
+    pass.record = [=, this](VkCommandBuffer command_buffer) {
+      if (query_pool != VK_NULL_HANDLE)
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                   query_pool, first_query);
+      if (is_streaming)
+        _record_vertex_draws(command_buffer, pipeline, extent, inputs,
+                             offsets, draws);
+      else
+        record_shader_draw(command_buffer, pipeline, extent, inputs, offsets);
+      if (query_pool != VK_NULL_HANDLE)
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                   query_pool, first_query + 1);
+    };
+    return pass;
+  }
+
+  // Blends the next sample into the window's accumulation target, only as
+  // many tiles of it as fit the budget when there is one.
+  SecondaryPass _accumulation_pass(RenderWindow &target, SecondaryPass pass,
+                                   uint32_t first_query) {
+    auto &accumulating = target.accumulation.value();
+    pass.render_pass = render_data.accumulation_render_pass;
+    pass.framebuffer = accumulating.framebuffer;
+
+    auto extent = target.swapchain.extent;
+    auto tile_count = accumulation_tile_count(extent);
+    auto is_converged = _is_converged(accumulating);
+    std::vector<VkRect2D> tiles;
+    if (!is_converged && accumulation.tile_budget_ms) {
+      auto remaining = tile_count - accumulating.next_tile;
+      uint32_t fitting = 1;
+      if (accumulating.ms_per_tile > 0.)
+        fitting = (uint32_t)(accumulation.tile_budget_ms.value() /
+                             accumulating.ms_per_tile);
+      fitting = std::clamp(fitting, 1u, remaining);
+      for (uint32_t i = 0; i < fitting; i++)
+        tiles.push_back(
+            accumulation_tile(extent, accumulating.next_tile + i));
+    } else if (!is_converged) {
+      tiles.push_back({{0, 0}, extent});
+    }
+
+    auto inputs = shader_inputs(extent);
+    inputs.time = accumulating.time;
+    inputs.delta_time = 0.f;
+    inputs.frame = accumulating.samples;
+    float weight = 1.f / (float)(accumulating.samples + 1);
+
+    // Nothing drawn leaves nothing to time, the per tile estimate stays put
+    accumulating.slot_tiles[render_data.current_frame] =
+        tiles.empty() || accumulation.tile_budget_ms ? (uint32_t)tiles.size()
+                                                     : tile_count;
+    if (!tiles.empty()) {
+      accumulating.next_tile += (uint32_t)tiles.size();
+      if (!accumulation.tile_budget_ms ||
+          accumulating.next_tile >= tile_count) {
+        accumulating.next_tile = 0;
+        accumulating.samples++;
+      }
+    }
+
+    auto query_pool = target.timestamp_pool;
+    auto offsets = _dynamic_offsets(target);
+    auto pipeline =
+        tiles.empty() ? VK_NULL_HANDLE : _accumulation_pipeline(target);
+    pass.record = [=, this](VkCommandBuffer command_buffer) {
+      if (query_pool != VK_NULL_HANDLE)
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                   query_pool, first_query);
+      if (!tiles.empty()) {
+        float constants[4] = {0.f, 0.f, 0.f, weight};
+        _record_shader_state(command_buffer, pipeline, extent, inputs,
+                             offsets);
+        dispatch.cmdSetBlendConstants(command_buffer, constants);
+        for (auto &tile : tiles) {
+          dispatch.cmdSetScissor(command_buffer, 0, 1, &tile);
+          dispatch.cmdDraw(command_buffer, 4, 1, 0, 0);
+        }
+      }
+      if (query_pool != VK_NULL_HANDLE)
+        dispatch.cmdWriteTimestamp(command_buffer,
+                                   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                                   query_pool, first_query + 1);
+    };
+    return pass;
+  }
+
+  SecondaryPass _imgui_pass(RenderWindow &target, ImDrawData *draw_data) {
+    SecondaryPass pass;
+    pass.render_pass = render_data.render_pass;
+    pass.framebuffer = target.framebuffers[target.image_index];
+    pass.record = [draw_data](VkCommandBuffer command_buffer) {
+      ImGui_ImplVulkan_RenderDrawData(draw_data, command_buffer);
+    };
+    return pass;
+  }
+
+  // The frame's primary command buffer: one render pass per window, running
+  // the secondaries in `passes[pass_offsets[i]..pass_offsets[i + 1]]`.
+  VkCommandBuffer
+  _record_frame_commands(const std::vector<RenderWindow *> &targets,
+                         const std::vector<SecondaryPass> &passes,
+                         const std::vector<size_t> &pass_offsets) {
+    TRACE_SCOPE("Renderer::record_frame_commands");
+    auto command_buffer =
+        render_data.frame_command_buffers[render_data.current_frame];
+    CHECK_VK_ERRC(dispatch.resetCommandBuffer(command_buffer, 0));
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK_ERRC(dispatch.beginCommandBuffer(command_buffer, &begin_info));
+
+    if (_has_audio_upload)
+      record_audio_upload(dispatch, command_buffer, audio,
+                          render_data.current_frame);
+    // Submitted right after recording, with the next timeline value
+    if (vertices)
+      vertices->record_uploads(command_buffer,
+                               render_data.timeline->submitted + 1);
+    if (record_offscreen_passes)
+      record_offscreen_passes(command_buffer);
+
+    std::vector<VkCommandBuffer> secondaries;
+    for (size_t i = 0; i < targets.size(); i++) {
+      auto &target = *targets[i];
+      if (target.timestamp_pool != VK_NULL_HANDLE)
+        dispatch.cmdResetQueryPool(command_buffer, target.timestamp_pool,
+                                   (uint32_t)render_data.current_frame * 2,
+                                   2);
+
+      auto first = pass_offsets[i];
+      VkRenderPassBeginInfo render_pass_info = {};
+      render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+      render_pass_info.renderPass = render_data.render_pass;
+      render_pass_info.framebuffer = target.framebuffers[target.image_index];
+      render_pass_info.renderArea.extent = target.swapchain.extent;
+
+      // The shader draws into the accumulated image, which is then copied to
+      // the swapchain for everything else to draw over
+      if (target.accumulation) {
+        auto &accumulating = target.accumulation.value();
+        if (accumulating.needs_clear) {
+          record_accumulation_clear(dispatch, command_buffer, accumulating);
+          accumulating.needs_clear = false;
+        }
+
+        auto accumulation_pass_info = render_pass_info;
+        accumulation_pass_info.renderPass =
+            render_data.accumulation_render_pass;
+        accumulation_pass_info.framebuffer = accumulating.framebuffer;
+        dispatch.cmdBeginRenderPass(
+            command_buffer, &accumulation_pass_info,
+            VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        dispatch.cmdExecuteCommands(command_buffer, 1,
+                                    &passes[first].command_buffer);
+        dispatch.cmdEndRenderPass(command_buffer);
+
+        record_accumulation_blit(
+            dispatch, command_buffer, accumulating,
+            target.swapchain_images[target.image_index]);
+        render_pass_info.renderPass = render_data.overlay_render_pass;
+        first++;
+      }
+
+      dispatch.cmdBeginRenderPass(
+          command_buffer, &render_pass_info,
+          VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+      secondaries.clear();
+      for (size_t j = first; j < pass_offsets[i + 1]; j++)
+        secondaries.push_back(passes[j].command_buffer);
+      if (!secondaries.empty())
+        dispatch.cmdExecuteCommands(command_buffer,
+                                    (uint32_t)secondaries.size(),
+                                    secondaries.data());
+
+      dispatch.cmdEndRenderPass(command_buffer);
+    }
+
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(command_buffer));
+    return command_buffer;
+  }
+
+  // Builds the new swapchain from the old one without waiting for the GPU.
+  // The old swapchain and what was made from its images live on until the
+  // frames still using them are done.
+  VkResult recreate_swapchain(RenderWindow &target) {
+    TRACE_SCOPE("Renderer::recreate_swapchain");
+    auto old_swapchain = target.swapchain;
+    auto old_image_views = target.swapchain_image_views;
+    auto old_framebuffers = target.framebuffers;
+    CHECK_VK_ERRC(create_swapchain(target));
+    CHECK_VK_ERRC(create_framebuffers(target));
+    target.image_in_flight.assign(target.swapchain.image_count, 0);
+    target.is_suboptimal = false;
+    target.is_out_of_date = false;
+    target.recreated_at = delta_clock.now();
+
+    // Other submissions advance the timeline too, so the last frame is
+    // waited for by its own value and frames are counted separately
+    auto last_slot =
+        (render_data.current_frame + MAXIMUM_FRAMES_IN_FLIGHT - 1) %
+        MAXIMUM_FRAMES_IN_FLIGHT;
+    retired_swapchains.push_back(
+        {render_data.frame_values[last_slot],
+         render_data.presented_frames + SWAPCHAIN_RETIRE_FRAMES,
+         [=, this]() mutable {
+           for (auto framebuffer : old_framebuffers)
+             dispatch.destroyFramebuffer(framebuffer, nullptr);
+           old_swapchain.destroy_image_views(old_image_views);
+           vkb::destroy_swapchain(old_swapchain);
+         }});
+
+    if (target.accumulation) {
+      _destroy_accumulation_target(target);
+      _create_accumulation_target(target);
+    }
+    request_redraw();
 
     return VK_SUCCESS;
   }
 
+  VkResult _acquire_image(RenderWindow &target) {
+    TRACE_SCOPE("acquireNextImageKHR");
+    return dispatch.acquireNextImageKHR(
+        target.swapchain, UINT64_MAX,
+        target.available_semaphores[render_data.current_frame],
+        VK_NULL_HANDLE, &target.image_index);
+  }
+
+  // Recreated by the first frame after the interval, drawing until then.
+  void _mark_suboptimal(RenderWindow &target) {
+    target.is_suboptimal = true;
+    request_redraw();
+  }
+
+  // Recreated by the first frame after the interval, skipped until then.
+  // Resizing on Win32 reports this rather than suboptimal, since the
+  // swapchain extent has to match the window.
+  void _mark_out_of_date(RenderWindow &target) {
+    target.is_out_of_date = true;
+    request_redraw();
+  }
+
+  bool _is_recreation_due(const RenderWindow &target) {
+    return delta_clock.now() - target.recreated_at >=
+           SWAPCHAIN_RECREATE_INTERVAL;
+  }
+
+  void _destroy_retired_swapchains() {
+    auto &timeline = *render_data.timeline;
+    while (!retired_swapchains.empty()) {
+      auto &retired = retired_swapchains.front();
+      if (render_data.presented_frames < retired.destroy_after_presented ||
+          !timeline.is_complete(retired.last_frame_value))
+        break;
+      retired.destroy();
+      retired_swapchains.pop_front();
+    }
+  }
+
+  // A swapchain cannot have a zero extent, so there is nothing to draw into.
+  bool _is_minimized(RenderWindow &target) {
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(target.window, &width, &height);
+    return width == 0 || height == 0;
+  }
+
   CompilationResult set_fragment_shader(const char *filename,
                                         const char *source) {
+    TRACE_SCOPE("Renderer::set_fragment_shader");
     EXPECT(!is_frame_in_progress);
+    auto hash = shader_origin_hash(source, {}, optimizer_recipe);
+    if (auto reused = _reusable_shader(filename, hash, source, {})) {
+      _store_prepared_shader(filename, reused.value());
+      return _reuse_prepared_shader(filename, reused.value());
+    }
+
     auto compilation_result =
-        shader_compiler.compile_fragment_shader(filename, source);
+        shader_compiler().compile_fragment_shader(filename, source);
 
     TRY(compilation_result);
 
-    auto fragment_code = std::move(compilation_result.unwrap());
+    ShaderStatistics statistics;
+    auto parameters = _reflect_parameters(compilation_result.unwrap());
+    auto optimization_result =
+        optimize_shader(std::move(compilation_result.unwrap()),
+                        optimizer_recipe, statistics);
+    TRY(optimization_result);
+    auto interface_error =
+        check_shader_interface(filename, optimization_result.unwrap());
+    if (interface_error)
+      return interface_error.value();
+    reloads.mark(filename, ReloadStage::Compiled);
+
+    auto fragment_code = std::move(optimization_result.unwrap());
     auto ctx = extract_type_info(fragment_code.data(), fragment_code.size());
 
-    CHECK_VK_ERRC(dispatch.deviceWaitIdle());
-    recreate_graphics_pipeline(fragment_code);
+    auto prepared = prepare_shader(fragment_code, std::move(parameters),
+                                   render_data.pipeline_cache);
+    prepared.statistics = statistics;
+    prepared.origin = std::make_shared<ShaderOrigin>(
+        ShaderOrigin{hash, source, {}, optimizer_recipe, fragment_code});
+
+    _store_prepared_shader(filename, prepared);
+    reloads.mark(filename, ReloadStage::PipelineCreated);
+    _show_shader_file(filename);
+
+    return fragment_code;
   }
 
-  VkResult recreate_graphics_pipeline(std::optional<std::vector<uint32_t>>
-                                          fragment_shader_code = std::nullopt) {
-    CHECK_VK_ERRC(create_shader_modules(fragment_shader_code));
-    CHECK_VK_ERRC(create_graphics_pipeline());
-    CHECK_VK_ERRC(create_framebuffers());
-    CHECK_VK_ERRC(create_command_pool());
-    CHECK_VK_ERRC(create_command_buffers());
-    CHECK_VK_ERRC(create_sync_objects());
-    return VK_SUCCESS;
+  // Nothing to compile or create, `prepared` came from the same source.
+  CompilationResult _reuse_prepared_shader(const char *filename,
+                                           const PreparedShader &prepared) {
+    reloads.mark(filename, ReloadStage::Compiled);
+    reloads.mark(filename, ReloadStage::PipelineCreated);
+    _show_shader_file(filename);
+    return prepared.origin->code;
+  }
+
+  void _show_shader_file(const char *filename) {
+    if (!is_shader_shown(filename))
+      windows[focused_window]->shader = filename;
+    request_redraw();
   }
 
   double delta_time() { return dt; }
@@ -559,7 +2074,9 @@ struct Renderer {
 
     auto delta = last_delta_point.has_value() ? (now - last_delta_point.value())
                                               : nanoseconds(0);
-    dt = duration<double, seconds::period>(delta).count();
+    dt = scripted_dt.value_or(
+        duration<double, seconds::period>(delta).count());
+    time += dt;
     last_delta_point = now;
 
     auto fps_duration = duration_cast<seconds>(now - last_fps_point).count();
@@ -571,50 +2088,45 @@ struct Renderer {
     }
   }
 
-  void create_imgui_command_buffer(ImDrawData *draw_data_ptr) {
-    auto imgui_buffer = render_data.imgui_buffers[render_data.image_index];
-
-    VkCommandBufferBeginInfo command_buffer_begin_info = {};
-    command_buffer_begin_info.sType =
-        VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    command_buffer_begin_info.flags |=
-        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    dispatch.beginCommandBuffer(imgui_buffer, &command_buffer_begin_info);
-
-    VkRenderPassBeginInfo render_pass_begin_info = {};
-    render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    render_pass_begin_info.renderPass = render_data.render_pass;
-    render_pass_begin_info.framebuffer =
-        render_data.framebuffers[render_data.image_index];
-    render_pass_begin_info.renderArea.extent = swapchain.extent;
-    render_pass_begin_info.clearValueCount = 0;
-
-    dispatch.cmdBeginRenderPass(imgui_buffer, &render_pass_begin_info,
-                                VK_SUBPASS_CONTENTS_INLINE);
-    ImGui_ImplVulkan_RenderDrawData(draw_data_ptr, imgui_buffer);
-
-    dispatch.cmdEndRenderPass(imgui_buffer);
-    dispatch.endCommandBuffer(imgui_buffer);
-  }
-
   VulkanResult begin_frame() {
+    TRACE_SCOPE("Renderer::begin_frame");
     is_frame_in_progress = true;
 
     tick_timers();
 
-    dispatch.waitForFences(
-        1, &render_data.in_flight_fences[render_data.current_frame], VK_TRUE,
-        UINT64_MAX);
-
-    VkResult result = dispatch.acquireNextImageKHR(
-        swapchain, UINT64_MAX,
-        render_data.available_semaphores[render_data.current_frame],
-        VK_NULL_HANDLE, &render_data.image_index);
-
-    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-      return recreate_swapchain();
-    } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-      CHECK_VK_ERRC(result);
+    auto &timeline = *render_data.timeline;
+    timeline.wait(render_data.frame_values[render_data.current_frame]);
+    _read_timestamps();
+    deferred.run_completed(timeline);
+    _destroy_retired_swapchains();
+    recording->begin_frame(render_data.current_frame);
+
+    // A minimized window sits this frame out, and so does one whose
+    // swapchain is out of date until it is due to be recreated
+    for (auto &window : windows) {
+      window->is_acquired = false;
+      if (_is_minimized(*window))
+        continue;
+      if ((window->is_suboptimal || window->is_out_of_date) &&
+          _is_recreation_due(*window))
+        CHECK_VK_ERRC(recreate_swapchain(*window));
+      if (window->is_out_of_date)
+        continue;
+
+      auto result = _acquire_image(*window);
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        _mark_out_of_date(*window);
+        if (!_is_recreation_due(*window))
+          continue;
+        CHECK_VK_ERRC(recreate_swapchain(*window));
+        result = _acquire_image(*window);
+      }
+
+      window->is_acquired = result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR;
+      if (result == VK_SUBOPTIMAL_KHR)
+        _mark_suboptimal(*window);
+      else if (!window->is_acquired && result != VK_ERROR_OUT_OF_DATE_KHR)
+        CHECK_VK_ERRC(result);
     }
 
     if (is_imgui_enabled) {
@@ -628,112 +2140,193 @@ struct Renderer {
   }
 
   VulkanResult end_frame() {
-    if (render_data.image_in_flight[render_data.image_index] !=
-        VK_NULL_HANDLE) {
-      dispatch.waitForFences(
-          1, &render_data.image_in_flight[render_data.image_index], VK_TRUE,
-          UINT64_MAX);
-    }
-    render_data.image_in_flight[render_data.image_index] =
-        render_data.in_flight_fences[render_data.current_frame];
-
-    ImGui::Render();
-    ImDrawData *draw_data = ImGui::GetDrawData();
+    TRACE_SCOPE("Renderer::end_frame");
+    auto &timeline = *render_data.timeline;
+    auto frame_value = timeline.submitted + 1;
 
-    if (is_imgui_enabled) {
-      create_imgui_command_buffer(draw_data);
+    ImDrawData *draw_data;
+    {
+      TRACE_SCOPE("ImGui::Render");
+      ImGui::Render();
+      draw_data = ImGui::GetDrawData();
     }
 
-    dispatch.resetFences(
-        1, &render_data.in_flight_fences[render_data.current_frame]);
-
-    VkSemaphore wait_semaphores[] = {
-        render_data.available_semaphores[render_data.current_frame]};
-    VkPipelineStageFlags wait_stages[] = {
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    VkSemaphore signal_semaphores[] = {
-        render_data.finished_semaphore[render_data.current_frame]};
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = wait_semaphores;
-    submitInfo.pWaitDstStageMask = wait_stages;
-
-    VkCommandBuffer command_buffers[2] = {
-        render_data.command_buffers[render_data.image_index],
-        render_data.imgui_buffers[render_data.image_index]};
-
-    // NOTE(ktnlvr): avoid submitting the imgui buffer
-    submitInfo.commandBufferCount = is_imgui_enabled ? 2 : 1;
-    submitInfo.pCommandBuffers = command_buffers;
-
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signal_semaphores;
-
-    CHECK_VK_ERRC(dispatch.queueSubmit(
-        render_data.graphics_queue, 1, &submitInfo,
-        render_data.in_flight_fences[render_data.current_frame]));
-
-    VkPresentInfoKHR present_info = {};
-    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-
-    present_info.waitSemaphoreCount = 1;
-    present_info.pWaitSemaphores = signal_semaphores;
-
-    VkSwapchainKHR swapChains[] = {swapchain};
-    present_info.swapchainCount = 1;
-    present_info.pSwapchains = swapChains;
-
-    present_info.pImageIndices = &render_data.image_index;
-
-    VkResult result =
+    std::vector<RenderWindow *> targets;
+    for (auto &window : windows)
+      if (window->is_acquired)
+        targets.push_back(window.get());
+
+    auto count = targets.size();
+    std::vector<SecondaryPass> passes;
+    std::vector<size_t> pass_offsets;
+    std::vector<VkSemaphore> wait_semaphores(count);
+    std::vector<VkPipelineStageFlags> wait_stages(
+        count, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                   VK_PIPELINE_STAGE_TRANSFER_BIT);
+    std::vector<VkSemaphore> signal_semaphores(count);
+    std::vector<VkSwapchainKHR> swapchains(count);
+    std::vector<uint32_t> image_indices(count);
+
+    for (size_t i = 0; i < count; i++) {
+      auto &target = *targets[i];
+      // Usually long done, the cached timeline value answers without a call
+      auto &image_value = target.image_in_flight[target.image_index];
+      timeline.wait(image_value);
+      image_value = frame_value;
+
+      pass_offsets.push_back(passes.size());
+      passes.push_back(_shader_pass(target));
+      // NOTE(ktnlvr): avoid submitting the imgui buffer
+      if (is_imgui_enabled && &target == &primary_window())
+        passes.push_back(_imgui_pass(target, draw_data));
+
+      wait_semaphores[i] =
+          target.available_semaphores[render_data.current_frame];
+      signal_semaphores[i] =
+          target.finished_semaphore[render_data.current_frame];
+      swapchains[i] = target.swapchain;
+      image_indices[i] = target.image_index;
+    }
+    pass_offsets.push_back(passes.size());
+
+    std::vector<VkResult> results(count, VK_SUCCESS);
+    if (count > 0) {
+      recording->record(passes);
+      auto command_buffer =
+          _record_frame_commands(targets, passes, pass_offsets);
+
+      auto signals = signal_semaphores;
+      signals.push_back(timeline.semaphore);
+      TimelineSignal signal(signals.size());
+      signal.values.back() = timeline.next();
+      render_data.frame_values[render_data.current_frame] = frame_value;
+
+      // As late as it gets, the GPU reads these only once the frame runs
+      _latch_inputs(targets);
+
+      VkSubmitInfo submit_info = {};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.waitSemaphoreCount = (uint32_t)count;
+      submit_info.pWaitSemaphores = wait_semaphores.data();
+      submit_info.pWaitDstStageMask = wait_stages.data();
+      submit_info.commandBufferCount = 1;
+      submit_info.pCommandBuffers = &command_buffer;
+      submit_info.signalSemaphoreCount = (uint32_t)signals.size();
+      submit_info.pSignalSemaphores = signals.data();
+      signal.chain(submit_info);
+      {
+        TRACE_SCOPE("queueSubmit");
+        CHECK_VK_ERRC(dispatch.queueSubmit(render_data.graphics_queue, 1,
+                                           &submit_info, VK_NULL_HANDLE));
+      }
+      for (auto target : targets)
+        reloads.mark(target->shader, ReloadStage::Submitted);
+
+      VkPresentInfoKHR present_info = {};
+      present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      present_info.waitSemaphoreCount = (uint32_t)count;
+      present_info.pWaitSemaphores = signal_semaphores.data();
+      present_info.swapchainCount = (uint32_t)count;
+      present_info.pSwapchains = swapchains.data();
+      present_info.pImageIndices = image_indices.data();
+      present_info.pResults = results.data();
+
+      {
+        TRACE_SCOPE("queuePresentKHR");
         dispatch.queuePresentKHR(render_data.present_queue, &present_info);
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
-      return recreate_swapchain();
-    } else {
-      CHECK_VK_ERRC(result);
+      }
+      for (size_t i = 0; i < count; i++)
+        if (results[i] == VK_SUCCESS || results[i] == VK_SUBOPTIMAL_KHR)
+          reloads.mark(targets[i]->shader, ReloadStage::Presented);
+      render_data.presented_frames++;
     }
 
     render_data.current_frame =
         (render_data.current_frame + 1) % MAXIMUM_FRAMES_IN_FLIGHT;
     frames++;
+    frame_count++;
+    _has_audio_upload = false;
+    if (pending_redraws > 0)
+      pending_redraws--;
 
     is_frame_in_progress = false;
 
+    for (size_t i = 0; i < count; i++) {
+      targets[i]->is_acquired = false;
+      if (results[i] == VK_ERROR_OUT_OF_DATE_KHR) {
+        _mark_out_of_date(*targets[i]);
+      } else if (results[i] == VK_SUBOPTIMAL_KHR) {
+        _mark_suboptimal(*targets[i]);
+      } else {
+        CHECK_VK_ERRC(results[i]);
+      }
+    }
+
     return VK_SUCCESS;
   }
 
   void update_window_title() {
-    std::stringstream title;
-    title << "Rhetort | FPS: " << fps;
-    auto title_str = title.str();
-    glfwSetWindowTitle(window, title_str.c_str());
+    for (auto &window : windows) {
+      std::stringstream title;
+      title << "Rhetort | FPS: " << fps;
+      if (windows.size() > 1)
+        title << " | " << std::filesystem::path(window->shader).filename();
+      auto title_str = title.str();
+      glfwSetWindowTitle(window->window, title_str.c_str());
+    }
   }
 
   void set_imgui_enabled(bool v) {
     EXPECT(!is_frame_in_progress);
     is_imgui_enabled = v;
+    request_redraw();
   }
 
   Renderer(Bootstrap bootstrap) {
-    this->window = bootstrap.window;
     this->instance = bootstrap.instance;
     this->physical_device = bootstrap.physical_device;
     this->device = bootstrap.device;
     this->dispatch = bootstrap.device.make_table();
+    this->_compiler = bootstrap.compiler;
+
+    // None of this needs the swapchain, so it runs while that is created
+    auto builtin_fragment_module = std::async(std::launch::async, [this]() {
+      StartupScope scope("shader modules and layouts");
+      CHECK_VK_ERRC(create_pipeline_layout());
+      CHECK_VK_ERRC(create_pipeline_cache());
+      CHECK_VK_ERRC(create_shader_modules());
+      return create_shader_module(builtins::fragment_shader_spirv);
+    });
+
+    {
+      StartupScope scope("swapchain and render pass");
+      auto primary = std::make_unique<RenderWindow>();
+      primary->window = bootstrap.window;
+      primary->surface = bootstrap.device.surface;
+      CHECK_VK_ERRC(create_swapchain(*primary));
+      windows.push_back(std::move(primary));
+      CHECK_VK_ERRC(create_queues());
+      CHECK_VK_ERRC(create_timestamp_support());
+      CHECK_VK_ERRC(create_render_pass());
+    }
 
-    this->swapchain = create_swapchain().value();
-    CHECK_VK_ERRC(create_queues());
-    CHECK_VK_ERRC(create_render_pass());
-    CHECK_VK_ERRC(create_shader_modules());
-    CHECK_VK_ERRC(create_graphics_pipeline());
-    CHECK_VK_ERRC(create_framebuffers());
-    CHECK_VK_ERRC(create_command_pool());
-    CHECK_VK_ERRC(create_command_buffers());
-    CHECK_VK_ERRC(create_sync_objects());
-
-    create_imgui();
+    {
+      StartupScope scope("builtin pipeline");
+      CHECK_VK_ERRC(create_builtin_pipeline(builtin_fragment_module.get()));
+    }
+
+    {
+      StartupScope scope("framebuffers and commands");
+      CHECK_VK_ERRC(create_command_pool());
+      CHECK_VK_ERRC(create_sync_objects());
+      CHECK_VK_ERRC(create_descriptor_sets());
+      _create_window_resources(primary_window());
+    }
+
+    {
+      StartupScope scope("imgui");
+      create_imgui();
+    }
   }
 };
 
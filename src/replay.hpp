@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "renderer.hpp"
+#include "shaders/builtins.hpp"
+#include "shaders/inputs.hpp"
+
+namespace retort {
+
+const uint32_t TRACE_VERSION = 1;
+
+// Which fields follow the time step of a frame in a trace.
+const uint8_t TRACE_EXTENT = 1 << 0;
+const uint8_t TRACE_MOUSE = 1 << 1;
+const uint8_t TRACE_BUTTONS = 1 << 2;
+const uint8_t TRACE_KEYS = 1 << 3;
+const uint8_t TRACE_SHADER = 1 << 4;
+
+// A shader loaded before a frame, with the source it was compiled from. Built
+// in shaders have no source.
+struct TraceShader {
+  std::string name;
+  std::string source;
+};
+
+// Everything the primary window's shader got from outside in one frame.
+struct TraceFrame {
+  double dt = 0.;
+  VkExtent2D extent = {};
+  LatchedInputs inputs = {};
+  std::optional<TraceShader> shader;
+};
+
+// Appends frames to a trace. After "RTRC" and the version every frame is a
+// byte of `TRACE_*` flags, the time step and then only the fields that differ
+// from the frame before, in the order of the flags.
+struct TraceWriter {
+  std::unique_ptr<FILE, int (*)(FILE *)> file{nullptr, fclose};
+  TraceFrame previous;
+  uint64_t frame_count = 0;
+
+  void write(const TraceFrame &frame) {
+    auto &last = previous;
+    uint8_t flags = 0;
+    if (frame_count == 0 || frame.extent.width != last.extent.width ||
+        frame.extent.height != last.extent.height)
+      flags |= TRACE_EXTENT;
+    if (frame_count == 0 ||
+        memcmp(frame.inputs.mouse, last.inputs.mouse,
+               sizeof(frame.inputs.mouse)) != 0 ||
+        memcmp(frame.inputs.polled_mouse, last.inputs.polled_mouse,
+               sizeof(frame.inputs.polled_mouse)) != 0)
+      flags |= TRACE_MOUSE;
+    if (frame_count == 0 || frame.inputs.buttons != last.inputs.buttons)
+      flags |= TRACE_BUTTONS;
+    if (frame_count == 0 || memcmp(frame.inputs.keys, last.inputs.keys,
+                                   sizeof(frame.inputs.keys)) != 0)
+      flags |= TRACE_KEYS;
+    if (frame.shader)
+      flags |= TRACE_SHADER;
+
+    _put(&flags, sizeof(flags));
+    _put(&frame.dt, sizeof(frame.dt));
+    if (flags & TRACE_EXTENT)
+      _put(&frame.extent, sizeof(frame.extent));
+    if (flags & TRACE_MOUSE) {
+      _put(frame.inputs.mouse, sizeof(frame.inputs.mouse));
+      _put(frame.inputs.polled_mouse, sizeof(frame.inputs.polled_mouse));
+    }
+    if (flags & TRACE_BUTTONS)
+      _put(&frame.inputs.buttons, sizeof(frame.inputs.buttons));
+    if (flags & TRACE_KEYS)
+      _put(frame.inputs.keys, sizeof(frame.inputs.keys));
+    if (flags & TRACE_SHADER) {
+      _put_string(frame.shader->name);
+      _put_string(frame.shader->source);
+    }
+
+    previous = frame;
+    frame_count++;
+  }
+
+  void _put(const void *data, size_t size) {
+    fwrite(data, 1, size, file.get());
+  }
+
+  void _put_string(const std::string &string) {
+    auto size = (uint32_t)string.size();
+    _put(&size, sizeof(size));
+    _put(string.data(), size);
+  }
+};
+
+auto open_trace_writer(const std::filesystem::path &path, std::string &error)
+    -> std::optional<TraceWriter> {
+  TraceWriter writer;
+  writer.file.reset(fopen(path.string().c_str(), "wb"));
+  if (!writer.file) {
+    error = "cannot open " + path.string() + " for writing";
+    return std::nullopt;
+  }
+  fwrite("RTRC", 1, 4, writer.file.get());
+  fwrite(&TRACE_VERSION, 1, sizeof(TRACE_VERSION), writer.file.get());
+  return writer;
+}
+
+// Every frame of the trace, each complete rather than only what changed.
+auto read_trace(const std::filesystem::path &path, std::string &error)
+    -> std::optional<std::vector<TraceFrame>> {
+  std::unique_ptr<FILE, int (*)(FILE *)> file{
+      fopen(path.string().c_str(), "rb"), fclose};
+  if (!file) {
+    error = "cannot open " + path.string();
+    return std::nullopt;
+  }
+
+  auto get = [&](void *data, size_t size) {
+    return fread(data, 1, size, file.get()) == size;
+  };
+  auto get_string = [&](std::string &string) {
+    uint32_t size;
+    if (!get(&size, sizeof(size)))
+      return false;
+    string.resize(size);
+    return get(string.data(), size);
+  };
+
+  char magic[4];
+  uint32_t version;
+  if (!get(magic, 4) || memcmp(magic, "RTRC", 4) != 0 ||
+      !get(&version, sizeof(version))) {
+    error = path.string() + " is not a trace";
+    return std::nullopt;
+  }
+  if (version != TRACE_VERSION) {
+    error = path.string() + " is a trace of version " +
+            std::to_string(version) + ", expected " +
+            std::to_string(TRACE_VERSION);
+    return std::nullopt;
+  }
+
+  std::vector<TraceFrame> frames;
+  TraceFrame frame;
+  uint8_t flags;
+  while (get(&flags, sizeof(flags))) {
+    frame.shader.reset();
+    bool is_complete = get(&frame.dt, sizeof(frame.dt));
+    if (is_complete && (flags & TRACE_EXTENT))
+      is_complete = get(&frame.extent, sizeof(frame.extent));
+    if (is_complete && (flags & TRACE_MOUSE))
+      is_complete = get(frame.inputs.mouse, sizeof(frame.inputs.mouse)) &&
+                    get(frame.inputs.polled_mouse,
+                        sizeof(frame.inputs.polled_mouse));
+    if (is_complete && (flags & TRACE_BUTTONS))
+      is_complete = get(&frame.inputs.buttons, sizeof(frame.inputs.buttons));
+    if (is_complete && (flags & TRACE_KEYS))
+      is_complete = get(frame.inputs.keys, sizeof(frame.inputs.keys));
+    if (is_complete && (flags & TRACE_SHADER)) {
+      frame.shader.emplace();
+      is_complete = get_string(frame.shader->name) &&
+                    get_string(frame.shader->source);
+    }
+    if (!is_complete) {
+      error = path.string() + " ends within frame " +
+              std::to_string(frames.size());
+      return std::nullopt;
+    }
+    frames.push_back(frame);
+  }
+
+  if (frames.empty() || !frames[0].shader) {
+    error = path.string() + " does not start with a shader";
+    return std::nullopt;
+  }
+  return frames;
+}
+
+// Shows the shader in the primary window, compiled from the recorded source
+// rather than what the file holds now. Prints why when it cannot.
+bool show_trace_shader(Renderer &renderer, const TraceShader &shader) {
+  if (shader.name == builtins::latency_shader_filename) {
+    renderer.use_latency_test(0);
+    return true;
+  }
+  if (shader.source.empty()) {
+    if (!renderer.has_prepared_shader(shader.name)) {
+      std::cerr << "retort: the trace shows " << shader.name
+                << ", which is not built in" << std::endl;
+      return false;
+    }
+    renderer.use_prepared_shader(shader.name, 0);
+    return true;
+  }
+
+  auto result = renderer.set_fragment_shader(shader.name.c_str(),
+                                             shader.source.c_str());
+  if (!result) {
+    std::cerr << result.unwrap_err().messages << std::endl;
+    return false;
+  }
+  renderer.use_prepared_shader(shader.name, 0);
+  return true;
+}
+
+// Hands out the frames of a trace one at a time.
+struct TraceReplay {
+  std::vector<TraceFrame> frames;
+  size_t next_frame = 0;
+
+  bool is_done() const { return next_frame >= frames.size(); }
+
+  const TraceFrame &next() { return frames[next_frame++]; }
+};
+
+} // namespace retort
@@ -1,2 +1,8 @@
+#include "shaders/builtins.hpp"
 #include "shaders/compiler.hpp"
+#include "shaders/cost.hpp"
+#include "shaders/inputs.hpp"
+#include "shaders/interface.hpp"
+#include "shaders/optimizer.hpp"
 #include "shaders/reflection.hpp"
+#include "shaders/statistics.hpp"
\ No newline at end of file
@@ -0,0 +1,13 @@
+#version 450
+
+layout (location = 0) out vec3 fragColor;
+
+vec2 positions[4] = vec2[](vec2 (-1., -1.), vec2 (1., -1.), vec2 (1., 1.), vec2 (-1., 1.));
+
+vec3 colors[3] = vec3[](vec3 (1.0, 0.0, 0.0), vec3 (0.0, 1.0, 0.0), vec3 (0.0, 0.0, 1.0));
+
+void main ()
+{
+	gl_Position = vec4 (positions[gl_VertexIndex], 0.0, 1.0);
+	fragColor = colors[gl_VertexIndex % 3];
+}
@@ -1,12 +1,15 @@
 #pragma once
 
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <shaderc/shaderc.hpp>
 
 #include "../error.hpp"
+#include "../tracing.hpp"
 #include "../utils.hpp"
 
-#include "./builtins.hpp"
-
 namespace retort {
 
 struct CompilationError {
@@ -17,6 +20,10 @@ struct CompilationError {
 
 using CompilationResult = Result<std::vector<uint32_t>, CompilationError>;
 
+// `#define`s passed to the preprocessor, as if they were at the top of the
+// source.
+using ShaderDefines = std::vector<std::pair<std::string, std::string>>;
+
 struct CompilationInfo {
   const char *filename;
   shaderc_shader_kind kind;
@@ -33,6 +40,11 @@ struct CompilationInfo {
     options.SetOptimizationLevel(shaderc_optimization_level_performance);
     options.SetPreserveBindings(true);
   }
+
+  void define(const ShaderDefines &defines) {
+    for (auto &[name, value] : defines)
+      options.AddMacroDefinition(name, value);
+  }
 };
 
 struct Compiler {
@@ -45,6 +57,7 @@ struct Compiler {
   }
 
   auto compile(const CompilationInfo &info) -> CompilationResult {
+    TRACE_SCOPE("Compiler::compile");
     shaderc::PreprocessedSourceCompilationResult result_pre =
         _compiler.PreprocessGlsl(info.source.data(), info.source.size(),
                                  info.kind, info.filename, info.options);
@@ -74,19 +87,17 @@ struct Compiler {
     return std::vector(result_spv.begin(), result_spv.end());
   }
 
-  auto compile_fragment_shader(const char *filename, const char *source)
+  auto compile_fragment_shader(const char *filename, const char *source,
+                               const ShaderDefines &defines = {})
       -> CompilationResult {
-    return compile(filename, shaderc_fragment_shader, source);
-  }
-
-  auto create_inline_vertex_shader_code() -> CompilationResult {
-    return compile(builtins::vertex_shader_filename, shaderc_vertex_shader,
-                   builtins::vertex_shader);
+    CompilationInfo info(filename, shaderc_fragment_shader, source);
+    info.define(defines);
+    return compile(info);
   }
 
-  auto create_inline_fragment_shader_code() -> CompilationResult {
-    return compile_fragment_shader(builtins::fragment_shader_filename,
-                                   builtins::fragment_shader);
+  auto compile_vertex_shader(const char *filename, const char *source)
+      -> CompilationResult {
+    return compile(filename, shaderc_vertex_shader, source);
   }
 };
 
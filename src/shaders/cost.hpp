@@ -0,0 +1,481 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace retort {
+
+// Relative issue costs used to decide what bounds a shader. Transcendentals
+// run on quarter rate units on most GPUs, a texture fetch takes about as much
+// issue bandwidth and latency hiding as a handful of ALU instructions.
+const double TRANSCENDENTAL_WEIGHT = 4.;
+const double TEXTURE_WEIGHT = 8.;
+
+// Assumed iterations of loops whose trip count is not a constant.
+const double DYNAMIC_LOOP_TRIP_COUNT = 16.;
+// Trip counts above this are treated as dynamic.
+const uint32_t MAXIMUM_CONSTANT_TRIP_COUNT = 1 << 16;
+
+// Local arrays with more components than this usually spill to scratch memory.
+const uint32_t LARGE_LOCAL_ARRAY_COMPONENTS = 64;
+
+// Static per fragment estimate of the entry point. Counts are weighted by the
+// component count of the result and by the trip counts of enclosing loops.
+struct ShaderCost {
+  double arithmetic = 0.;
+  double transcendental = 0.;
+  double texture = 0.;
+  double branch = 0.;
+  bool has_dynamic_loops = false;
+  std::vector<std::string> warnings;
+
+  double alu_weight() const {
+    return arithmetic + TRANSCENDENTAL_WEIGHT * transcendental;
+  }
+  double fetch_weight() const { return TEXTURE_WEIGHT * texture; }
+  bool is_fetch_bound() const { return fetch_weight() > alu_weight(); }
+};
+
+namespace _cost {
+
+enum Op : uint32_t {
+  Name = 5,
+  ExtInstImport = 11,
+  ExtInst = 12,
+  EntryPoint = 15,
+  TypeInt = 21,
+  TypeVector = 23,
+  TypeMatrix = 24,
+  TypeArray = 28,
+  TypePointer = 32,
+  Constant = 43,
+  Function = 54,
+  FunctionEnd = 56,
+  FunctionCall = 57,
+  Variable = 59,
+  ImageSampleImplicitLod = 87,
+  ImageWrite = 99,
+  ConvertFToU = 109,
+  Bitcast = 124,
+  SNegate = 126,
+  IAdd = 128,
+  ISub = 130,
+  SMulExtended = 152,
+  Any = 154,
+  IEqual = 170,
+  INotEqual = 171,
+  UGreaterThan = 172,
+  SGreaterThan = 173,
+  UGreaterThanEqual = 174,
+  SGreaterThanEqual = 175,
+  ULessThan = 176,
+  SLessThan = 177,
+  ULessThanEqual = 178,
+  SLessThanEqual = 179,
+  FUnordGreaterThanEqual = 191,
+  ShiftRightLogical = 194,
+  BitCount = 205,
+  DPdx = 207,
+  FwidthCoarse = 215,
+  Phi = 245,
+  LoopMerge = 246,
+  Label = 248,
+  BranchConditional = 250,
+  Switch = 251,
+};
+
+// GLSL.std.450 instructions from Sin through InverseSqrt
+const uint32_t GLSL_FIRST_TRANSCENDENTAL = 13;
+const uint32_t GLSL_LAST_TRANSCENDENTAL = 32;
+
+const uint32_t STORAGE_CLASS_PRIVATE = 6;
+const uint32_t STORAGE_CLASS_FUNCTION = 7;
+
+struct Instruction {
+  uint32_t opcode;
+  const uint32_t *operands;
+  uint32_t operand_count;
+};
+
+struct Call {
+  uint32_t function;
+  double weight;
+  bool is_in_dynamic_loop;
+};
+
+struct FunctionCost {
+  double arithmetic = 0.;
+  double transcendental = 0.;
+  double texture = 0.;
+  double branch = 0.;
+  bool has_texture = false;
+  bool has_dynamic_loops = false;
+  std::vector<Call> calls;
+};
+
+struct Loop {
+  uint32_t merge;
+  double weight;
+  bool is_dynamic;
+};
+
+std::string literal_string(const uint32_t *words, uint32_t count) {
+  std::string str;
+  for (uint32_t i = 0; i < count; i++) {
+    for (uint32_t byte = 0; byte < 4; byte++) {
+      char c = (char)((words[i] >> (byte * 8)) & 0xFF);
+      if (c == '\0')
+        return str;
+      str += c;
+    }
+  }
+  return str;
+}
+
+struct Analyzer {
+  std::vector<Instruction> instructions;
+  // Instructions defining result ids the loop analysis looks at
+  std::map<uint32_t, size_t> defs;
+  std::map<uint32_t, uint32_t> constants;
+  std::map<uint32_t, bool> int_signedness;
+  std::map<uint32_t, uint32_t> type_components;
+  std::map<uint32_t, uint32_t> pointee_types;
+  std::map<uint32_t, std::string> names;
+  std::map<uint32_t, FunctionCost> functions;
+  std::optional<uint32_t> glsl_std_450;
+  std::optional<uint32_t> entry_point;
+  std::vector<std::string> warnings;
+
+  Analyzer(std::span<const uint32_t> spirv) {
+    size_t offset = 5;
+    while (offset < spirv.size()) {
+      uint32_t length = spirv[offset] >> 16;
+      if (length == 0 || offset + length > spirv.size())
+        break;
+      instructions.push_back({spirv[offset] & 0xFFFF, &spirv[offset + 1],
+                              length - 1});
+      offset += length;
+    }
+  }
+
+  uint32_t components(uint32_t type) {
+    auto it = type_components.find(type);
+    return it == type_components.end() ? 1 : it->second;
+  }
+
+  std::string name_of(uint32_t id) {
+    auto it = names.find(id);
+    return it == names.end() ? "%" + std::to_string(id) : it->second;
+  }
+
+  void collect_globals() {
+    for (size_t i = 0; i < instructions.size(); i++) {
+      auto [opcode, ops, count] = instructions[i];
+      switch (opcode) {
+      case Name:
+        names[ops[0]] = literal_string(ops + 1, count - 1);
+        break;
+      case ExtInstImport:
+        if (literal_string(ops + 1, count - 1) == "GLSL.std.450")
+          glsl_std_450 = ops[0];
+        break;
+      case EntryPoint:
+        entry_point = ops[1];
+        break;
+      case TypeInt:
+        int_signedness[ops[0]] = ops[2];
+        break;
+      case TypeVector:
+        type_components[ops[0]] = components(ops[1]) * ops[2];
+        break;
+      case TypeMatrix:
+        type_components[ops[0]] = components(ops[1]) * ops[2];
+        break;
+      case TypeArray:
+        if (constants.contains(ops[2]))
+          type_components[ops[0]] = components(ops[1]) * constants[ops[2]];
+        break;
+      case TypePointer:
+        pointee_types[ops[0]] = ops[2];
+        break;
+      case Constant:
+        if (count == 3)
+          constants[ops[1]] = ops[2];
+        break;
+      case Variable:
+        check_local_array(ops);
+        break;
+      case Phi:
+      case IAdd:
+      case ISub:
+        defs[ops[1]] = i;
+        break;
+      default:
+        if (opcode >= IEqual && opcode <= SLessThanEqual)
+          defs[ops[1]] = i;
+      }
+    }
+  }
+
+  void check_local_array(const uint32_t *ops) {
+    if (ops[2] != STORAGE_CLASS_FUNCTION && ops[2] != STORAGE_CLASS_PRIVATE)
+      return;
+    auto pointee = pointee_types.find(ops[0]);
+    if (pointee == pointee_types.end())
+      return;
+
+    auto size = components(pointee->second);
+    if (size > LARGE_LOCAL_ARRAY_COMPONENTS)
+      warnings.push_back("local array " + name_of(ops[1]) + " holds " +
+                         std::to_string(size) +
+                         " components and will likely spill to memory");
+  }
+
+  const Instruction *def(uint32_t id) {
+    auto it = defs.find(id);
+    return it == defs.end() ? nullptr : &instructions[it->second];
+  }
+
+  std::optional<int64_t> constant(uint32_t id, uint32_t type) {
+    auto it = constants.find(id);
+    if (it == constants.end())
+      return std::nullopt;
+    if (int_signedness[type])
+      return (int64_t)(int32_t)it->second;
+    return (int64_t)it->second;
+  }
+
+  static bool compare(uint32_t opcode, int64_t a, int64_t b) {
+    switch (opcode) {
+    case IEqual:
+      return a == b;
+    case INotEqual:
+      return a != b;
+    case UGreaterThan:
+    case SGreaterThan:
+      return a > b;
+    case UGreaterThanEqual:
+    case SGreaterThanEqual:
+      return a >= b;
+    case ULessThan:
+    case SLessThan:
+      return a < b;
+    default:
+      return a <= b;
+    }
+  }
+
+  // Recognizes `for (i = init; i < limit; i += step)` with constant init,
+  // limit and step, in the shape glslang emits it: an induction phi in the
+  // header and the exit test in the first conditional branch after it.
+  std::optional<uint32_t> trip_count(size_t loop_merge_index) {
+    auto merge = instructions[loop_merge_index].operands[0];
+
+    const Instruction *branch = nullptr;
+    for (auto i = loop_merge_index + 1; i < instructions.size(); i++) {
+      auto opcode = instructions[i].opcode;
+      if (opcode == LoopMerge)
+        return std::nullopt;
+      if (opcode == BranchConditional) {
+        branch = &instructions[i];
+        break;
+      }
+    }
+    if (!branch)
+      return std::nullopt;
+
+    auto condition = def(branch->operands[0]);
+    bool exits_when_true = branch->operands[1] == merge;
+    if (!exits_when_true && branch->operands[2] != merge)
+      return std::nullopt;
+    if (!condition || condition->opcode < IEqual ||
+        condition->opcode > SLessThanEqual)
+      return std::nullopt;
+
+    auto lhs = def(condition->operands[2]);
+    bool is_phi_on_left = lhs && lhs->opcode == Phi;
+    auto phi = is_phi_on_left ? lhs : def(condition->operands[3]);
+    if (!phi || phi->opcode != Phi || phi->operand_count != 6)
+      return std::nullopt;
+
+    auto type = phi->operands[0];
+    auto limit = constant(condition->operands[is_phi_on_left ? 3 : 2], type);
+
+    // One incoming value is the initial constant, the other the increment
+    std::optional<int64_t> init, step;
+    for (uint32_t incoming : {phi->operands[2], phi->operands[4]}) {
+      if (auto value = constant(incoming, type)) {
+        init = value;
+        continue;
+      }
+      auto next = def(incoming);
+      if (!next || (next->opcode != IAdd && next->opcode != ISub))
+        continue;
+      auto phi_id = phi->operands[1];
+      std::optional<int64_t> amount;
+      if (next->operands[2] == phi_id)
+        amount = constant(next->operands[3], type);
+      else if (next->operands[3] == phi_id && next->opcode == IAdd)
+        amount = constant(next->operands[2], type);
+      if (amount)
+        step = next->opcode == IAdd ? amount.value() : -amount.value();
+    }
+    if (!init || !step || !limit || step.value() == 0)
+      return std::nullopt;
+
+    uint32_t trips = 0;
+    for (auto i = init.value(); trips < MAXIMUM_CONSTANT_TRIP_COUNT;
+         i += step.value(), trips++) {
+      auto a = is_phi_on_left ? i : limit.value();
+      auto b = is_phi_on_left ? limit.value() : i;
+      if (compare(condition->opcode, a, b) == exits_when_true)
+        return trips;
+    }
+    return std::nullopt;
+  }
+
+  void collect_functions() {
+    FunctionCost *function = nullptr;
+    uint32_t function_id = 0;
+    std::vector<Loop> loops;
+    bool has_warned_dynamic_fetch = false;
+
+    for (size_t i = 0; i < instructions.size(); i++) {
+      auto [opcode, ops, count] = instructions[i];
+
+      if (opcode == Function) {
+        function_id = ops[1];
+        function = &functions[function_id];
+        loops.clear();
+        has_warned_dynamic_fetch = false;
+        continue;
+      }
+      if (!function)
+        continue;
+
+      while (opcode == Label && !loops.empty() && loops.back().merge == ops[0])
+        loops.pop_back();
+
+      double weight = loops.empty() ? 1. : loops.back().weight;
+      bool is_in_dynamic_loop =
+          std::any_of(loops.begin(), loops.end(),
+                      [](auto &loop) { return loop.is_dynamic; });
+
+      if (opcode == FunctionEnd) {
+        function = nullptr;
+      } else if (opcode == LoopMerge) {
+        auto trips = trip_count(i);
+        if (!trips)
+          function->has_dynamic_loops = true;
+        loops.push_back({ops[0],
+                         weight * (trips ? trips.value()
+                                         : DYNAMIC_LOOP_TRIP_COUNT),
+                         !trips});
+      } else if (opcode == FunctionCall) {
+        function->calls.push_back({ops[2], weight, is_in_dynamic_loop});
+      } else if (opcode == BranchConditional || opcode == Switch) {
+        function->branch += weight;
+      } else if (opcode >= ImageSampleImplicitLod && opcode <= ImageWrite) {
+        function->texture += weight;
+        function->has_texture = true;
+        if (is_in_dynamic_loop && !has_warned_dynamic_fetch) {
+          warnings.push_back("texture access inside a loop without a constant "
+                             "trip count in " +
+                             name_of(function_id));
+          has_warned_dynamic_fetch = true;
+        }
+      } else if (opcode == ExtInst) {
+        auto cost = weight * components(ops[0]);
+        bool is_transcendental = glsl_std_450 && ops[2] == glsl_std_450 &&
+                                 ops[3] >= GLSL_FIRST_TRANSCENDENTAL &&
+                                 ops[3] <= GLSL_LAST_TRANSCENDENTAL;
+        if (is_transcendental)
+          function->transcendental += cost;
+        else
+          function->arithmetic += cost;
+      } else if ((opcode >= ConvertFToU && opcode <= Bitcast) ||
+                 (opcode >= SNegate && opcode <= SMulExtended) ||
+                 (opcode >= Any && opcode <= FUnordGreaterThanEqual) ||
+                 (opcode >= ShiftRightLogical && opcode <= BitCount) ||
+                 (opcode >= DPdx && opcode <= FwidthCoarse)) {
+        function->arithmetic += weight * components(ops[0]);
+      }
+    }
+  }
+
+  // Adds `id` and everything it calls, scaled by `weight`, to `cost`.
+  void accumulate(uint32_t id, double weight, ShaderCost &cost,
+                  std::set<uint32_t> &warned_calls) {
+    auto it = functions.find(id);
+    if (it == functions.end())
+      return;
+    auto &function = it->second;
+
+    cost.arithmetic += weight * function.arithmetic;
+    cost.transcendental += weight * function.transcendental;
+    cost.texture += weight * function.texture;
+    cost.branch += weight * function.branch;
+    cost.has_dynamic_loops |= function.has_dynamic_loops;
+
+    for (auto &call : function.calls) {
+      if (call.is_in_dynamic_loop && samples(call.function) &&
+          warned_calls.insert(call.function).second)
+        cost.warnings.push_back("texture access through " +
+                                name_of(call.function) +
+                                " inside a loop without a constant trip count");
+      accumulate(call.function, weight * call.weight, cost, warned_calls);
+    }
+  }
+
+  bool samples(uint32_t id) {
+    auto it = functions.find(id);
+    if (it == functions.end())
+      return false;
+    if (it->second.has_texture)
+      return true;
+    return std::any_of(it->second.calls.begin(), it->second.calls.end(),
+                       [&](auto &call) { return samples(call.function); });
+  }
+};
+
+} // namespace _cost
+
+auto estimate_shader_cost(std::span<const uint32_t> spirv) -> ShaderCost {
+  _cost::Analyzer analyzer(spirv);
+  analyzer.collect_globals();
+  analyzer.collect_functions();
+
+  ShaderCost cost;
+  cost.warnings = analyzer.warnings;
+  if (analyzer.entry_point) {
+    std::set<uint32_t> warned_calls;
+    analyzer.accumulate(analyzer.entry_point.value(), 1., cost, warned_calls);
+  }
+  return cost;
+}
+
+void print_shader_cost(const ShaderCost &cost,
+                       std::optional<double> gpu_time_ms = std::nullopt) {
+  fprintf(stderr,
+          "  estimated per fragment: %.0f alu, %.0f transcendental, %.0f "
+          "texture, %.0f branches, %s bound\n",
+          cost.arithmetic, cost.transcendental, cost.texture, cost.branch,
+          cost.is_fetch_bound() ? "fetch" : "ALU");
+  if (cost.has_dynamic_loops)
+    fprintf(stderr,
+            "  loops without a constant trip count counted %.0f times\n",
+            DYNAMIC_LOOP_TRIP_COUNT);
+  if (gpu_time_ms)
+    fprintf(stderr, "  measured: %.3fms\n", gpu_time_ms.value());
+  for (auto &warning : cost.warnings)
+    fprintf(stderr, "  warning: %s\n", warning.c_str());
+}
+
+} // namespace retort
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+namespace retort {
+
+// Pushed to every fragment shader before its draw. Shaders can read it by
+// declaring the matching block:
+//
+//   layout (push_constant) uniform Retort {
+//     vec2 resolution;
+//     float time;
+//     float delta_time;
+//     uint frame;
+//   } retort;
+//
+// When playing audio, its spectrum and waveform are in a 512x2 texture, in
+// the first and second row respectively:
+//
+//   layout (set = 0, binding = 0) uniform sampler2D retort_audio;
+//
+// Images loaded with --texture are in a table, in the order they were given:
+//
+//   #extension GL_EXT_nonuniform_qualifier : require
+//   layout (set = 1, binding = 0) uniform sampler2D retort_textures[];
+//
+// Mouse and keyboard, written right before the frame is submitted:
+//
+//   layout (set = 0, binding = 1) uniform RetortInput {
+//     vec4 mouse;
+//     vec2 polled_mouse;
+//     uint buttons;
+//     uvec4 keys[3];
+//   } retort_input;
+//
+// Parameters of their own, edited in the GUI while the shader runs. Members
+// are 32-bit scalars and vectors, up to 1024 bytes in all:
+//
+//   layout (set = 0, binding = 2) uniform Parameters {
+//     float scale;
+//     vec3 color;
+//   } parameters;
+struct ShaderInputs {
+  float resolution[2];
+  float time;
+  float delta_time;
+  uint32_t frame;
+};
+
+// Laid out as std140. `mouse.xy` is the cursor in pixels like `gl_FragCoord`,
+// `mouse.zw` where the left button went down, negated once it is released.
+// `polled_mouse` is the cursor when the frame started, for comparison. Bit i
+// of `buttons` is mouse button i, GLFW key k is bit k % 32 of
+// `keys[k / 128][k / 32 % 4]`.
+struct LatchedInputs {
+  float mouse[4];
+  float polled_mouse[2];
+  uint32_t buttons;
+  uint32_t _padding;
+  uint32_t keys[12];
+};
+
+} // namespace retort
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <span>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+#include "compiler.hpp"
+#include "reflection.hpp"
+
+namespace retort {
+
+const uint32_t INPUT_SET = 0;
+const uint32_t TEXTURE_SET = 1;
+const uint32_t SHADER_SET_COUNT = 2;
+
+// Where shaders declare their own uniform block, edited in the GUI, and how
+// large it may get.
+const uint32_t PARAMETER_BINDING = 2;
+const uint32_t PARAMETER_BLOCK_SIZE = 1024;
+
+// Vertex shaders drawing a vertex stream see everything fragment shaders do.
+const VkShaderStageFlags SHADER_STAGES =
+    VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+
+// Slots in the bindless texture table. Anything that supports descriptor
+// indexing allows far more than this after binding.
+const uint32_t TEXTURE_TABLE_SIZE = 4096;
+
+// A resource every shader may declare. The descriptor set layouts are built
+// from these, and shaders are checked against them after compiling, so all
+// shaders share one pipeline layout.
+struct InterfaceBinding {
+  uint32_t set;
+  uint32_t binding;
+  DescriptorKind kind;
+  uint32_t count;
+  const char *declaration;
+};
+
+const InterfaceBinding SHADER_INTERFACE[] = {
+    {INPUT_SET, 0, DescriptorKind::CombinedImageSampler, 1,
+     "layout (set = 0, binding = 0) uniform sampler2D retort_audio;"},
+    {INPUT_SET, 1, DescriptorKind::UniformBuffer, 1,
+     "layout (set = 0, binding = 1) uniform RetortInput { ... } retort_input;"},
+    {INPUT_SET, PARAMETER_BINDING, DescriptorKind::UniformBuffer, 1,
+     "layout (set = 0, binding = 2) uniform Parameters { ... } parameters;"},
+    {TEXTURE_SET, 0, DescriptorKind::CombinedImageSampler, TEXTURE_TABLE_SIZE,
+     "layout (set = 1, binding = 0) uniform sampler2D retort_textures[];"},
+};
+
+// Uniform buffers hold a slot per window and frame, picked when binding.
+VkDescriptorType descriptor_type(DescriptorKind kind) {
+  switch (kind) {
+  case DescriptorKind::Sampler:
+    return VK_DESCRIPTOR_TYPE_SAMPLER;
+  case DescriptorKind::CombinedImageSampler:
+    return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  case DescriptorKind::SampledImage:
+    return VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+  case DescriptorKind::StorageImage:
+    return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  case DescriptorKind::UniformBuffer:
+    return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  case DescriptorKind::StorageBuffer:
+    return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  }
+  return VK_DESCRIPTOR_TYPE_MAX_ENUM;
+}
+
+// Reports the first resource of the shader that nothing would be bound to,
+// rather than letting pipeline creation fail on it, and parameters the editor
+// cannot show.
+auto check_shader_interface(const char *filename,
+                            std::span<const uint32_t> code)
+    -> std::optional<CompilationError> {
+  auto bindings = reflect_descriptor_bindings(code.data(), code.size());
+  for (auto &binding : bindings) {
+    auto provided = std::find_if(
+        std::begin(SHADER_INTERFACE), std::end(SHADER_INTERFACE),
+        [&](const InterfaceBinding &provided) {
+          return provided.set == binding.set &&
+                 provided.binding == binding.binding &&
+                 provided.kind == binding.kind &&
+                 binding.count <= provided.count;
+        });
+    if (provided != std::end(SHADER_INTERFACE))
+      continue;
+
+    auto message = std::string(filename) + ": nothing is bound to set " +
+                   std::to_string(binding.set) + ", binding " +
+                   std::to_string(binding.binding) +
+                   " as declared, shaders can use:\n";
+    for (auto &provided : SHADER_INTERFACE)
+      message += std::string("  ") + provided.declaration + "\n";
+    return CompilationError(message.c_str());
+  }
+
+  auto parameters = reflect_uniform_block(code.data(), code.size(),
+                                          INPUT_SET, PARAMETER_BINDING);
+  if (!parameters)
+    return std::nullopt;
+  std::string message;
+  if (parameters->other_member_count > 0)
+    message = std::string(filename) +
+              ": parameters can only be 32-bit scalars and vectors";
+  else if (parameters->size > PARAMETER_BLOCK_SIZE)
+    message = std::string(filename) + ": parameters take " +
+              std::to_string(parameters->size) + " bytes, at most " +
+              std::to_string(PARAMETER_BLOCK_SIZE) + " fit";
+  if (!message.empty())
+    return CompilationError(message.c_str());
+  return std::nullopt;
+}
+
+} // namespace retort
@@ -0,0 +1,44 @@
+#version 450
+
+// The cursor latched right before submitting is the cross, the one polled
+// when the frame started is the ring. The gap between them while moving is
+// what latching saves. The screen turns white while the left button is
+// down, for measuring with a camera or a photodiode.
+
+layout (push_constant) uniform Retort {
+	vec2 resolution;
+	float time;
+	float delta_time;
+	uint frame;
+} retort;
+
+layout (set = 0, binding = 1) uniform RetortInput {
+	vec4 mouse;
+	vec2 polled_mouse;
+	uint buttons;
+	uvec4 keys[3];
+} retort_input;
+
+layout (location = 0) out vec4 outColor;
+
+void main ()
+{
+	vec2 p = gl_FragCoord.xy;
+	vec2 latched = retort_input.mouse.xy;
+
+	// Alternates every frame, a dropped frame shows as a stuck bar
+	float bar = step (p.y, 16.0) * float (retort.frame & 1u);
+	vec3 color = vec3 (0.1 + 0.5 * bar);
+	if ((retort_input.buttons & 1u) != 0u)
+		color = vec3 (1.0);
+
+	vec2 offset = abs (p - latched);
+	float cross = step (min (offset.x, offset.y), 1.0)
+		* step (max (offset.x, offset.y), 24.0);
+	color = mix (color, vec3 (0.2, 1.0, 0.3), cross);
+
+	float ring = abs (distance (p, retort_input.polled_mouse) - 20.0);
+	color = mix (color, vec3 (1.0, 0.3, 0.2), step (ring, 1.5));
+
+	outColor = vec4 (color, 1.0);
+}
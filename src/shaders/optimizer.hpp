@@ -0,0 +1,86 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <spirv-tools/optimizer.hpp>
+
+#include "../tracing.hpp"
+#include "compiler.hpp"
+
+namespace retort {
+
+enum struct OptimizerRecipe {
+  None,
+  Size,
+  Performance,
+  StripDebugInfo,
+};
+
+const OptimizerRecipe OPTIMIZER_RECIPES[] = {
+    OptimizerRecipe::None,
+    OptimizerRecipe::Size,
+    OptimizerRecipe::Performance,
+    OptimizerRecipe::StripDebugInfo,
+};
+
+const char *optimizer_recipe_name(OptimizerRecipe recipe) {
+  switch (recipe) {
+  case OptimizerRecipe::None:
+    return "none";
+  case OptimizerRecipe::Size:
+    return "size";
+  case OptimizerRecipe::Performance:
+    return "performance";
+  case OptimizerRecipe::StripDebugInfo:
+    return "strip-debug";
+  }
+  return "unknown";
+}
+
+auto parse_optimizer_recipe(const std::string &name)
+    -> std::optional<OptimizerRecipe> {
+  for (auto recipe : OPTIMIZER_RECIPES)
+    if (name == optimizer_recipe_name(recipe))
+      return recipe;
+  return std::nullopt;
+}
+
+// Runs a SPIR-V Tools pass recipe over a module shaderc produced. Safe to call
+// from several threads at once.
+auto optimize_spirv(std::span<const uint32_t> spirv, OptimizerRecipe recipe)
+    -> CompilationResult {
+  TRACE_SCOPE("optimize_spirv");
+  spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_2);
+
+  std::string messages;
+  optimizer.SetMessageConsumer([&](spv_message_level_t, const char *,
+                                   const spv_position_t &position,
+                                   const char *message) {
+    messages += "word " + std::to_string(position.index) + ": " + message;
+    messages += '\n';
+  });
+
+  switch (recipe) {
+  case OptimizerRecipe::None:
+    return std::vector<uint32_t>(spirv.begin(), spirv.end());
+  case OptimizerRecipe::Size:
+    optimizer.RegisterSizePasses();
+    break;
+  case OptimizerRecipe::Performance:
+    optimizer.RegisterPerformancePasses();
+    break;
+  case OptimizerRecipe::StripDebugInfo:
+    optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+    break;
+  }
+
+  std::vector<uint32_t> optimized;
+  if (!optimizer.Run(spirv.data(), spirv.size(), &optimized))
+    return CompilationError(messages.c_str());
+  return optimized;
+}
+
+} // namespace retort
@@ -1,7 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
 
 namespace retort {
 
@@ -29,6 +36,7 @@ enum struct StorageClass : uint32_t {
   Workgroup = 4,
   CrossWorkgroup = 5,
   Private = 6,
+  PushConstant = 9,
   StorageBuffer = 12,
 };
 
@@ -126,4 +134,445 @@ auto extract_type_info(const uint32_t *spirv, size_t count) -> TypeContext {
   return ctx;
 }
 
+// Whether the shader reads any `ShaderInputs` member that changes between
+// frames, i.e. anything past `resolution`. Loading the whole block counts too.
+auto reads_time_varying_inputs(const uint32_t *spirv, size_t count) -> bool {
+  const uint32_t OP_CONSTANT = 43;
+  const uint32_t OP_VARIABLE = 59;
+  const uint32_t OP_LOAD = 61;
+  const uint32_t OP_ACCESS_CHAIN = 65;
+  const uint32_t OP_IN_BOUNDS_ACCESS_CHAIN = 66;
+
+  std::map<uint32_t, uint32_t> constants;
+  std::set<uint32_t> push_constants;
+
+  uint32_t offset = 5;
+  while (offset < count) {
+    uint32_t instruction = spirv[offset];
+    uint32_t length = instruction >> 16;
+    uint32_t opcode = instruction & 0xFFFF;
+    if (length == 0 || offset + length > count)
+      break;
+
+    auto operand = [&](uint32_t i) { return spirv[offset + 1 + i]; };
+
+    switch (opcode) {
+    case OP_CONSTANT:
+      if (length == 4)
+        constants[operand(1)] = operand(2);
+      break;
+    case OP_VARIABLE:
+      if ((StorageClass)operand(2) == StorageClass::PushConstant)
+        push_constants.insert(operand(1));
+      break;
+    case OP_LOAD:
+      if (push_constants.contains(operand(2)))
+        return true;
+      break;
+    case OP_ACCESS_CHAIN:
+    case OP_IN_BOUNDS_ACCESS_CHAIN: {
+      if (!push_constants.contains(operand(2)))
+        break;
+      if (length < 5)
+        return true;
+      auto member = constants.find(operand(3));
+      if (member == constants.end() || member->second > 0)
+        return true;
+      break;
+    }
+    }
+
+    offset += length;
+  }
+
+  return false;
+}
+
+enum struct DescriptorKind {
+  Sampler,
+  CombinedImageSampler,
+  SampledImage,
+  StorageImage,
+  UniformBuffer,
+  StorageBuffer,
+};
+
+// A resource the shader declares and where it expects it to be bound.
+struct DescriptorBinding {
+  uint32_t set = 0;
+  uint32_t binding = 0;
+  DescriptorKind kind = DescriptorKind::Sampler;
+  // Elements of an array, zero when it is runtime sized
+  uint32_t count = 1;
+};
+
+auto reflect_descriptor_bindings(const uint32_t *spirv, size_t count)
+    -> std::vector<DescriptorBinding> {
+  const uint32_t OP_TYPE_IMAGE = 25;
+  const uint32_t OP_TYPE_SAMPLER = 26;
+  const uint32_t OP_TYPE_SAMPLED_IMAGE = 27;
+  const uint32_t OP_TYPE_ARRAY = 28;
+  const uint32_t OP_TYPE_RUNTIME_ARRAY = 29;
+  const uint32_t OP_TYPE_POINTER = 32;
+  const uint32_t OP_CONSTANT = 43;
+  const uint32_t OP_VARIABLE = 59;
+  const uint32_t OP_DECORATE = 71;
+  const uint32_t DECORATION_BINDING = 33;
+  const uint32_t DECORATION_DESCRIPTOR_SET = 34;
+  const uint32_t IMAGE_IS_STORAGE = 2;
+
+  std::map<uint32_t, uint32_t> constants;
+  std::map<uint32_t, DescriptorKind> resource_types;
+  // Element type and length of array types, length zero when runtime sized
+  std::map<uint32_t, std::pair<uint32_t, uint32_t>> arrays;
+  std::map<uint32_t, uint32_t> pointees;
+  std::map<uint32_t, uint32_t> sets;
+  std::map<uint32_t, uint32_t> bindings;
+  // Variable, its pointer type and its storage class
+  std::vector<std::tuple<uint32_t, uint32_t, StorageClass>> variables;
+
+  uint32_t offset = 5;
+  while (offset < count) {
+    uint32_t instruction = spirv[offset];
+    uint32_t length = instruction >> 16;
+    uint32_t opcode = instruction & 0xFFFF;
+    if (length == 0 || offset + length > count)
+      break;
+
+    auto operand = [&](uint32_t i) { return spirv[offset + 1 + i]; };
+
+    switch (opcode) {
+    case OP_DECORATE:
+      if (length >= 4 && operand(1) == DECORATION_BINDING)
+        bindings[operand(0)] = operand(2);
+      if (length >= 4 && operand(1) == DECORATION_DESCRIPTOR_SET)
+        sets[operand(0)] = operand(2);
+      break;
+    case OP_TYPE_IMAGE:
+      resource_types[operand(0)] = operand(6) == IMAGE_IS_STORAGE
+                                       ? DescriptorKind::StorageImage
+                                       : DescriptorKind::SampledImage;
+      break;
+    case OP_TYPE_SAMPLER:
+      resource_types[operand(0)] = DescriptorKind::Sampler;
+      break;
+    case OP_TYPE_SAMPLED_IMAGE:
+      resource_types[operand(0)] = DescriptorKind::CombinedImageSampler;
+      break;
+    case OP_TYPE_ARRAY:
+      arrays[operand(0)] = {operand(1), constants[operand(2)]};
+      break;
+    case OP_TYPE_RUNTIME_ARRAY:
+      arrays[operand(0)] = {operand(1), 0};
+      break;
+    case OP_TYPE_POINTER:
+      pointees[operand(0)] = operand(2);
+      break;
+    case OP_CONSTANT:
+      if (length == 4)
+        constants[operand(1)] = operand(2);
+      break;
+    case OP_VARIABLE:
+      variables.emplace_back(operand(1), operand(0), (StorageClass)operand(2));
+      break;
+    }
+
+    offset += length;
+  }
+
+  std::vector<DescriptorBinding> result;
+  for (auto [variable, pointer, storage] : variables) {
+    DescriptorBinding binding;
+    binding.set = sets.contains(variable) ? sets[variable] : 0;
+    binding.binding = bindings.contains(variable) ? bindings[variable] : 0;
+
+    auto type = pointees[pointer];
+    if (auto array = arrays.find(type); array != arrays.end()) {
+      type = array->second.first;
+      binding.count = array->second.second;
+    }
+
+    if (storage == StorageClass::Uniform) {
+      binding.kind = DescriptorKind::UniformBuffer;
+    } else if (storage == StorageClass::StorageBuffer) {
+      binding.kind = DescriptorKind::StorageBuffer;
+    } else if (storage == StorageClass::UniformConstant &&
+               resource_types.contains(type)) {
+      binding.kind = resource_types[type];
+    } else {
+      continue;
+    }
+    result.push_back(binding);
+  }
+  return result;
+}
+
+// Whether the shader loads any sampler or image it declares, which is how the
+// audio texture is read.
+auto reads_textures(const uint32_t *spirv, size_t count) -> bool {
+  const uint32_t OP_VARIABLE = 59;
+  const uint32_t OP_LOAD = 61;
+
+  std::set<uint32_t> textures;
+
+  uint32_t offset = 5;
+  while (offset < count) {
+    uint32_t instruction = spirv[offset];
+    uint32_t length = instruction >> 16;
+    uint32_t opcode = instruction & 0xFFFF;
+    if (length == 0 || offset + length > count)
+      break;
+
+    auto operand = [&](uint32_t i) { return spirv[offset + 1 + i]; };
+
+    if (opcode == OP_VARIABLE &&
+        (StorageClass)operand(2) == StorageClass::UniformConstant)
+      textures.insert(operand(1));
+    else if (opcode == OP_LOAD && textures.contains(operand(2)))
+      return true;
+
+    offset += length;
+  }
+
+  return false;
+}
+
+enum struct ScalarKind {
+  Float,
+  Int,
+  Uint,
+};
+
+// A user-defined input of the shader's entry point, e.g. a vertex attribute.
+struct ShaderInput {
+  uint32_t location = 0;
+  ScalarKind kind = ScalarKind::Float;
+  uint32_t component_count = 1;
+};
+
+// Built-ins like `gl_VertexIndex` are left out, as are inputs of a type that
+// is neither a scalar nor a vector.
+auto reflect_shader_inputs(const uint32_t *spirv, size_t count)
+    -> std::vector<ShaderInput> {
+  const uint32_t OP_TYPE_INT = 21;
+  const uint32_t OP_TYPE_FLOAT = 22;
+  const uint32_t OP_TYPE_VECTOR = 23;
+  const uint32_t OP_TYPE_POINTER = 32;
+  const uint32_t OP_VARIABLE = 59;
+  const uint32_t OP_DECORATE = 71;
+  const uint32_t DECORATION_LOCATION = 30;
+
+  std::map<uint32_t, ScalarKind> scalars;
+  // Component type and count of vector types
+  std::map<uint32_t, std::pair<uint32_t, uint32_t>> vectors;
+  std::map<uint32_t, uint32_t> pointees;
+  std::map<uint32_t, uint32_t> locations;
+  // Variable and its pointer type
+  std::vector<std::pair<uint32_t, uint32_t>> variables;
+
+  uint32_t offset = 5;
+  while (offset < count) {
+    uint32_t instruction = spirv[offset];
+    uint32_t length = instruction >> 16;
+    uint32_t opcode = instruction & 0xFFFF;
+    if (length == 0 || offset + length > count)
+      break;
+
+    auto operand = [&](uint32_t i) { return spirv[offset + 1 + i]; };
+
+    switch (opcode) {
+    case OP_DECORATE:
+      if (length >= 4 && operand(1) == DECORATION_LOCATION)
+        locations[operand(0)] = operand(2);
+      break;
+    case OP_TYPE_INT:
+      scalars[operand(0)] = operand(2) ? ScalarKind::Int : ScalarKind::Uint;
+      break;
+    case OP_TYPE_FLOAT:
+      scalars[operand(0)] = ScalarKind::Float;
+      break;
+    case OP_TYPE_VECTOR:
+      vectors[operand(0)] = {operand(1), operand(2)};
+      break;
+    case OP_TYPE_POINTER:
+      pointees[operand(0)] = operand(2);
+      break;
+    case OP_VARIABLE:
+      if ((StorageClass)operand(2) == StorageClass::Input)
+        variables.emplace_back(operand(1), operand(0));
+      break;
+    }
+
+    offset += length;
+  }
+
+  std::vector<ShaderInput> result;
+  for (auto [variable, pointer] : variables) {
+    if (!locations.contains(variable))
+      continue;
+    ShaderInput input;
+    input.location = locations[variable];
+
+    auto type = pointees[pointer];
+    if (auto vector = vectors.find(type); vector != vectors.end()) {
+      type = vector->second.first;
+      input.component_count = vector->second.second;
+    }
+    if (!scalars.contains(type))
+      continue;
+    input.kind = scalars[type];
+    result.push_back(input);
+  }
+  return result;
+}
+
+// A member of a uniform block that holds a 32-bit scalar or vector.
+struct UniformMember {
+  std::string name;
+  uint32_t offset = 0;
+  ScalarKind kind = ScalarKind::Float;
+  uint32_t component_count = 1;
+};
+
+// The members of a uniform block in declaration order. Matrices, arrays,
+// structs and anything not 32 bits wide are only counted.
+struct UniformBlock {
+  std::string name;
+  // Up to the end of the last member that is described
+  uint32_t size = 0;
+  std::vector<UniformMember> members;
+  uint32_t other_member_count = 0;
+};
+
+// The block declared as uniform at `set` and `binding`, if there is one.
+auto reflect_uniform_block(const uint32_t *spirv, size_t count, uint32_t set,
+                           uint32_t binding) -> std::optional<UniformBlock> {
+  const uint32_t OP_NAME = 5;
+  const uint32_t OP_MEMBER_NAME = 6;
+  const uint32_t OP_TYPE_INT = 21;
+  const uint32_t OP_TYPE_FLOAT = 22;
+  const uint32_t OP_TYPE_VECTOR = 23;
+  const uint32_t OP_TYPE_STRUCT = 30;
+  const uint32_t OP_TYPE_POINTER = 32;
+  const uint32_t OP_VARIABLE = 59;
+  const uint32_t OP_DECORATE = 71;
+  const uint32_t OP_MEMBER_DECORATE = 72;
+  const uint32_t DECORATION_BINDING = 33;
+  const uint32_t DECORATION_DESCRIPTOR_SET = 34;
+  const uint32_t DECORATION_OFFSET = 35;
+
+  std::map<uint32_t, std::string> names;
+  std::map<std::pair<uint32_t, uint32_t>, std::string> member_names;
+  std::map<std::pair<uint32_t, uint32_t>, uint32_t> member_offsets;
+  // Kind of 32-bit scalar types
+  std::map<uint32_t, ScalarKind> scalars;
+  // Component type and count of vector types
+  std::map<uint32_t, std::pair<uint32_t, uint32_t>> vectors;
+  std::map<uint32_t, std::vector<uint32_t>> structs;
+  std::map<uint32_t, uint32_t> pointees;
+  std::map<uint32_t, uint32_t> sets;
+  std::map<uint32_t, uint32_t> bindings;
+  // Variable and its pointer type
+  std::vector<std::pair<uint32_t, uint32_t>> variables;
+
+  uint32_t offset = 5;
+  while (offset < count) {
+    uint32_t instruction = spirv[offset];
+    uint32_t length = instruction >> 16;
+    uint32_t opcode = instruction & 0xFFFF;
+    if (length == 0 || offset + length > count)
+      break;
+
+    auto operand = [&](uint32_t i) { return spirv[offset + 1 + i]; };
+    // A literal string starting at operand `i`, null terminated within the
+    // instruction
+    auto string = [&](uint32_t i) {
+      auto chars = (const char *)(spirv + offset + 1 + i);
+      size_t max_size = (length - 1 - i) * sizeof(uint32_t);
+      return std::string(chars, strnlen(chars, max_size));
+    };
+
+    switch (opcode) {
+    case OP_NAME:
+      if (length >= 3)
+        names[operand(0)] = string(1);
+      break;
+    case OP_MEMBER_NAME:
+      if (length >= 4)
+        member_names[{operand(0), operand(1)}] = string(2);
+      break;
+    case OP_DECORATE:
+      if (length >= 4 && operand(1) == DECORATION_BINDING)
+        bindings[operand(0)] = operand(2);
+      if (length >= 4 && operand(1) == DECORATION_DESCRIPTOR_SET)
+        sets[operand(0)] = operand(2);
+      break;
+    case OP_MEMBER_DECORATE:
+      if (length >= 5 && operand(2) == DECORATION_OFFSET)
+        member_offsets[{operand(0), operand(1)}] = operand(3);
+      break;
+    case OP_TYPE_INT:
+      if (operand(1) == 32)
+        scalars[operand(0)] = operand(2) ? ScalarKind::Int : ScalarKind::Uint;
+      break;
+    case OP_TYPE_FLOAT:
+      if (operand(1) == 32)
+        scalars[operand(0)] = ScalarKind::Float;
+      break;
+    case OP_TYPE_VECTOR:
+      vectors[operand(0)] = {operand(1), operand(2)};
+      break;
+    case OP_TYPE_STRUCT:
+      structs[operand(0)] =
+          std::vector<uint32_t>(spirv + offset + 2, spirv + offset + length);
+      break;
+    case OP_TYPE_POINTER:
+      pointees[operand(0)] = operand(2);
+      break;
+    case OP_VARIABLE:
+      if ((StorageClass)operand(2) == StorageClass::Uniform)
+        variables.emplace_back(operand(1), operand(0));
+      break;
+    }
+
+    offset += length;
+  }
+
+  for (auto [variable, pointer] : variables) {
+    auto declared_set = sets.contains(variable) ? sets[variable] : 0;
+    auto declared_binding =
+        bindings.contains(variable) ? bindings[variable] : 0;
+    if (declared_set != set || declared_binding != binding)
+      continue;
+    auto type = pointees[pointer];
+    if (!structs.contains(type))
+      continue;
+
+    UniformBlock block;
+    block.name = names[type];
+    auto &member_types = structs[type];
+    for (uint32_t i = 0; i < member_types.size(); i++) {
+      UniformMember member;
+      member.name = member_names[{type, i}];
+      member.offset = member_offsets[{type, i}];
+
+      auto member_type = member_types[i];
+      if (auto vector = vectors.find(member_type); vector != vectors.end()) {
+        member_type = vector->second.first;
+        member.component_count = vector->second.second;
+      }
+      if (!scalars.contains(member_type)) {
+        block.other_member_count++;
+        continue;
+      }
+      member.kind = scalars[member_type];
+      block.size =
+          std::max(block.size, member.offset + member.component_count * 4);
+      block.members.push_back(member);
+    }
+    return block;
+  }
+  return std::nullopt;
+}
+
 } // namespace retort
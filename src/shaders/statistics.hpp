@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <spirv-tools/libspirv.hpp>
+
+namespace retort {
+
+struct ModuleStatistics {
+  size_t word_count = 0;
+  uint32_t function_count = 0;
+  uint32_t loop_count = 0;
+  // Keyed by opcode name, e.g. "OpFMul"
+  std::map<std::string, uint32_t> opcodes;
+
+  uint32_t count(const std::string &opcode) const {
+    auto it = opcodes.find(opcode);
+    return it == opcodes.end() ? 0 : it->second;
+  }
+};
+
+// What a shader module looked like straight out of shaderc, and after the
+// optimizer if one ran.
+struct ShaderStatistics {
+  ModuleStatistics unoptimized;
+  std::optional<ModuleStatistics> optimized;
+};
+
+// Counts instructions by disassembling the module, which gives opcode names
+// without keeping a table of them here.
+auto module_statistics(std::span<const uint32_t> spirv) -> ModuleStatistics {
+  ModuleStatistics statistics;
+  statistics.word_count = spirv.size();
+
+  spvtools::SpirvTools tools(SPV_ENV_VULKAN_1_2);
+  std::string text;
+  if (!tools.Disassemble(spirv.data(), spirv.size(), &text,
+                         SPV_BINARY_TO_TEXT_OPTION_NO_HEADER))
+    return statistics;
+
+  std::istringstream lines(text);
+  std::string line, word;
+  while (std::getline(lines, line)) {
+    // Either "OpName ..." or "%id = OpName ..."
+    std::istringstream words(line);
+    while (words >> word) {
+      if (word.starts_with("Op")) {
+        statistics.opcodes[word]++;
+        break;
+      }
+    }
+  }
+
+  statistics.function_count = statistics.count("OpFunction");
+  statistics.loop_count = statistics.count("OpLoopMerge");
+  return statistics;
+}
+
+// Opcodes ordered by how often they occur in the unoptimized module.
+auto sorted_opcodes(const ShaderStatistics &statistics)
+    -> std::vector<std::string> {
+  std::vector<std::string> names;
+  for (auto &[name, _] : statistics.unoptimized.opcodes)
+    names.push_back(name);
+  if (statistics.optimized)
+    for (auto &[name, _] : statistics.optimized->opcodes)
+      if (!statistics.unoptimized.opcodes.contains(name))
+        names.push_back(name);
+
+  std::stable_sort(names.begin(), names.end(), [&](auto &a, auto &b) {
+    return statistics.unoptimized.count(a) > statistics.unoptimized.count(b);
+  });
+  return names;
+}
+
+void print_shader_statistics(const std::string &name,
+                             const ShaderStatistics &statistics) {
+  auto &before = statistics.unoptimized;
+  auto &after = statistics.optimized;
+
+  // The optimized column is only there when the optimizer ran
+  auto row = [&](const char *label, size_t unoptimized, size_t optimized) {
+    if (after)
+      fprintf(stderr, "  %-28s %8zu -> %8zu\n", label, unoptimized, optimized);
+    else
+      fprintf(stderr, "  %-28s %8zu\n", label, unoptimized);
+  };
+
+  fprintf(stderr, "%s\n", name.c_str());
+  row("words", before.word_count, after ? after->word_count : 0);
+  row("functions", before.function_count, after ? after->function_count : 0);
+  row("loops", before.loop_count, after ? after->loop_count : 0);
+  for (auto &opcode : sorted_opcodes(statistics))
+    row(opcode.c_str(), before.count(opcode),
+        after ? after->count(opcode) : 0);
+}
+
+} // namespace retort
@@ -0,0 +1,195 @@
+#pragma once
+
+// Shared by retort and external consumers, so this header only depends on the
+// standard library and Win32.
+
+#include <Windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace retort {
+
+const uint32_t SHARED_FRAMES_MAGIC = 0x46525452; // "RTRF"
+const uint32_t SHARED_FRAMES_VERSION = 1;
+const size_t SHARED_FRAMES_ALIGNMENT = 64;
+
+enum struct SharedFrameFormat : uint32_t {
+  Rgba8 = 0,
+  Bgra8 = 1,
+};
+
+struct alignas(SHARED_FRAMES_ALIGNMENT) SharedFrameHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t slot_count;
+  SharedFrameFormat format;
+  uint64_t frame_size;
+  uint64_t slot_stride;
+
+  // One past the index of the newest complete frame, zero before the first.
+  std::atomic<uint64_t> published;
+  // Index of the last frame a consumer finished reading, for diagnostics.
+  std::atomic<uint64_t> consumed;
+};
+
+// Each slot is a seqlock: `sequence` is odd while the producer writes into it
+// and `2 * frame + 2` once `frame` is complete. A reader that sees the same
+// even value before and after copying got an untorn frame.
+struct alignas(SHARED_FRAMES_ALIGNMENT) SharedFrameSlot {
+  std::atomic<uint64_t> sequence;
+  uint64_t frame;
+  // Nanoseconds of `std::chrono::steady_clock`, which is QPC-based and shared
+  // between processes on Windows.
+  int64_t submitted_ns;
+  int64_t published_ns;
+};
+
+struct SharedFrameInfo {
+  uint64_t frame;
+  int64_t submitted_ns;
+  int64_t published_ns;
+};
+
+int64_t shared_frames_now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// A fixed number of frame slots in a named shared memory mapping. One process
+// creates and publishes, any number of processes open and read.
+struct SharedFrameRing {
+  HANDLE mapping = nullptr;
+  uint8_t *base = nullptr;
+  SharedFrameHeader *header = nullptr;
+
+  SharedFrameRing() = default;
+  SharedFrameRing(const SharedFrameRing &) = delete;
+  SharedFrameRing &operator=(const SharedFrameRing &) = delete;
+
+  ~SharedFrameRing() {
+    if (base)
+      UnmapViewOfFile(base);
+    if (mapping)
+      CloseHandle(mapping);
+  }
+
+  static size_t _align(size_t size) {
+    auto mask = SHARED_FRAMES_ALIGNMENT - 1;
+    return (size + mask) & ~mask;
+  }
+
+  bool create(const std::string &name, uint32_t width, uint32_t height,
+              uint32_t slot_count, SharedFrameFormat format) {
+    uint64_t frame_size = (uint64_t)width * height * 4;
+    uint64_t slot_stride = _align(sizeof(SharedFrameSlot) + frame_size);
+    uint64_t size =
+        _align(sizeof(SharedFrameHeader)) + slot_stride * slot_count;
+
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                 (DWORD)(size >> 32), (DWORD)size,
+                                 name.c_str());
+    if (!mapping)
+      return false;
+    if (!_map())
+      return false;
+
+    memset(base, 0, size);
+    header->magic = SHARED_FRAMES_MAGIC;
+    header->version = SHARED_FRAMES_VERSION;
+    header->width = width;
+    header->height = height;
+    header->slot_count = slot_count;
+    header->format = format;
+    header->frame_size = frame_size;
+    header->slot_stride = slot_stride;
+    header->published.store(0, std::memory_order_release);
+
+    return true;
+  }
+
+  bool open(const std::string &name) {
+    mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    if (!mapping)
+      return false;
+    if (!_map())
+      return false;
+    return header->magic == SHARED_FRAMES_MAGIC &&
+           header->version == SHARED_FRAMES_VERSION;
+  }
+
+  bool _map() {
+    base = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    header = (SharedFrameHeader *)base;
+    return base != nullptr;
+  }
+
+  SharedFrameSlot *slot(uint64_t frame) {
+    auto index = frame % header->slot_count;
+    return (SharedFrameSlot *)(base + _align(sizeof(SharedFrameHeader)) +
+                               index * header->slot_stride);
+  }
+
+  uint8_t *pixels(SharedFrameSlot *slot) {
+    return (uint8_t *)slot + sizeof(SharedFrameSlot);
+  }
+
+  // Producer side: the only copy a frame goes through on its way in.
+  void publish(uint64_t frame, const void *pixels_in, int64_t submitted_ns) {
+    auto target = slot(frame);
+
+    target->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(pixels(target), pixels_in, header->frame_size);
+    target->frame = frame;
+    target->submitted_ns = submitted_ns;
+    target->published_ns = shared_frames_now_ns();
+
+    target->sequence.store(2 * frame + 2, std::memory_order_release);
+    header->published.store(frame + 1, std::memory_order_release);
+  }
+
+  // Consumer side: copies the newest complete frame if it is newer than
+  // `after`. Retries when the producer laps the slot mid-copy.
+  auto read_latest(std::optional<uint64_t> after, std::vector<uint8_t> &out)
+      -> std::optional<SharedFrameInfo> {
+    out.resize(header->frame_size);
+
+    while (true) {
+      auto published = header->published.load(std::memory_order_acquire);
+      if (published == 0)
+        return std::nullopt;
+
+      auto frame = published - 1;
+      if (after && frame <= after.value())
+        return std::nullopt;
+
+      auto source = slot(frame);
+      auto before = source->sequence.load(std::memory_order_acquire);
+      if (before != 2 * frame + 2)
+        continue;
+
+      SharedFrameInfo info = {source->frame, source->submitted_ns,
+                              source->published_ns};
+      memcpy(out.data(), pixels(source), header->frame_size);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (source->sequence.load(std::memory_order_relaxed) != before)
+        continue;
+
+      header->consumed.store(frame, std::memory_order_release);
+      return info;
+    }
+  }
+};
+
+} // namespace retort
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace retort {
+
+struct StartupPhase {
+  std::string name;
+  std::thread::id thread;
+  double begin_ms;
+  double end_ms;
+};
+
+// Collects how long each startup step took and on which thread, so that
+// overlapping work shows up as overlapping ranges.
+struct StartupTimes {
+  std::mutex _mutex;
+  std::chrono::steady_clock::time_point origin =
+      std::chrono::steady_clock::now();
+  std::vector<StartupPhase> phases;
+
+  double now_ms() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now() - origin).count();
+  }
+
+  void add(StartupPhase phase) {
+    std::lock_guard lock(_mutex);
+    phases.push_back(std::move(phase));
+  }
+
+  void print() {
+    std::lock_guard lock(_mutex);
+
+    std::vector<std::thread::id> threads;
+    auto sorted = phases;
+    std::sort(sorted.begin(), sorted.end(),
+              [](auto &a, auto &b) { return a.begin_ms < b.begin_ms; });
+
+    double total = 0.;
+    fprintf(stderr, "%-32s %6s %9s %9s %9s\n", "startup phase", "thread",
+            "begin", "end", "took");
+    for (auto &phase : sorted) {
+      auto it = std::find(threads.begin(), threads.end(), phase.thread);
+      if (it == threads.end())
+        it = threads.insert(threads.end(), phase.thread);
+
+      fprintf(stderr, "%-32s %6zu %7.2fms %7.2fms %7.2fms\n",
+              phase.name.c_str(), (size_t)(it - threads.begin()),
+              phase.begin_ms, phase.end_ms, phase.end_ms - phase.begin_ms);
+      total = std::max(total, phase.end_ms);
+    }
+    fprintf(stderr, "%-32s %6s %9s %7.2fms\n", "total", "", "", total);
+  }
+};
+
+StartupTimes &startup_times() {
+  static StartupTimes instance;
+  return instance;
+}
+
+// Records the enclosing scope as one startup phase.
+struct StartupScope {
+  std::string name;
+  double begin_ms;
+
+  StartupScope(std::string name)
+      : name(std::move(name)), begin_ms(startup_times().now_ms()) {}
+
+  ~StartupScope() {
+    auto &times = startup_times();
+    times.add({name, std::this_thread::get_id(), begin_ms, times.now_ms()});
+  }
+};
+
+} // namespace retort
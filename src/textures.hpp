@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include <stb_image.h>
+
+#include "memory.hpp"
+#include "shaders/interface.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// An image file shaders sample as `retort_textures[index]`.
+struct Texture {
+  std::filesystem::path path;
+  Image image;
+};
+
+// Every texture goes into one descriptor set that is allocated once with room
+// for `TEXTURE_TABLE_SIZE` of them. Adding or replacing one writes a single
+// descriptor, the set, its layout and its pool stay as they are.
+struct TextureTable {
+  VkDescriptorSet set = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+  // Indexed the same way as the descriptors
+  std::vector<Texture> textures;
+
+  std::optional<uint32_t> find(const std::filesystem::path &path) {
+    for (size_t i = 0; i < textures.size(); i++)
+      if (textures[i].path == path)
+        return (uint32_t)i;
+    return std::nullopt;
+  }
+
+  bool is_full() { return textures.size() >= TEXTURE_TABLE_SIZE; }
+};
+
+VkSampler create_texture_sampler(vkb::DispatchTable &dispatch) {
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = VK_FILTER_LINEAR;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+  VkSampler sampler;
+  CHECK_VK_ERRC(dispatch.createSampler(&sampler_info, nullptr, &sampler));
+  return sampler;
+}
+
+void write_texture_descriptor(vkb::DispatchTable &dispatch,
+                              const TextureTable &table, uint32_t index) {
+  VkDescriptorImageInfo image_info = {};
+  image_info.sampler = table.sampler;
+  image_info.imageView = table.textures[index].image.view;
+  image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = table.set;
+  write.dstBinding = 0;
+  write.dstArrayElement = index;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  write.pImageInfo = &image_info;
+  dispatch.updateDescriptorSets(1, &write, 0, nullptr);
+}
+
+// Decodes an image file into a host-visible buffer of RGBA8 pixels, ready to
+// be copied into an image of `extent`.
+auto read_texture_file(vkb::DispatchTable &dispatch,
+                       const VkPhysicalDeviceMemoryProperties &props,
+                       const std::filesystem::path &path, VkExtent2D &extent,
+                       std::string &error) -> std::optional<Buffer> {
+  int width, height, channels;
+  std::unique_ptr<stbi_uc, void (*)(void *)> pixels(
+      stbi_load(path.string().c_str(), &width, &height, &channels, 4),
+      stbi_image_free);
+  if (!pixels) {
+    error = path.string() + ": " + stbi_failure_reason();
+    return std::nullopt;
+  }
+
+  extent = {(uint32_t)width, (uint32_t)height};
+  auto size = (VkDeviceSize)width * height * 4;
+  auto buffer = create_buffer(dispatch, props, size,
+                              VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  memcpy(buffer.mapped, pixels.get(), size);
+  return buffer;
+}
+
+} // namespace retort
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "tracing.hpp"
+
+namespace retort {
+
+struct ThreadPool {
+  std::vector<std::thread> _workers;
+  std::queue<std::function<void()>> _jobs;
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  bool _stopping = false;
+
+  static inline thread_local size_t _current_worker = SIZE_MAX;
+
+  ThreadPool(
+      size_t thread_count = std::max(1u, std::thread::hardware_concurrency())) {
+    for (size_t i = 0; i < thread_count; i++)
+      _workers.emplace_back([this, i]() { _worker_loop(i); });
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(_mutex);
+      _stopping = true;
+    }
+    _condition.notify_all();
+    for (auto &worker : _workers)
+      worker.join();
+  }
+
+  size_t size() const { return _workers.size(); }
+
+  // Index of the calling worker in `[0, size())`, used to pick per-thread
+  // resources. Threads not owned by a pool get `SIZE_MAX`.
+  static size_t worker_index() { return _current_worker; }
+
+  template <typename F>
+  auto submit(F &&job) -> std::future<std::invoke_result_t<F>> {
+    using R = std::invoke_result_t<F>;
+
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(job));
+    auto future = task->get_future();
+    {
+      std::lock_guard lock(_mutex);
+      _jobs.emplace([task]() { (*task)(); });
+    }
+    _condition.notify_one();
+
+    return future;
+  }
+
+  // Runs `job(i)` for every `i` in `[0, count)` and blocks until all are done.
+  template <typename F> void parallel_for(size_t count, F &&job) {
+    std::vector<std::future<void>> futures;
+    futures.reserve(count);
+    for (size_t i = 0; i < count; i++)
+      futures.push_back(submit([&job, i]() { job(i); }));
+    for (auto &future : futures)
+      future.get();
+  }
+
+  void _worker_loop(size_t index) {
+    _current_worker = index;
+    TRACE_THREAD_NAME("worker " + std::to_string(index));
+
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock lock(_mutex);
+        _condition.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+        if (_stopping && _jobs.empty())
+          return;
+        job = std::move(_jobs.front());
+        _jobs.pop();
+      }
+      job();
+    }
+  }
+};
+
+} // namespace retort
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "export.hpp"
+#include "offscreen.hpp"
+#include "options.hpp"
+#include "readback.hpp"
+#include "renderer.hpp"
+#include "threading.hpp"
+#include "timeline.hpp"
+
+namespace retort {
+
+struct TiledSettings {
+  std::filesystem::path path;
+  std::string output;
+  // Of the whole image
+  VkExtent2D extent;
+  uint32_t tile_size;
+  size_t ring_size;
+};
+
+// The viewport does not move `gl_FragCoord`, so every tile is compiled with
+// its offset in the whole image added to it.
+ShaderDefines tile_defines(VkOffset2D offset) {
+  char value[96];
+  snprintf(value, sizeof(value), "(gl_FragCoord + vec4(%d., %d., 0., 0.))",
+           offset.x, offset.y);
+  return {{"gl_FragCoord", value}};
+}
+
+using TileShader = Result<PreparedShader, CompilationError>;
+
+// Renders a single still at a size no image on the device could hold, one
+// tile at a time. Tiles go through a ring of readback buffers and a writer
+// thread puts each of their rows right where it belongs in the PPM file, so
+// at most the tiles in the ring are ever in memory. Their pipelines are
+// compiled on the pool only a ring's worth of tiles ahead and destroyed once
+// their readback has landed.
+struct TiledExporter {
+  Renderer &renderer;
+  ThreadPool &pool;
+  TiledSettings settings;
+  uint32_t columns;
+  uint32_t rows;
+  OffscreenTarget target;
+  ReadbackRing ring;
+
+  bool is_bgra;
+  FILE *file = nullptr;
+  // Where the pixels start, after the header
+  long long _data_offset = 0;
+  std::vector<uint8_t> _rgb;
+
+  std::string _source;
+  // Per worker, like when prewarming
+  std::vector<Compiler> _compilers;
+  std::vector<VkPipelineCache> _caches;
+  // The tiles from the next one to render on, in order
+  std::deque<std::future<TileShader>> _compiling;
+  uint32_t _next_compiled_tile = 0;
+  // Pipelines of submitted tiles
+  DeferredWork _retired;
+
+  std::chrono::steady_clock::time_point _start;
+
+  TiledExporter(Renderer &renderer, ThreadPool &pool, TiledSettings settings)
+      : renderer(renderer), pool(pool), settings(settings),
+        columns((settings.extent.width + settings.tile_size - 1) /
+                settings.tile_size),
+        rows((settings.extent.height + settings.tile_size - 1) /
+             settings.tile_size),
+        target(create_offscreen_target(
+            renderer.dispatch, renderer.physical_device.memory_properties,
+            renderer.surface_format.format,
+            {std::min(settings.tile_size, settings.extent.width),
+             std::min(settings.tile_size, settings.extent.height)})),
+        ring(renderer.dispatch, *renderer.render_data.timeline,
+             renderer.physical_device.memory_properties,
+             renderer.device.get_queue_index(vkb::QueueType::graphics).value(),
+             settings.ring_size, _tile_bytes()),
+        _source(utils::read_file(settings.path.string().c_str())),
+        _compilers(pool.size()), _caches(pool.size(), VK_NULL_HANDLE) {
+    is_bgra = is_bgra_format(renderer.surface_format.format);
+
+    VkPipelineCacheCreateInfo cache_info = {};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    for (auto &cache : _caches)
+      CHECK_VK_ERRC(
+          renderer.dispatch.createPipelineCache(&cache_info, nullptr, &cache));
+  }
+
+  ~TiledExporter() {
+    for (auto &compiling : _compiling) {
+      auto shader = compiling.get();
+      if (shader)
+        renderer.destroy_prepared_shader(shader.unwrap());
+    }
+    if (file)
+      fclose(file);
+
+    auto &dispatch = renderer.dispatch;
+    CHECK_VK_ERRC(dispatch.deviceWaitIdle());
+    _retired.run_completed(*renderer.render_data.timeline);
+    CHECK_VK_ERRC(dispatch.mergePipelineCaches(
+        renderer.render_data.pipeline_cache, (uint32_t)_caches.size(),
+        _caches.data()));
+    for (auto cache : _caches)
+      dispatch.destroyPipelineCache(cache, nullptr);
+    destroy_offscreen_target(dispatch, target);
+  }
+
+  uint32_t tile_count() const { return columns * rows; }
+
+  VkDeviceSize _tile_bytes() const {
+    auto edge = (VkDeviceSize)settings.tile_size;
+    return std::min<VkDeviceSize>(edge, settings.extent.width) *
+           std::min<VkDeviceSize>(edge, settings.extent.height) * 4;
+  }
+
+  VkRect2D tile_rect(uint32_t tile) const {
+    auto size = settings.tile_size;
+    auto x = tile % columns * size;
+    auto y = tile / columns * size;
+    VkRect2D rect;
+    rect.offset = {(int32_t)x, (int32_t)y};
+    rect.extent = {std::min(size, settings.extent.width - x),
+                   std::min(size, settings.extent.height - y)};
+    return rect;
+  }
+
+  // A shader that does not compile fails every tile, so the first tile is
+  // compiled before the file is created.
+  bool run() {
+    auto shader = _next_shader();
+    if (!shader)
+      return false;
+
+    file = fopen(settings.output.c_str(), "wb");
+    if (!file) {
+      std::cerr << "retort: cannot open " << settings.output
+                << " for writing" << std::endl;
+      renderer.destroy_prepared_shader(shader.value());
+      return false;
+    }
+    fprintf(file, "P6\n%u %u\n255\n", settings.extent.width,
+            settings.extent.height);
+    _data_offset = _ftelli64(file);
+
+    _start = std::chrono::steady_clock::now();
+    std::thread writer([this]() { _writer_loop(); });
+    uint32_t tile = 0;
+    while (shader) {
+      _render_tile(tile, shader.value());
+      shader.reset();
+      if (++tile < tile_count())
+        shader = _next_shader();
+    }
+    ring.close();
+    writer.join();
+    if (tile < tile_count())
+      return false;
+
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - _start)
+                       .count();
+    std::cerr << "\nwrote " << settings.extent.width << "x"
+              << settings.extent.height << " in " << tile_count()
+              << " tiles in " << seconds << "s" << std::endl;
+    return true;
+  }
+
+  // The pipeline of the next tile, with up to a ring's worth of the tiles
+  // after it compiling meanwhile. Prints why when it did not compile.
+  std::optional<PreparedShader> _next_shader() {
+    while (_next_compiled_tile < tile_count() &&
+           _compiling.size() <= settings.ring_size)
+      _compiling.push_back(_compile_tile(_next_compiled_tile++));
+
+    auto shader = _compiling.front().get();
+    _compiling.pop_front();
+    _retired.run_completed(*renderer.render_data.timeline);
+    if (!shader) {
+      std::cerr << shader.unwrap_err().messages << std::endl;
+      return std::nullopt;
+    }
+    return shader.unwrap();
+  }
+
+  std::future<TileShader> _compile_tile(uint32_t tile) {
+    auto recipe = renderer.optimizer_recipe;
+    return pool.submit([this, tile, recipe]() {
+      TRACE_SCOPE("TiledExporter::compile_tile");
+      auto worker = ThreadPool::worker_index();
+      ShaderVariant variant{settings.path.string(), settings.path,
+                            tile_defines(tile_rect(tile).offset)};
+      auto hash = shader_origin_hash(_source, variant.defines, recipe);
+      return renderer.compile_shader_variant(variant, _source, recipe, hash,
+                                             _compilers[worker],
+                                             _caches[worker]);
+    });
+  }
+
+  void _render_tile(uint32_t tile, const PreparedShader &shader) {
+    TRACE_SCOPE("TiledExporter::render_tile");
+    auto index = ring.acquire(tile);
+    auto &slot = ring.slots[index];
+    auto &dispatch = renderer.dispatch;
+    auto rect = tile_rect(tile);
+
+    ShaderInputs inputs = {};
+    inputs.resolution[0] = (float)settings.extent.width;
+    inputs.resolution[1] = (float)settings.extent.height;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_VK_ERRC(
+        dispatch.beginCommandBuffer(slot.command_buffer, &begin_info));
+
+    renderer.record_shader_pass(slot.command_buffer, shader.graphics_pipeline,
+                                target.render_pass, target.framebuffer,
+                                rect.extent, inputs);
+    record_readback(dispatch, slot.command_buffer, target, slot.buffer.buffer,
+                    0, {{0, 0}, rect.extent});
+
+    CHECK_VK_ERRC(dispatch.endCommandBuffer(slot.command_buffer));
+
+    ring.submit(index, renderer.render_data.graphics_queue);
+    _retired.defer(slot.timeline_value, [this, shader]() {
+      renderer.destroy_prepared_shader(shader);
+    });
+  }
+
+  void _writer_loop() {
+    TRACE_THREAD_NAME("tile writer");
+    while (auto index = ring.next()) {
+      auto &slot = ring.slots[index.value()];
+      // The slot is the render thread's again once released
+      auto tile = (uint32_t)slot.frame;
+      _write_tile(tile, (const uint8_t *)slot.buffer.mapped);
+      ring.release(index.value());
+      fprintf(stderr, "\rwrote %u/%u tiles", tile + 1, tile_count());
+    }
+  }
+
+  // Row by row, each one seeks to where it starts in the whole image.
+  void _write_tile(uint32_t tile, const uint8_t *pixels) {
+    TRACE_SCOPE("TiledExporter::write_tile");
+    auto rect = tile_rect(tile);
+    auto width = rect.extent.width;
+    for (uint32_t y = 0; y < rect.extent.height; y++) {
+      pack_rgb(pixels + (size_t)y * width * 4, width, is_bgra, _rgb);
+      auto pixel = ((long long)rect.offset.y + y) * settings.extent.width +
+                   rect.offset.x;
+      _fseeki64(file, _data_offset + pixel * 3, SEEK_SET);
+      fwrite(_rgb.data(), 1, _rgb.size(), file);
+    }
+  }
+};
+
+int run_tiled_export(Bootstrap bootstrap, const Options &options) {
+  if (options.export_format != "ppm")
+    usage_error("tiled stills are written as ppm");
+  if (options.export_output.value() == "-")
+    usage_error("tiled stills are written to a file");
+
+  Renderer renderer(bootstrap);
+  renderer.optimizer_recipe = options.optimizer_recipe;
+  if (options.print_startup_times)
+    startup_times().print();
+  if (!renderer.load_textures(options.textures))
+    return 1;
+
+  TiledSettings settings;
+  settings.path = options.files[0];
+  settings.output = options.export_output.value();
+  settings.extent = {options.width, options.height};
+  settings.tile_size =
+      std::min(options.tile_size,
+               renderer.physical_device.properties.limits.maxImageDimension2D);
+  settings.ring_size = options.ring_size;
+
+  ThreadPool pool;
+  TiledExporter exporter(renderer, pool, settings);
+  fprintf(stderr, "rendering %u tiles of at most %ux%u\n",
+          exporter.tile_count(), settings.tile_size, settings.tile_size);
+  return exporter.run() ? 0 : 1;
+}
+
+} // namespace retort
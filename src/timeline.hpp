@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "tracing.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+// A timeline semaphore counting the submissions to one queue. Every
+// submission signals the next value, so that waiting for a frame, a readback
+// or a resource to be released is a wait for a number.
+//
+// Values are handed out by the thread that submits to the queue, any thread
+// may wait.
+struct QueueTimeline {
+  vkb::DispatchTable dispatch;
+  VkSemaphore semaphore = VK_NULL_HANDLE;
+  // The last value a submission was told to signal
+  uint64_t submitted = 0;
+  // The GPU has been seen to reach at least this far
+  std::atomic<uint64_t> _completed = 0;
+
+  QueueTimeline(vkb::DispatchTable dispatch) : dispatch(dispatch) {
+    VkSemaphoreTypeCreateInfo type_info = {};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_info = {};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &type_info;
+    CHECK_VK_ERRC(
+        this->dispatch.createSemaphore(&semaphore_info, nullptr, &semaphore));
+  }
+
+  QueueTimeline(const QueueTimeline &) = delete;
+  QueueTimeline &operator=(const QueueTimeline &) = delete;
+
+  ~QueueTimeline() {
+    wait(submitted);
+    dispatch.destroySemaphore(semaphore, nullptr);
+  }
+
+  uint64_t next() { return ++submitted; }
+
+  void _observe(uint64_t value) {
+    auto completed = _completed.load();
+    while (completed < value &&
+           !_completed.compare_exchange_weak(completed, value))
+      ;
+  }
+
+  // Only asks the driver when the cached value is not far enough along.
+  bool is_complete(uint64_t value) {
+    if (_completed.load() >= value)
+      return true;
+    uint64_t counter = 0;
+    CHECK_VK_ERRC(dispatch.getSemaphoreCounterValue(semaphore, &counter));
+    _observe(counter);
+    return counter >= value;
+  }
+
+  void wait(uint64_t value) {
+    if (_completed.load() >= value)
+      return;
+
+    TRACE_SCOPE("QueueTimeline::wait");
+    VkSemaphoreWaitInfo wait_info = {};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &semaphore;
+    wait_info.pValues = &value;
+    CHECK_VK_ERRC(dispatch.waitSemaphores(&wait_info, UINT64_MAX));
+    _observe(value);
+  }
+};
+
+// Chained into a submission, gives each of its signal semaphores the value at
+// the same index. Binary semaphores ignore theirs.
+struct TimelineSignal {
+  VkTimelineSemaphoreSubmitInfo info = {};
+  std::vector<uint64_t> values;
+
+  TimelineSignal(size_t semaphore_count) : values(semaphore_count, 0) {
+    info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  }
+
+  void chain(VkSubmitInfo &submit_info) {
+    info.signalSemaphoreValueCount = (uint32_t)values.size();
+    info.pSignalSemaphoreValues = values.data();
+    submit_info.pNext = &info;
+  }
+};
+
+// Work that has to wait until the GPU is done with something, like
+// destroying a pipeline that frames in flight still draw with.
+struct DeferredWork {
+  std::deque<std::pair<uint64_t, std::function<void()>>> _pending;
+
+  // Runs `work` once `timeline` reaches `value`.
+  void defer(uint64_t value, std::function<void()> work) {
+    _pending.emplace_back(value, std::move(work));
+  }
+
+  void run_completed(QueueTimeline &timeline) {
+    while (!_pending.empty() && timeline.is_complete(_pending.front().first)) {
+      auto work = std::move(_pending.front().second);
+      _pending.pop_front();
+      work();
+    }
+  }
+};
+
+} // namespace retort
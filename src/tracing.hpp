@@ -0,0 +1,185 @@
+#pragma once
+
+// Scoped CPU trace spans, dumped on demand as Chrome trace JSON (loadable in
+// chrome://tracing and Perfetto). Everything compiles out unless the build
+// defines RETORT_TRACING.
+
+#ifdef RETORT_TRACING
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace retort::tracing {
+
+const size_t EVENTS_PER_THREAD = 1 << 16;
+
+struct Event {
+  // Must point to a string with static storage duration.
+  const char *name;
+  int64_t begin_ns;
+  int64_t end_ns;
+};
+
+// Written by its owning thread only. The dumping thread reads `head` to find
+// the newest events and re-checks it afterwards to drop overwritten ones.
+struct ThreadBuffer {
+  uint32_t thread_id;
+  std::string thread_name;
+  std::array<Event, EVENTS_PER_THREAD> events;
+  std::atomic<uint64_t> head = 0;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  std::chrono::steady_clock::time_point epoch =
+      std::chrono::steady_clock::now();
+};
+
+Registry &registry() {
+  static Registry instance;
+  return instance;
+}
+
+int64_t now_ns() {
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now() - registry().epoch)
+      .count();
+}
+
+ThreadBuffer &thread_buffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+    auto &reg = registry();
+    std::lock_guard lock(reg.mutex);
+    auto created = std::make_shared<ThreadBuffer>();
+    created->thread_id = (uint32_t)reg.buffers.size();
+    created->thread_name = "thread " + std::to_string(created->thread_id);
+    reg.buffers.push_back(created);
+    return created;
+  }();
+  return *buffer;
+}
+
+void set_thread_name(std::string name) {
+  auto &buffer = thread_buffer();
+  std::lock_guard lock(registry().mutex);
+  buffer.thread_name = std::move(name);
+}
+
+void record(const char *name, int64_t begin_ns, int64_t end_ns) {
+  auto &buffer = thread_buffer();
+  auto head = buffer.head.load(std::memory_order_relaxed);
+  buffer.events[head % EVENTS_PER_THREAD] = {name, begin_ns, end_ns};
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+struct Scope {
+  const char *name;
+  int64_t begin_ns;
+
+  Scope(const char *name) : name(name), begin_ns(now_ns()) {}
+  ~Scope() { record(name, begin_ns, now_ns()); }
+};
+
+void _write_json_string(std::ofstream &out, const char *str) {
+  out << '"';
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      out << '\\';
+    out << *str;
+  }
+  out << '"';
+}
+
+// Writes the most recent events of every thread that ever traced. Safe to call
+// while other threads keep recording.
+bool dump_chrome_trace(const std::string &path) {
+  std::ofstream out(path);
+  if (!out.is_open())
+    return false;
+
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  std::vector<std::string> names;
+  {
+    auto &reg = registry();
+    std::lock_guard lock(reg.mutex);
+    buffers = reg.buffers;
+    for (auto &buffer : buffers)
+      names.push_back(buffer->thread_name);
+  }
+
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool is_first = true;
+  auto separator = [&]() {
+    if (!is_first)
+      out << ",\n";
+    is_first = false;
+  };
+
+  std::vector<Event> events;
+  for (size_t i = 0; i < buffers.size(); i++) {
+    auto &buffer = *buffers[i];
+
+    separator();
+    out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+        << buffer.thread_id << ",\"args\":{\"name\":";
+    _write_json_string(out, names[i].c_str());
+    out << "}}";
+
+    auto head = buffer.head.load(std::memory_order_acquire);
+    auto first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+    events.clear();
+    for (auto j = first; j < head; j++)
+      events.push_back(buffer.events[j % EVENTS_PER_THREAD]);
+
+    // Anything the owner overwrote while we were copying is garbage
+    auto new_head = buffer.head.load(std::memory_order_acquire);
+    auto valid_from = new_head > EVENTS_PER_THREAD
+                          ? new_head - EVENTS_PER_THREAD
+                          : 0;
+
+    for (auto j = first; j < head; j++) {
+      if (j < valid_from)
+        continue;
+      auto &event = events[j - first];
+      separator();
+      out << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.thread_id
+          << ",\"ts\":" << event.begin_ns / 1000.
+          << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1000.
+          << ",\"name\":";
+      _write_json_string(out, event.name);
+      out << "}";
+    }
+  }
+
+  out << "]}\n";
+  return out.good();
+}
+
+} // namespace retort::tracing
+
+#define _RETORT_TRACE_CONCAT_INNER(a, b) a##b
+#define _RETORT_TRACE_CONCAT(a, b) _RETORT_TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name)                                                      \
+  retort::tracing::Scope _RETORT_TRACE_CONCAT(_trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) retort::tracing::set_thread_name(name)
+
+#else
+
+#define TRACE_SCOPE(name)                                                      \
+  do {                                                                         \
+  } while (0)
+#define TRACE_THREAD_NAME(name)                                                \
+  do {                                                                         \
+  } while (0)
+
+#endif
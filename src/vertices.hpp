@@ -0,0 +1,505 @@
+#pragma once
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <VkBootstrap.h>
+#include <vulkan/vulkan.h>
+
+#include "memory.hpp"
+#include "shaders/reflection.hpp"
+#include "timeline.hpp"
+#include "tracing.hpp"
+#include "utils.hpp"
+
+namespace retort {
+
+const uint32_t VERTEX_FILE_MAGIC = 0x58545652; // "RVTX"
+const uint32_t VERTEX_FILE_VERSION = 1;
+
+// Vertices are split into device local buffers of at most this size.
+const VkDeviceSize VERTEX_CHUNK_BYTES = 64ull << 20;
+// Host visible buffers the loader thread fills from the file ahead of the GPU
+const size_t VERTEX_STAGING_COUNT = 4;
+const VkDeviceSize VERTEX_STAGING_BYTES = 16ull << 20;
+
+enum struct VertexFormat : uint32_t {
+  Float = 1,
+  Float2 = 2,
+  Float3 = 3,
+  Float4 = 4,
+  Unorm8x4 = 5,
+  Uint = 6,
+};
+
+// At the very start of a vertex file, followed by `attribute_count`
+// attributes. The vertices are tightly packed from `data_offset` on.
+struct VertexFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t vertex_count;
+  uint64_t data_offset;
+  uint32_t stride;
+  uint32_t attribute_count;
+};
+
+struct VertexAttribute {
+  uint32_t location;
+  VertexFormat format;
+  // Bytes from the start of the vertex
+  uint32_t offset;
+};
+
+struct VertexFormatInfo {
+  VkFormat format;
+  // What the shader reads it as
+  ScalarKind kind;
+  uint32_t component_count;
+  uint32_t size;
+};
+
+auto describe_vertex_format(VertexFormat format)
+    -> std::optional<VertexFormatInfo> {
+  switch (format) {
+  case VertexFormat::Float:
+    return VertexFormatInfo{VK_FORMAT_R32_SFLOAT, ScalarKind::Float, 1, 4};
+  case VertexFormat::Float2:
+    return VertexFormatInfo{VK_FORMAT_R32G32_SFLOAT, ScalarKind::Float, 2, 8};
+  case VertexFormat::Float3:
+    return VertexFormatInfo{VK_FORMAT_R32G32B32_SFLOAT, ScalarKind::Float, 3,
+                            12};
+  case VertexFormat::Float4:
+    return VertexFormatInfo{VK_FORMAT_R32G32B32A32_SFLOAT, ScalarKind::Float,
+                            4, 16};
+  case VertexFormat::Unorm8x4:
+    return VertexFormatInfo{VK_FORMAT_R8G8B8A8_UNORM, ScalarKind::Float, 4, 4};
+  case VertexFormat::Uint:
+    return VertexFormatInfo{VK_FORMAT_R32_UINT, ScalarKind::Uint, 1, 4};
+  }
+  return std::nullopt;
+}
+
+struct VertexLayout {
+  uint64_t vertex_count = 0;
+  uint64_t data_offset = 0;
+  uint32_t stride = 0;
+  std::vector<VertexAttribute> attributes;
+
+  uint64_t data_size() const { return vertex_count * stride; }
+};
+
+auto parse_vertex_layout(const uint8_t *data, uint64_t size,
+                         std::string &error) -> std::optional<VertexLayout> {
+  VertexFileHeader header;
+  if (size < sizeof(header)) {
+    error = "too short for a vertex file header";
+    return std::nullopt;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != VERTEX_FILE_MAGIC) {
+    error = "not a vertex file";
+    return std::nullopt;
+  }
+  if (header.version != VERTEX_FILE_VERSION) {
+    error = "vertex file of version " + std::to_string(header.version) +
+            ", expected " + std::to_string(VERTEX_FILE_VERSION);
+    return std::nullopt;
+  }
+
+  auto attributes_end = sizeof(header) + (uint64_t)header.attribute_count *
+                                             sizeof(VertexAttribute);
+  if (attributes_end > size || header.data_offset < attributes_end) {
+    error = "the attributes overlap the vertices";
+    return std::nullopt;
+  }
+  if (header.stride == 0 || header.vertex_count == 0) {
+    error = "no vertices";
+    return std::nullopt;
+  }
+  if (header.data_offset > size ||
+      header.vertex_count > (size - header.data_offset) / header.stride) {
+    error = "ends before its " + std::to_string(header.vertex_count) +
+            " vertices do";
+    return std::nullopt;
+  }
+
+  VertexLayout layout;
+  layout.vertex_count = header.vertex_count;
+  layout.data_offset = header.data_offset;
+  layout.stride = header.stride;
+  layout.attributes.resize(header.attribute_count);
+  memcpy(layout.attributes.data(), data + sizeof(header),
+         layout.attributes.size() * sizeof(VertexAttribute));
+
+  for (auto &attribute : layout.attributes) {
+    auto info = describe_vertex_format(attribute.format);
+    auto location = std::to_string(attribute.location);
+    if (!info) {
+      error = "unknown format of location " + location;
+      return std::nullopt;
+    }
+    if (attribute.offset + info->size > layout.stride) {
+      error = "location " + location + " reaches past the vertex stride";
+      return std::nullopt;
+    }
+  }
+  return layout;
+}
+
+const char *scalar_kind_name(ScalarKind kind) {
+  switch (kind) {
+  case ScalarKind::Float:
+    return "float";
+  case ScalarKind::Int:
+    return "int";
+  case ScalarKind::Uint:
+    return "uint";
+  }
+  return "?";
+}
+
+// Every input of the vertex shader needs an attribute that it reads as the
+// same type. Attributes the shader does not declare are fine.
+auto check_vertex_inputs(const VertexLayout &layout,
+                         std::span<const ShaderInput> inputs)
+    -> std::optional<std::string> {
+  for (auto &input : inputs) {
+    auto location = std::to_string(input.location);
+    auto attribute = std::find_if(
+        layout.attributes.begin(), layout.attributes.end(),
+        [&](auto &attribute) { return attribute.location == input.location; });
+    if (attribute == layout.attributes.end())
+      return "the vertex file has nothing at location " + location;
+
+    auto info = describe_vertex_format(attribute->format).value();
+    if (info.kind != input.kind ||
+        info.component_count != input.component_count)
+      return "location " + location + " is " +
+             std::to_string(input.component_count) + " " +
+             scalar_kind_name(input.kind) + "s in the shader but " +
+             std::to_string(info.component_count) + " " +
+             scalar_kind_name(info.kind) + "s in the vertex file";
+  }
+  return std::nullopt;
+}
+
+// A whole file mapped read only, paged in as it is read.
+struct MappedFile {
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+  const uint8_t *data = nullptr;
+  uint64_t size = 0;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+    if (data)
+      UnmapViewOfFile(data);
+    if (mapping)
+      CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+      CloseHandle(file);
+  }
+
+  bool open(const std::filesystem::path &path) {
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+      return false;
+    size = (uint64_t)file_size.QuadPart;
+
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+      return false;
+    data = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    return data != nullptr;
+  }
+};
+
+struct VertexChunk {
+  // Created once the first bytes for it are staged
+  Buffer buffer;
+  VkDeviceSize uploaded = 0;
+};
+
+struct VertexStaging {
+  Buffer buffer;
+  // Where in the vertex data the staged bytes start
+  VkDeviceSize source_offset = 0;
+  VkDeviceSize size = 0;
+  // What the queue timeline reaches once the copy out of it is done
+  uint64_t timeline_value = 0;
+};
+
+struct VertexDraw {
+  VkBuffer buffer;
+  uint32_t vertex_count;
+};
+
+// Streams the vertices of a mapped file into device local buffers. A loader
+// thread copies the file into free staging buffers, so that page faults and
+// disk reads stay off the render loop, which then records the copies out of
+// them into each frame. Chunks are drawn as far as they have arrived.
+struct VertexStream {
+  vkb::DispatchTable dispatch;
+  QueueTimeline &timeline;
+  VkPhysicalDeviceMemoryProperties props;
+  VkPrimitiveTopology topology;
+
+  MappedFile file;
+  VertexLayout layout;
+  VkDeviceSize chunk_size = 0;
+  std::vector<VertexChunk> chunks;
+  std::vector<VertexStaging> staging;
+
+  VkDeviceSize uploaded_bytes = 0;
+  std::chrono::steady_clock::time_point started_at;
+  std::optional<double> upload_seconds;
+
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<size_t> _free;
+  std::deque<size_t> _filled;
+  bool _is_closed = false;
+  // Render loop only
+  std::vector<size_t> _in_flight;
+  // Loader only
+  VkDeviceSize _next_offset = 0;
+  std::thread _loader;
+
+  VertexStream(vkb::DispatchTable dispatch, QueueTimeline &timeline,
+               const VkPhysicalDeviceMemoryProperties &props,
+               VkPrimitiveTopology topology)
+      : dispatch(dispatch), timeline(timeline), props(props),
+        topology(topology) {}
+
+  VertexStream(const VertexStream &) = delete;
+  VertexStream &operator=(const VertexStream &) = delete;
+
+  ~VertexStream() {
+    {
+      std::lock_guard lock(_mutex);
+      _is_closed = true;
+    }
+    _condition.notify_all();
+    if (_loader.joinable())
+      _loader.join();
+
+    timeline.wait(timeline.submitted);
+    for (auto &chunk : chunks)
+      if (chunk.buffer.buffer != VK_NULL_HANDLE)
+        destroy_buffer(dispatch, chunk.buffer);
+    for (auto &slot : staging)
+      destroy_buffer(dispatch, slot.buffer);
+  }
+
+  bool open(const std::filesystem::path &path, std::string &error) {
+    if (!file.open(path)) {
+      error = "cannot map " + path.string();
+      return false;
+    }
+    auto parsed = parse_vertex_layout(file.data, file.size, error);
+    if (!parsed) {
+      error = path.string() + ": " + error;
+      return false;
+    }
+    layout = parsed.value();
+
+    // Whole lines and triangles in every chunk
+    auto chunk_vertices = VERTEX_CHUNK_BYTES / layout.stride / 6 * 6;
+    chunk_size = std::max<VkDeviceSize>(chunk_vertices, 6) * layout.stride;
+    chunks.resize((layout.data_size() + chunk_size - 1) / chunk_size);
+
+    auto staging_size =
+        std::min<VkDeviceSize>(VERTEX_STAGING_BYTES, layout.data_size());
+    staging.resize(VERTEX_STAGING_COUNT);
+    for (size_t i = 0; i < staging.size(); i++) {
+      staging[i].buffer =
+          create_buffer(dispatch, props, staging_size,
+                        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      _free.push_back(i);
+    }
+
+    started_at = std::chrono::steady_clock::now();
+    _loader = std::thread([this]() { _load(); });
+    return true;
+  }
+
+  void _load() {
+    TRACE_THREAD_NAME("vertex loader");
+    auto data = file.data + layout.data_offset;
+    auto total = layout.data_size();
+    while (_next_offset < total) {
+      size_t index;
+      {
+        std::unique_lock lock(_mutex);
+        _condition.wait(lock,
+                        [this]() { return _is_closed || !_free.empty(); });
+        if (_is_closed)
+          return;
+        index = _free.front();
+        _free.pop_front();
+      }
+
+      auto &slot = staging[index];
+      auto chunk_end = (_next_offset / chunk_size + 1) * chunk_size;
+      slot.source_offset = _next_offset;
+      slot.size = std::min<VkDeviceSize>(
+          {slot.buffer.size, chunk_end - _next_offset, total - _next_offset});
+      {
+        TRACE_SCOPE("VertexStream::stage");
+        memcpy(slot.buffer.mapped, data + _next_offset, slot.size);
+      }
+      _next_offset += slot.size;
+
+      std::lock_guard lock(_mutex);
+      _filled.push_back(index);
+    }
+  }
+
+  bool is_uploaded() const { return uploaded_bytes == layout.data_size(); }
+
+  VkDeviceSize device_bytes() const {
+    VkDeviceSize bytes = 0;
+    for (auto &chunk : chunks)
+      bytes += chunk.buffer.size;
+    return bytes;
+  }
+
+  VkDeviceSize staging_bytes() const {
+    return staging.size() * staging[0].buffer.size;
+  }
+
+  // Since the stream started, or until it finished.
+  double upload_mib_per_second() const {
+    auto seconds = upload_seconds.value_or(
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      started_at)
+            .count());
+    return seconds > 0. ? uploaded_bytes / seconds / (1 << 20) : 0.;
+  }
+
+  void _release_completed() {
+    auto completed = std::stable_partition(
+        _in_flight.begin(), _in_flight.end(), [this](size_t index) {
+          return !timeline.is_complete(staging[index].timeline_value);
+        });
+    if (completed == _in_flight.end())
+      return;
+    {
+      std::lock_guard lock(_mutex);
+      _free.insert(_free.end(), completed, _in_flight.end());
+    }
+    _in_flight.erase(completed, _in_flight.end());
+    _condition.notify_all();
+  }
+
+  // Copies whatever was staged since the last frame into the chunks. Has to
+  // be recorded outside of a render pass, before the draws, into the
+  // submission that signals `timeline_value`.
+  void record_uploads(VkCommandBuffer cmd, uint64_t timeline_value) {
+    _release_completed();
+    std::deque<size_t> filled;
+    {
+      std::lock_guard lock(_mutex);
+      filled.swap(_filled);
+    }
+    if (filled.empty())
+      return;
+
+    TRACE_SCOPE("VertexStream::record_uploads");
+    for (auto index : filled) {
+      auto &slot = staging[index];
+      auto chunk_index = slot.source_offset / chunk_size;
+      auto &chunk = chunks[chunk_index];
+      if (chunk.buffer.buffer == VK_NULL_HANDLE) {
+        auto size = std::min<VkDeviceSize>(
+            chunk_size, layout.data_size() - chunk_index * chunk_size);
+        chunk.buffer = create_buffer(dispatch, props, size,
+                                     VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      }
+
+      VkBufferCopy region = {};
+      region.dstOffset = slot.source_offset % chunk_size;
+      region.size = slot.size;
+      dispatch.cmdCopyBuffer(cmd, slot.buffer.buffer, chunk.buffer.buffer, 1,
+                             &region);
+      chunk.uploaded += slot.size;
+      uploaded_bytes += slot.size;
+      slot.timeline_value = timeline_value;
+      _in_flight.push_back(index);
+    }
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    dispatch.cmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1,
+                                &barrier, 0, nullptr, 0, nullptr);
+
+    if (is_uploaded())
+      upload_seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - started_at)
+                           .count();
+  }
+
+  // Everything uploaded so far, in whole primitives.
+  std::vector<VertexDraw> draws() const {
+    uint64_t per_primitive = 1;
+    if (topology == VK_PRIMITIVE_TOPOLOGY_LINE_LIST)
+      per_primitive = 2;
+    else if (topology == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST)
+      per_primitive = 3;
+
+    std::vector<VertexDraw> draws;
+    for (auto &chunk : chunks) {
+      auto vertex_count = chunk.uploaded / layout.stride;
+      vertex_count -= vertex_count % per_primitive;
+      if (vertex_count > 0)
+        draws.push_back({chunk.buffer.buffer, (uint32_t)vertex_count});
+    }
+    return draws;
+  }
+};
+
+void print_vertex_stream(const VertexStream &stream) {
+  const double MIB = 1 << 20;
+  size_t buffer_count = 0;
+  for (auto &chunk : stream.chunks)
+    if (chunk.buffer.buffer != VK_NULL_HANDLE)
+      buffer_count++;
+
+  fprintf(stderr, "%llu vertices, %.1f MiB uploaded at %.1f MiB/s\n",
+          (unsigned long long)stream.layout.vertex_count,
+          stream.uploaded_bytes / MIB, stream.upload_mib_per_second());
+  fprintf(stderr,
+          "  %.1f MiB device local in %zu buffers, %.1f MiB staging, "
+          "%.1f MiB mapped\n",
+          stream.device_bytes() / MIB, buffer_count,
+          stream.staging_bytes() / MIB, stream.file.size / MIB);
+}
+
+} // namespace retort
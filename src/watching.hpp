@@ -6,6 +6,7 @@
 #include <filesystem>
 #include <map>
 
+#include "tracing.hpp"
 #include "utils.hpp"
 
 namespace retort {
@@ -17,16 +18,26 @@ struct FileWatcherPool {
       std::vector<std::tuple<WatchedFileId, std::filesystem::path>>;
 
   WatchedFileId watch_file(std::filesystem::path file) {
-    _filepaths[0] = file;
-    return 0;
+    for (auto &[id, path] : _filepaths)
+      if (path == file)
+        return id;
+
+    auto id = _next_id++;
+    _filepaths[id] = file;
+    return id;
   }
 
-  void forget_file(WatchedFileId id) {}
+  void forget_file(WatchedFileId id) {
+    _filepaths.erase(id);
+    _ts.erase(id);
+  }
 
+  WatchedFileId _next_id = 0;
   std::unordered_map<WatchedFileId, std::filesystem::path> _filepaths;
   std::unordered_map<WatchedFileId, std::filesystem::file_time_type> _ts;
 
   PollReturn poll_files() {
+    TRACE_SCOPE("FileWatcherPool::poll_files");
     // TODO: replace with a better notification system
     PollReturn changed;
 
@@ -0,0 +1,100 @@
+// Reads frames published by `retort --shm <name>` and reports how late they
+// arrive, measured from the moment retort submitted them to the GPU.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "../src/shared_frames.hpp"
+
+using namespace retort;
+
+struct LatencyWindow {
+  std::vector<double> end_to_end_ms;
+  std::vector<double> transport_ms;
+  uint64_t frames = 0;
+  uint64_t skipped = 0;
+
+  void report(double seconds) {
+    if (end_to_end_ms.empty()) {
+      printf("no frames\n");
+      return;
+    }
+
+    std::sort(end_to_end_ms.begin(), end_to_end_ms.end());
+    double sum = 0., transport_sum = 0.;
+    for (auto ms : end_to_end_ms)
+      sum += ms;
+    for (auto ms : transport_ms)
+      transport_sum += ms;
+
+    auto percentile = [&](double p) {
+      auto index = (size_t)(p * (end_to_end_ms.size() - 1));
+      return end_to_end_ms[index];
+    };
+
+    printf("%6.1f frames/s  skipped %4llu  latency mean %6.2fms  p50 %6.2fms  "
+           "p99 %6.2fms  max %6.2fms  transport %5.2fms\n",
+           frames / seconds, (unsigned long long)skipped,
+           sum / end_to_end_ms.size(), percentile(0.5), percentile(0.99),
+           end_to_end_ms.back(), transport_sum / transport_ms.size());
+
+    *this = {};
+  }
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: retort_shm_consumer <name> [seconds]\n");
+    return 1;
+  }
+
+  double duration = argc > 2 ? atof(argv[2]) : 0.;
+
+  SharedFrameRing ring;
+  if (!ring.open(argv[1])) {
+    fprintf(stderr, "could not open shared frames '%s'\n", argv[1]);
+    return 1;
+  }
+
+  printf("%ux%u, %u slots\n", ring.header->width, ring.header->height,
+         ring.header->slot_count);
+
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  auto window_start = start;
+
+  std::vector<uint8_t> pixels;
+  std::optional<uint64_t> last_frame;
+  LatencyWindow window;
+
+  while (duration <= 0. ||
+         std::chrono::duration<double>(clock::now() - start).count() <
+             duration) {
+    auto info = ring.read_latest(last_frame, pixels);
+    if (!info) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    } else {
+      auto now_ns = shared_frames_now_ns();
+      window.end_to_end_ms.push_back((now_ns - info->submitted_ns) / 1e6);
+      window.transport_ms.push_back((now_ns - info->published_ns) / 1e6);
+      if (last_frame)
+        window.skipped += info->frame - last_frame.value() - 1;
+      window.frames++;
+      last_frame = info->frame;
+    }
+
+    auto now = clock::now();
+    auto elapsed = std::chrono::duration<double>(now - window_start).count();
+    if (elapsed >= 1.) {
+      window.report(elapsed);
+      window_start = now;
+    }
+  }
+
+  return 0;
+}